@@ -0,0 +1,270 @@
+/*
+ * preview_bench.cpp
+ *
+ * headless benchmark of the preview scene
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ *
+ * renders the toolpath actor offscreen for synthetic programs of a range of
+ * sizes and prints one JSON object per size to stdout:
+ *
+ *   preview_bench [-w width] [-h height] [-f frames] [segments...]
+ *
+ * every size runs in a child process of its own so the peak RSS belongs to
+ * that size alone. the window is whatever offscreen render window VTK was
+ * built with (EGL, OSMesa or X), its class and the GL renderer go into the
+ * report so llvmpipe numbers aren't compared against hardware ones.
+ */
+
+#include "gcode_parser.hpp"
+#include "toolpath.hpp"
+#include "toolpath_actor.hpp"
+#include "vtkCamera.h"
+#include "vtkNew.h"
+#include "vtkRenderWindow.h"
+#include "vtkRenderer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <numeric>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace ImCNC;
+using Clock = std::chrono::steady_clock;
+
+static const std::vector<long> c_default_sizes = {10000, 100000, 1000000,
+                                                  10000000, 20000000};
+
+struct Options
+{
+  int width = 1280;
+  int height = 800;
+  int frames = 120;
+};
+
+static double ms_since(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start)
+      .count();
+}
+
+// a 3D surfacing program: rows of 1000 moves over a wavy surface, 1000 rows
+// per layer, a retract and a rapid between layers
+static int write_program(const char* path, long segments)
+{
+  FILE* f = fopen(path, "w");
+  if (!f)
+    return -1;
+
+  fprintf(f, "G21 G90 F1000\nG0 Z5\nG0 X0 Y0\n");
+  const long row_length = 1000;
+  const long layer_rows = 1000;
+  for (long i = 0; i < segments; i++) {
+    long column = i % row_length;
+    long row = (i / row_length) % layer_rows;
+    long layer = i / (row_length * layer_rows);
+    if (column == 0 && row == 0 && i > 0)
+      fprintf(f, "G0 Z5\nG0 X0 Y0\n");
+
+    double x = 0.1 * ((row % 2 == 0) ? column : row_length - 1 - column);
+    double y = 0.1 * row;
+    double z = -0.5 * layer + 0.2 * std::sin(0.3 * x) * std::cos(0.2 * y);
+    fprintf(f, "G1 X%.3f Y%.3f Z%.3f\n", x, y, z);
+  }
+  fprintf(f, "G0 Z5\nM2\n");
+  return (fclose(f) == 0) ? 0 : -1;
+}
+
+static void print_stats(const char* name, std::vector<double> times,
+                        bool last)
+{
+  std::sort(times.begin(), times.end());
+  double mean = std::accumulate(times.begin(), times.end(), 0.0) /
+                std::max<std::size_t>(times.size(), 1);
+  auto at = [&](double q) {
+    if (times.empty())
+      return 0.0;
+    return times[std::min(times.size() - 1,
+                          static_cast<std::size_t>(q * times.size()))];
+  };
+  printf("\"%s\":{\"frames\":%zu,\"mean_ms\":%.3f,\"p50_ms\":%.3f,"
+         "\"p95_ms\":%.3f,\"max_ms\":%.3f}%s",
+         name, times.size(), mean, at(0.5), at(0.95),
+         times.empty() ? 0.0 : times.back(), last ? "" : ",");
+}
+
+static std::string gl_renderer(vtkRenderWindow* window)
+{
+  std::string caps = window->ReportCapabilities();
+  auto pos = caps.find("OpenGL renderer string:");
+  if (pos == std::string::npos)
+    return "unknown";
+  auto begin = caps.find_first_not_of(' ', pos + 23);
+  auto end = caps.find('\n', begin);
+  std::string name = caps.substr(begin, end - begin);
+  // keep the report valid JSON
+  name.erase(std::remove(name.begin(), name.end(), '"'), name.end());
+  return name;
+}
+
+static int run(long segments, const Options& options)
+{
+  char path[] = "/tmp/preview_bench_XXXXXX";
+  int fd = mkstemp(path);
+  if (fd < 0) {
+    fprintf(stderr, "preview_bench: can't create a temporary file\n");
+    return -1;
+  }
+  close(fd);
+  if (write_program(path, segments) != 0) {
+    fprintf(stderr, "preview_bench: can't write %s\n", path);
+    unlink(path);
+    return -1;
+  }
+
+  auto start = Clock::now();
+  auto toolpath = std::make_shared<Toolpath>();
+  GCodeParser parser;
+  int result = parser.parse(path, *toolpath);
+  unlink(path);
+  if (result != 0) {
+    fprintf(stderr, "preview_bench: can't parse the program\n");
+    return -1;
+  }
+  double load_ms = ms_since(start);
+
+  vtkNew<vtkRenderWindow> window;
+  window->SetOffScreenRendering(true);
+  window->SetSize(options.width, options.height);
+  vtkNew<vtkRenderer> renderer;
+  window->AddRenderer(renderer);
+  vtkNew<vtkCamera> camera;
+  camera->ParallelProjectionOn();
+  renderer->SetActiveCamera(camera);
+  ToolpathActor actor;
+  renderer->AddActor(actor.get_actor());
+
+  const double aspect = double(options.width) / options.height;
+  auto frame = [&] {
+    auto begin = Clock::now();
+    actor.update_visibility(camera, aspect);
+    renderer->ResetCameraClippingRange();
+    window->Render();
+    window->WaitForCompletion();
+    return ms_since(begin);
+  };
+
+  // the first frame includes setting up the context and expanding every
+  // chunk in view
+  start = Clock::now();
+  actor.set_toolpath(toolpath);
+  auto bounds = toolpath->bounds();
+  camera->SetPosition(1, -1, 1);
+  camera->SetFocalPoint(0, 0, 0);
+  camera->SetViewUp(0, 0, 1);
+  renderer->ResetCamera(bounds.data());
+  frame();
+  double first_frame_ms = ms_since(start);
+
+  // once around the part
+  std::vector<double> orbit;
+  for (int i = 0; i < options.frames; i++) {
+    camera->Azimuth(360.0 / options.frames);
+    orbit.push_back(frame());
+  }
+
+  // into a corner of the part and back out, chunks leave and enter the view
+  std::vector<double> zoom;
+  renderer->ResetCamera(bounds.data());
+  double focal[3], position[3];
+  camera->GetFocalPoint(focal);
+  camera->GetPosition(position);
+  const double corner[3] = {bounds[0], bounds[2], bounds[5]};
+  for (int k = 0; k < 3; k++)
+    position[k] += corner[k] - focal[k];
+  camera->SetFocalPoint(corner);
+  camera->SetPosition(position);
+  const double scale = camera->GetParallelScale();
+  for (int i = 0; i < options.frames; i++) {
+    double t = double(i) / std::max(options.frames - 1, 1);
+    double zoom_factor = std::pow(100.0, 1.0 - std::abs(2 * t - 1));
+    camera->SetParallelScale(scale / zoom_factor);
+    zoom.push_back(frame());
+  }
+
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  printf("{\"segments\":%ld,\"vertices\":%zu,\"window\":\"%s\","
+         "\"renderer\":\"%s\",\"width\":%d,\"height\":%d,"
+         "\"load_ms\":%.3f,\"first_frame_ms\":%.3f,\"peak_rss_kb\":%ld,",
+         segments, toolpath->vertex_count(), window->GetClassName(),
+         gl_renderer(window).c_str(), options.width, options.height, load_ms,
+         first_frame_ms, usage.ru_maxrss);
+  print_stats("orbit", orbit, false);
+  print_stats("zoom", zoom, true);
+  printf("}\n");
+  fflush(stdout);
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  Options options;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:h:f:")) != -1) {
+    switch (opt) {
+    case 'w':
+      options.width = atoi(optarg);
+      break;
+    case 'h':
+      options.height = atoi(optarg);
+      break;
+    case 'f':
+      options.frames = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr,
+              "usage: %s [-w width] [-h height] [-f frames] [segments...]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+  if (options.width <= 0 || options.height <= 0 || options.frames <= 0) {
+    fprintf(stderr, "preview_bench: invalid size or frame count\n");
+    return 1;
+  }
+
+  std::vector<long> sizes;
+  for (int i = optind; i < argc; i++)
+    sizes.push_back(atol(argv[i]));
+  if (sizes.empty())
+    sizes = c_default_sizes;
+
+  int failed = 0;
+  for (long segments : sizes) {
+    fprintf(stderr, "preview_bench: %ld segments\n", segments);
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+      perror("preview_bench: fork");
+      return 1;
+    }
+    if (pid == 0)
+      _exit(run(segments, options) == 0 ? 0 : 1);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "preview_bench: %ld segments failed\n", segments);
+      failed++;
+    }
+  }
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * bvh.hpp
+ *
+ * bounding volume hierarchy over axis aligned boxes
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace ImCNC {
+
+struct Aabb
+{
+  std::array<float, 3> min{std::numeric_limits<float>::max(),
+                           std::numeric_limits<float>::max(),
+                           std::numeric_limits<float>::max()};
+  std::array<float, 3> max{std::numeric_limits<float>::lowest(),
+                           std::numeric_limits<float>::lowest(),
+                           std::numeric_limits<float>::lowest()};
+
+  void extend(const Aabb& box)
+  {
+    for (int i = 0; i < 3; i++) {
+      min[i] = std::min(min[i], box.min[i]);
+      max[i] = std::max(max[i], box.max[i]);
+    }
+  }
+
+  void extend(double x, double y, double z)
+  {
+    const double p[] = {x, y, z};
+    for (int i = 0; i < 3; i++) {
+      min[i] = std::min(min[i], static_cast<float>(p[i]));
+      max[i] = std::max(max[i], static_cast<float>(p[i]));
+    }
+  }
+
+  bool overlaps(const Aabb& box) const
+  {
+    for (int i = 0; i < 3; i++) {
+      if (box.max[i] < min[i] || box.min[i] > max[i])
+        return false;
+    }
+    return true;
+  }
+};
+
+// binary BVH built by median splits. primitives are only known by their
+// index into the boxes passed to build(), the caller does the exact tests.
+class Bvh
+{
+public:
+  // the top levels are built in parallel on up to threads threads
+  void build(const std::vector<Aabb>& boxes, unsigned threads = 0);
+  void clear();
+  bool empty() const { return m_nodes.empty(); }
+  std::size_t size() const { return m_indices.size(); }
+
+  // calls visit(primitive) for all primitives in leaves whose box passes
+  // test(box). visit returns false to stop the traversal.
+  template <class Test, class Visit>
+  void query(Test&& test, Visit&& visit) const
+  {
+    if (m_nodes.empty())
+      return;
+
+    std::uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+      const Node& node = m_nodes[stack[--top]];
+      if (!test(node.box))
+        continue;
+
+      if (node.count > 0) {
+        for (auto i = node.first; i < node.first + node.count; i++) {
+          if (!visit(m_indices[i]))
+            return;
+        }
+      }
+      else {
+        std::uint32_t self = static_cast<std::uint32_t>(&node - &m_nodes[0]);
+        stack[top++] = node.first; // right
+        stack[top++] = self + 1;   // left
+      }
+    }
+  }
+
+private:
+  // leaves have count > 0 and first indexes m_indices, inner nodes have
+  // their left child right behind them and first is the right child
+  struct Node
+  {
+    Aabb box;
+    std::uint32_t first;
+    std::uint32_t count;
+  };
+
+  void _build(const std::vector<Aabb>& boxes,
+              const std::vector<std::array<float, 3>>& centers,
+              std::uint32_t begin, std::uint32_t end, int depth,
+              std::vector<Node>& nodes);
+
+  std::vector<Node> m_nodes;
+  std::vector<std::uint32_t> m_indices;
+};
+
+} // namespace ImCNC
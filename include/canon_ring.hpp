@@ -0,0 +1,82 @@
+/*
+ * canon_ring.hpp
+ *
+ * canon calls passed from the interpreter worker to the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace ImCNC {
+
+enum class CanonOp : std::uint8_t {
+  TRAVERSE, // x, y, z
+  FEED,     // x, y, z
+  PROBE,    // x, y, z
+  // first_end, second_end, first_axis, second_axis, rotation, axis_end
+  ARC,
+  PLANE,    // 1 XY, 2 YZ, 3 XZ (CANON_PLANE)
+  UNITS,    // mm per program unit
+  G5X,      // x, y, z
+  G92,      // x, y, z
+  ROTATION, // degrees
+  ERROR,    // text follows the header
+  END,      // line is the interpreter's last status
+};
+
+// 8 bytes of header and size - 8 bytes of values, moves take 32 bytes.
+// sizes are multiples of 8, only error texts use the full record.
+struct CanonRecord
+{
+  static constexpr std::size_t c_max_values = 31;
+
+  CanonOp op;
+  std::uint8_t reserved;
+  std::uint16_t size;
+  std::int32_t line;
+  double values[c_max_values];
+};
+
+// single producer, single consumer byte ring in a memfd shared between the
+// preview and the worker process. both sides wait on futexes in the shared
+// page, the producer while the ring is full, the consumer while it's empty.
+// either side can give up: the consumer cancels, the producer closes.
+class CanonRing
+{
+public:
+  static constexpr std::size_t c_capacity = 4 << 20;
+
+  CanonRing() = default;
+  CanonRing(const CanonRing&) = delete;
+  CanonRing& operator=(const CanonRing&) = delete;
+  ~CanonRing();
+
+  // consumer side, the fd is inherited by the worker
+  int create();
+  // producer side
+  int attach(int fd);
+  int fd() const { return m_fd; }
+
+  // producer. blocks while the ring is full, -1 once cancelled.
+  int write(const void* data, std::size_t size);
+  void close_writer();
+  bool cancelled() const;
+
+  // consumer. copies what is there, at most size bytes and maybe ending in
+  // the middle of a record, waiting up to timeout_ms for something to
+  // arrive. 0 if nothing came.
+  std::size_t read(void* data, std::size_t size, int timeout_ms);
+  bool closed() const;
+  void cancel();
+
+private:
+  struct Shared;
+
+  Shared* m_shared = nullptr;
+  int m_fd = -1;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,68 @@
+/*
+ * collision.hpp
+ *
+ * tool against fixture collision check
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "bvh.hpp"
+
+#include <array>
+#include <string>
+#include <vector>
+
+namespace ImCNC {
+
+class Toolpath;
+
+using Triangle = std::array<std::array<float, 3>, 3>;
+
+// binary or ASCII STL, appended to triangles. degenerate triangles are
+// dropped.
+int load_stl(const std::string& path, std::vector<Triangle>& triangles);
+
+struct CollisionMesh
+{
+  std::vector<Triangle> triangles;
+  // the part is cut on purpose, only rapids must stay clear of it
+  bool part = false;
+};
+
+// sweeps the tool, a cylinder standing on its tip, along a toolpath and
+// reports the lines getting closer than a clearance to any mesh. the tool
+// is treated as rounded by its radius below the tip, which errs on the
+// side of reporting.
+class CollisionCheck
+{
+public:
+  struct Hit
+  {
+    int line;
+    // gap between tool and mesh, negative for a collision
+    double distance;
+  };
+
+  // meshes are in machine coordinates
+  void set_meshes(const std::vector<CollisionMesh>& meshes,
+                  unsigned threads = 0);
+
+  // transform maps program coordinates to where the tool tip is in machine
+  // coordinates, without the tool offset that moves the controlled point up
+  // to the spindle. as the upper 3x4 of a row major matrix. hits are sorted
+  // by line, one per line.
+  std::vector<Hit> check(const Toolpath& toolpath,
+                         const std::array<double, 12>& transform,
+                         double radius, double length, double clearance,
+                         unsigned threads = 0) const;
+
+private:
+  std::vector<Triangle> m_triangles;
+  std::vector<bool> m_part;
+  // center and radius
+  std::vector<std::array<float, 4>> m_spheres;
+  Bvh m_bvh;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,36 @@
+/*
+ * file_watcher.hpp
+ *
+ * notices when a file is rewritten
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <string>
+
+namespace ImCNC {
+
+// inotify on the file's directory, so editors that save by writing a new
+// file and renaming it over the old one are noticed as well
+class FileWatcher
+{
+public:
+  FileWatcher() = default;
+  FileWatcher(const FileWatcher&) = delete;
+  FileWatcher& operator=(const FileWatcher&) = delete;
+  ~FileWatcher();
+
+  // stops watching the file before
+  int watch(const std::string& path);
+  // true if the file was written or replaced since the last call, doesn't
+  // block
+  bool changed();
+
+private:
+  int m_fd = -1;
+  int m_wd = -1;
+  std::string m_name;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,83 @@
+/*
+ * gcode_parser.hpp
+ *
+ * minimal g-code reader for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace ImCNC {
+
+class Toolpath;
+
+// reads just enough g-code to draw a toolpath: G0/G1/G2/G3 (with P turns)
+// in all three planes, G17-G19, G20/G21, G90/G91 and G90.1/G91.1.
+// everything else (subroutines, parameters, expressions, canned cycles,
+// cutter compensation) is ignored, the interpreter stays the reference.
+// coordinates are program coordinates in mm.
+class GCodeParser
+{
+public:
+  struct State
+  {
+    std::array<double, 3> position{0, 0, 0};
+    int motion_mode = 0; // G code * 10, -1 for G80
+    int plane = 170;
+    double units = 1.0; // mm per program unit
+    bool absolute = true;
+    bool arc_absolute = false;
+
+    bool operator==(const State&) const = default;
+  };
+
+  // the modal state at the start of every c_checkpoint_lines-th line and a
+  // hash of every line, what update() needs to parse a changed program
+  // from the first changed line on
+  struct Index
+  {
+    struct Checkpoint
+    {
+      int line;
+      std::uint32_t vertex; // vertex count before the line
+      State state;
+    };
+
+    std::vector<std::uint64_t> line_hashes;
+    std::vector<Checkpoint> checkpoints;
+    // line of the M2/M30 that ended the program, 0 for the end of the file
+    int end_line = 0;
+  };
+
+  static constexpr int c_checkpoint_lines = 4096;
+
+  int parse(const std::string& path, Toolpath& toolpath);
+  int parse(std::istream& in, Toolpath& toolpath);
+  // the same, recording the index
+  int parse(const std::string& path, Toolpath& toolpath, Index& index);
+  // the program again after it changed, old and old_index are from the
+  // last parse. lines are parsed from the checkpoint before the first
+  // changed line until the modal state at a checkpoint after the last
+  // changed line is the same as it was, the vertices from there on are
+  // copied from old. 1 if the toolpath stays the same (toolpath is left
+  // alone, index is updated), -1 if the file can't be read.
+  int update(const std::string& path, const Toolpath& old,
+             const Index& old_index, Toolpath& toolpath, Index& index);
+
+private:
+  // returns false at program end (M2/M30)
+  bool _parse_line(int line_nr, const std::string& line, Toolpath& toolpath);
+  void _arc(int line_nr, bool clockwise, const std::array<double, 3>& end,
+            const std::array<double, 3>& offset, bool has_offset,
+            double radius, int turns, Toolpath& toolpath);
+
+  State m_state;
+};
+
+} // namespace ImCNC
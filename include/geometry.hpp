@@ -0,0 +1,51 @@
+/*
+ * geometry.hpp
+ *
+ * distance tests between points, segments and triangles
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <array>
+
+namespace ImCNC {
+
+using Vec = std::array<double, 3>;
+
+inline double dot(const Vec& a, const Vec& b)
+{
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+inline Vec sub(const Vec& a, const Vec& b)
+{
+  return {a[0] - b[0], a[1] - b[1], a[2] - b[2]};
+}
+
+inline Vec cross(const Vec& a, const Vec& b)
+{
+  return {a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2],
+          a[0] * b[1] - a[1] * b[0]};
+}
+
+// closest points of the segments p0-p1 and q0-q1, returns the squared
+// distance and the parameter s on p0-p1
+double segment_distance2(const Vec& p0, const Vec& p1, const Vec& q0,
+                         const Vec& q1, double& s);
+
+// point of the triangle a, b, c closest to p
+Vec closest_on_triangle(const Vec& p, const Vec& a, const Vec& b,
+                        const Vec& c);
+
+// squared distance between the segment p0-p1 and the triangle t, 0 if the
+// segment passes through it
+double segment_triangle_distance2(const Vec& p0, const Vec& p1,
+                                  const std::array<Vec, 3>& t);
+
+// squared distance between two triangles, 0 if they intersect. t may be
+// degenerate, u must not.
+double triangle_distance2(const std::array<Vec, 3>& t,
+                          const std::array<Vec, 3>& u);
+
+} // namespace ImCNC
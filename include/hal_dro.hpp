@@ -0,0 +1,51 @@
+/*
+ * hal_dro.hpp
+ *
+ * axis positions read from the motion pins
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace ImCNC {
+
+// machine positions straight from the pins motion writes every servo
+// period, the NML status only has them at the task cycle. the commanded
+// position of axis L is axis.L.pos-cmd. the actual one is joint.N.pos-fb
+// of the first joint the coordinates= of trivkins map to L, other
+// kinematics have no pin for it. the pin pointers are looked up again when
+// the HAL structure changes, which is checked every c_refresh, reading them
+// takes no lock.
+class HalDro
+{
+public:
+  static constexpr int c_axes = 9; // XYZABCUVW
+  static constexpr std::chrono::seconds c_refresh{1};
+
+  // [KINS]KINEMATICS of the INI file, the module and its arguments
+  void set_kinematics(const std::string& kinematics);
+  // -1 without HAL or without motion's pins
+  int update();
+
+  // false if there is no pin for the axis
+  bool commanded(int axis, double& position) const;
+  bool actual(int axis, double& position) const;
+
+private:
+  void _resolve();
+
+  // -1 without a joint or without identity kinematics
+  std::array<int, c_axes> m_joints = {-1, -1, -1, -1, -1, -1, -1, -1, -1};
+  std::array<const volatile double*, c_axes> m_cmd{};
+  std::array<const volatile double*, c_axes> m_fb{};
+  std::uint64_t m_stamp = 0;
+  std::chrono::steady_clock::time_point m_checked;
+  bool m_found = false;
+};
+
+} // namespace ImCNC
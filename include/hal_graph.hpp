@@ -0,0 +1,91 @@
+/*
+ * hal_graph.hpp
+ *
+ * the HAL netlist as a graph of components
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace ImCNC {
+
+struct HalSnapshot;
+
+// the netlist of a HalSnapshot: components are the nodes, their linked pins
+// the ports, and a signal is a link from the pin writing it to every other
+// pin linked to it. a signal without an OUT pin is written by its first IO
+// pin. pins that are not linked are only counted.
+struct HalGraph
+{
+  struct Node
+  {
+    int comp; // index in the snapshot's comps
+    std::vector<int> inputs;  // IN and IO pins, indices in the snapshot
+    std::vector<int> outputs; // OUT pins
+    int unlinked = 0;
+  };
+
+  struct Link
+  {
+    int from; // pins
+    int to;
+    int signal;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<Link> links;
+  // node of every pin in the snapshot, -1 if it isn't linked
+  std::vector<int> pin_nodes;
+  // of the component and pin names and the links, the same config loaded
+  // again gets the same key
+  std::uint64_t key = 0;
+
+  void build(const HalSnapshot& snapshot);
+};
+
+// top left corner of every node, in the order of the graph's nodes
+struct HalLayout
+{
+  std::uint64_t key = 0;
+  std::vector<std::array<float, 2>> positions;
+};
+
+// a layered layout, signals run left to right: cycles are broken by turning
+// the links that close them around, every component goes one column right
+// of the last component it reads from and the order in every column is
+// improved by moving components to the mean position of their neighbours,
+// a few sweeps back and forth. components without links are put into
+// columns of their own at the right. sizes are width and height per node.
+HalLayout layout_graph(const HalGraph& graph,
+                       const std::vector<std::array<float, 2>>& sizes);
+
+// runs layout_graph on a thread of its own and keeps the layouts by graph
+// key, in memory and in $XDG_CACHE_HOME/cockpit, so a config seen before
+// doesn't wait for it.
+class HalGraphLayouts
+{
+public:
+  HalGraphLayouts();
+
+  // the layout for the graph, nullptr while it is computed
+  const HalLayout* get(const HalGraph& graph,
+                       const std::vector<std::array<float, 2>>& sizes);
+
+private:
+  std::string _file_name(std::uint64_t key) const;
+  int _load(std::uint64_t key, std::size_t nodes, HalLayout& layout) const;
+  int _store(const HalLayout& layout) const;
+
+  std::string m_dir; // "" if there is no cache
+  std::map<std::uint64_t, HalLayout> m_layouts;
+  std::future<HalLayout> m_pending;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,97 @@
+/*
+ * hal_latency.hpp
+ *
+ * runtime distribution of the HAL threads and functions
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ImCNC {
+
+struct HalSnapshot;
+
+// reads the <name>.time pins HAL exports for every thread and function on
+// a thread of its own, every c_poll. runtimes are in CPU clocks, on x86
+// the TSC rate is measured once to turn them into ns. for every thread
+// and function it keeps a histogram of the last c_window samples (8
+// buckets per octave, so percentiles are good to about 9%), counts the
+// runs of threads that took longer than their period and keeps the
+// largest runtime of every c_history_step for a sparkline.
+//
+// the <name>.time pins only change when the thread runs, a value equal to
+// the one read before is taken as the same run. threads faster than c_poll
+// are sampled, not recorded run by run.
+class HalLatency
+{
+public:
+  static constexpr std::chrono::microseconds c_poll{500};
+  static constexpr int c_window = 20000;
+  static constexpr int c_buckets = 160;
+  static constexpr double c_first_bucket = 100; // ns
+  static constexpr int c_history = 100;
+  static constexpr std::chrono::milliseconds c_history_step{100};
+
+  struct Stats
+  {
+    std::string name;
+    bool thread = false;
+    int item = 0; // index in the snapshot's threads or functs
+    long period = 0; // ns, threads only
+    double mean = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double max = 0;  // ns, in the window
+    double tmax = 0; // ns, HAL's own maximum since it was reset
+    std::uint64_t runs = 0;
+    std::uint64_t overruns = 0;
+    // largest runtime per step in ns, oldest first
+    std::array<float, c_history> history{};
+  };
+
+  HalLatency() = default;
+  HalLatency(const HalLatency&) = delete;
+  HalLatency& operator=(const HalLatency&) = delete;
+  ~HalLatency();
+
+  // starts over with the threads and functions of the snapshot
+  void start(const HalSnapshot& snapshot);
+  void stop();
+  // copies what is there now
+  void stats(std::vector<Stats>& out) const;
+
+private:
+  struct Source
+  {
+    Stats stats;
+    const volatile std::int32_t* time;
+    const volatile std::int32_t* tmax;
+    std::int32_t last = -1;
+    std::array<int, c_buckets> histogram{};
+    std::vector<float> window; // ns, a ring
+    int window_size = 0;
+    int window_at = 0;
+    float step_max = 0;
+  };
+
+  void _poll();
+  void _add(Source& source, double ns);
+  void _update(Source& source);
+
+  std::vector<Source> m_sources;
+  double m_ns_per_clock = 1; // poll thread only
+  mutable std::mutex m_mutex;
+  std::atomic<bool> m_stop = false;
+  std::thread m_thread;
+};
+
+} // namespace ImCNC
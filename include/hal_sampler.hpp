@@ -0,0 +1,110 @@
+/*
+ * hal_sampler.hpp
+ *
+ * HAL values sampled at a fixed rate
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include "hal.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ImCNC {
+
+// halscope-lite: a thread of its own reads pins or signals through the
+// value pointers of a HalSnapshot at up to a few kHz. every channel has a
+// ring of the last c_capacity samples, with one ring of CLOCK_MONOTONIC
+// timestamps shared by all of them. the sampler never waits for readers,
+// it overwrites the oldest samples; readers check afterwards that what they
+// copied wasn't overwritten meanwhile.
+//
+// a capture drains the rings into a file on another thread: csv if the
+// name ends in .csv, otherwise a text header and rows of native doubles.
+class HalSampler
+{
+public:
+  static constexpr std::size_t c_capacity = 1 << 17;
+  static constexpr double c_max_rate = 10000;
+
+  struct Channel
+  {
+    std::string name;
+    hal_type_t type;
+    const volatile void* value;
+  };
+
+  HalSampler() = default;
+  HalSampler(const HalSampler&) = delete;
+  HalSampler& operator=(const HalSampler&) = delete;
+  ~HalSampler();
+
+  // stops sampling and capturing before, the rings start empty
+  int start(std::vector<Channel> channels, double rate);
+  void stop();
+  bool running() const { return m_thread.joinable(); }
+  const std::vector<Channel>& channels() const { return m_channels; }
+  double rate() const { return m_rate; }
+
+  // samples taken since start(), sample i is kept while
+  // i + c_capacity > count()
+  std::uint64_t count() const
+  {
+    return m_count.load(std::memory_order_acquire);
+  }
+  // ticks the sampler was too late for
+  std::uint64_t missed() const
+  {
+    return m_missed.load(std::memory_order_relaxed);
+  }
+  double time(std::uint64_t sample) const;
+  double value(int channel, std::uint64_t sample) const;
+  // false if the sample was overwritten while it was read, or is gone
+  bool kept(std::uint64_t sample) const;
+
+  // the smallest and largest value of each of columns equal slices of the
+  // samples from first to last. NaN for slices without samples.
+  void decimate(int channel, std::uint64_t first, std::uint64_t last,
+                int columns, float* min, float* max) const;
+
+  int capture(const std::string& path);
+  void stop_capture();
+  bool capturing() const { return m_writer.joinable(); }
+  // samples written and samples lost because the writer fell behind
+  std::uint64_t captured() const
+  {
+    return m_captured.load(std::memory_order_relaxed);
+  }
+  std::uint64_t dropped() const
+  {
+    return m_dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  void _sample();
+  void _write(std::FILE* f, bool csv);
+
+  std::vector<Channel> m_channels;
+  double m_rate = 1000;
+  std::unique_ptr<std::atomic<double>[]> m_times;
+  // channel * c_capacity + sample % c_capacity
+  std::unique_ptr<std::atomic<double>[]> m_values;
+  std::atomic<std::uint64_t> m_count = 0;
+  std::atomic<std::uint64_t> m_missed = 0;
+  std::atomic<bool> m_stop = false;
+  std::thread m_thread;
+
+  std::atomic<bool> m_stop_capture = false;
+  std::atomic<std::uint64_t> m_captured = 0;
+  std::atomic<std::uint64_t> m_dropped = 0;
+  std::thread m_writer;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,67 @@
+/*
+ * hal_search.hpp
+ *
+ * finding HAL names as they are typed
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace ImCNC {
+
+struct HalSnapshot;
+
+// the pin, parameter and signal names of a HalSnapshot in one lowercased
+// block, built when the HAL structure changes. a query matches a name if
+// its characters appear in the name in order ("sg2vel" finds
+// hm2_7i96.0.stepgen.02.velocity-fb); matches at the start of a name part
+// and runs of matching characters score higher. every name keeps a mask of
+// the characters in it, names missing one of the query's are skipped
+// without looking at them. a query that extends the one before only looks
+// at the names that matched that one.
+class HalSearch
+{
+public:
+  enum class Kind : std::uint8_t {
+    PIN,
+    PARAM,
+    SIGNAL,
+  };
+
+  struct Result
+  {
+    Kind kind;
+    int item; // index in the snapshot's list of that kind
+    int score;
+  };
+
+  void build(const HalSnapshot& snapshot);
+  // best matches first, nothing for an empty query
+  const std::vector<Result>& search(const char* query);
+  const std::vector<Result>& results() const { return m_results; }
+
+private:
+  struct Entry
+  {
+    std::uint32_t name; // offset in m_names
+    std::uint32_t length;
+    std::uint64_t mask;
+    Kind kind;
+    int item;
+  };
+
+  void _add(const char* name, Kind kind, int item);
+
+  std::string m_names;
+  std::vector<Entry> m_entries;
+  std::string m_query;
+  // entries that matched m_query
+  std::vector<int> m_matches;
+  std::vector<Result> m_results;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,104 @@
+/*
+ * hal_snapshot.hpp
+ *
+ * private copy of the HAL lists
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include "hal.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace ImCNC {
+
+// the HAL lists copied under hal_data->mutex, so everything built from them
+// runs without the lock. values are not copied, they are read through
+// pointers into the HAL shared memory, which stays mapped. the lists are
+// only as fresh as the last take().
+struct HalSnapshot
+{
+  struct Comp
+  {
+    char name[HAL_NAME_LEN + 1];
+    int comp_id;
+    int pid;
+    int type;
+    int offset; // in the HAL shared memory
+  };
+
+  struct Pin
+  {
+    char name[HAL_NAME_LEN + 1];
+    char signal[HAL_NAME_LEN + 1]; // "" if not linked
+    hal_type_t type;
+    hal_pin_dir_t dir;
+    const volatile void* value;
+    int owner; // index in comps
+  };
+
+  struct Signal
+  {
+    char name[HAL_NAME_LEN + 1];
+    hal_type_t type;
+    int readers;
+    int writers;
+    int bidirs;
+    const volatile void* value;
+  };
+
+  struct Param
+  {
+    char name[HAL_NAME_LEN + 1];
+    hal_type_t type;
+    hal_param_dir_t dir;
+    const volatile void* value;
+  };
+
+  struct Funct
+  {
+    char name[HAL_NAME_LEN + 1];
+    char owner[HAL_NAME_LEN + 1];
+    bool uses_fp;
+    bool reentrant;
+    const volatile hal_s32_t* maxtime;
+    int offset; // in the HAL shared memory
+    int thread; // first thread it was added to, -1 for none
+  };
+
+  struct Thread
+  {
+    char name[HAL_NAME_LEN + 1];
+    long period;
+    int priority;
+    int task_id;
+    // its functions in the order they run, in thread_functs
+    int first_funct;
+    int funct_count;
+  };
+
+  std::vector<Comp> comps;
+  std::vector<Pin> pins;
+  std::vector<Signal> signals;
+  std::vector<Param> params;
+  std::vector<Funct> functs;
+  std::vector<Thread> threads;
+  // indices into functs
+  std::vector<int> thread_functs;
+
+  // hash of the list structure when the copy was taken
+  std::uint64_t stamp = 0;
+
+  // the lists keep their storage, once they have grown to the size of the
+  // HAL nothing is allocated while the mutex is held. -1 without HAL.
+  int take();
+  // hash of which objects there are and which pins are linked to which
+  // signals, nothing is copied. 0 without HAL.
+  static std::uint64_t current_stamp();
+  // the same, for callers that hold hal_data->mutex
+  static std::uint64_t locked_stamp();
+};
+
+} // namespace ImCNC
@@ -0,0 +1,64 @@
+/*
+ * hal_tree.hpp
+ *
+ * HAL names as a tree for the browser
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace ImCNC {
+
+// the names of a HalSnapshot list (pins, parameters) split at the dots and
+// flattened in display order. built when the HAL structure changes, the
+// open branches carry over. drawn with a clipper, only the visible rows
+// cost anything.
+class HalTree
+{
+public:
+  struct Node
+  {
+    std::string path;  // up to and including this node's part
+    std::size_t label; // where this node's part starts in path
+    int depth;
+    int end;  // after the last node below this one
+    int item; // index in the list, -1 for branches
+    bool open;
+  };
+
+  // items sorted by name, as HAL keeps them
+  template <class Item>
+  void build(const std::vector<Item>& items)
+  {
+    _begin();
+    for (std::size_t i = 0; i < items.size(); i++)
+      _add(items[i].name, static_cast<int>(i));
+    _end();
+  }
+
+  // leaf(item, label) draws a leaf in one line
+  void draw(const std::function<void(int, const char*)>& leaf);
+
+  const std::vector<Node>& nodes() const { return m_nodes; }
+
+private:
+  void _begin();
+  void _add(const char* name, int item);
+  void _end();
+  void _update_rows();
+
+  std::vector<Node> m_nodes;
+  // indices of the nodes below open branches
+  std::vector<int> m_rows;
+  // open branches of the tree before
+  std::unordered_set<std::string> m_was_open;
+  std::vector<int> m_branches;
+};
+
+} // namespace ImCNC
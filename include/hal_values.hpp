@@ -0,0 +1,87 @@
+/*
+ * hal_values.hpp
+ *
+ * every HAL value at one moment, saved and compared
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include "hal.h"
+#include "hal_search.hpp"
+
+#include <cstdint>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace ImCNC {
+
+struct HalSnapshot;
+
+// the values of all bit, s32, u32 and float pins, parameters and signals,
+// copied in one go under hal_data->mutex. the values are kept in one array
+// per type, what they are is kept in a layout that is built once per HAL
+// structure and shared by all values taken with it. values with the same
+// layout are compared array by array, others by name.
+struct HalValues
+{
+  struct Entry
+  {
+    std::uint32_t name; // offset in the layout's names
+    HalSearch::Kind kind;
+    hal_type_t type;
+    std::uint32_t index; // in the array of its type
+  };
+
+  struct Layout
+  {
+    std::uint64_t stamp = 0; // of the snapshot, 0 if loaded
+    std::uint64_t key = 0;   // of the names and types
+    std::string names;       // '\0' after every name
+    std::vector<Entry> entries;
+    // entries ordered by kind and name
+    std::vector<int> by_name;
+    // entries of each array
+    std::vector<int> bit_entries;
+    std::vector<int> s32_entries;
+    std::vector<int> u32_entries;
+    std::vector<int> float_entries;
+    // where the values are read from while the stamp is current
+    std::vector<const volatile void*> sources;
+
+    const char* name(int entry) const
+    {
+      return names.data() + entries[entry].name;
+    }
+  };
+
+  std::shared_ptr<const Layout> layout;
+  std::vector<std::uint8_t> bits;
+  std::vector<std::int32_t> s32s;
+  std::vector<std::uint32_t> u32s;
+  std::vector<double> floats;
+  std::time_t time = 0;
+
+  // -1 without HAL or if the HAL structure changed since the snapshot was
+  // taken. reuses the layout if it was taken with the same snapshot before.
+  int take(const HalSnapshot& snapshot);
+  double value(int entry) const;
+
+  // a small binary file, loaded values have a layout of their own
+  int save(const char* path) const;
+  int load(const char* path);
+};
+
+// an entry that differs, -1 if the name is only in the other values
+struct HalValueChange
+{
+  int a;
+  int b;
+};
+
+// by kind and name
+std::vector<HalValueChange> diff(const HalValues& a, const HalValues& b);
+
+} // namespace ImCNC
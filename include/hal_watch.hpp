@@ -0,0 +1,104 @@
+/*
+ * hal_watch.hpp
+ *
+ * HAL values watched for changes and triggers
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#pragma once
+
+#include "hal_sampler.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace ImCNC {
+
+// a HalSampler of its own samples the watched values, a second thread goes
+// through every sample to count changes and look for triggers. when one
+// fires, the samples of all watched values from pre seconds before to post
+// seconds after it are copied out of the rings into a capture; the last
+// c_max_captures are kept. the trigger is armed again once its capture is
+// taken.
+class HalWatch
+{
+public:
+  static constexpr int c_max_captures = 8;
+
+  enum class Trigger : std::uint8_t {
+    NONE,
+    RISING,  // from below the threshold to at or above it
+    FALLING, // from at or above the threshold to below it
+    CHANGE,
+  };
+
+  struct Status
+  {
+    double value = 0;
+    std::uint64_t changes = 0;
+  };
+
+  struct Capture
+  {
+    int entry; // that triggered
+    double time;
+    std::vector<std::string> names;
+    std::vector<double> times;
+    std::vector<std::vector<double>> values; // per channel
+    std::size_t trigger; // index in times
+  };
+
+  HalWatch() = default;
+  HalWatch(const HalWatch&) = delete;
+  HalWatch& operator=(const HalWatch&) = delete;
+  ~HalWatch();
+
+  // keeps the triggers of entries that were watched before
+  int start(std::vector<HalSampler::Channel> channels, double rate);
+  void stop();
+  bool running() const { return m_thread.joinable(); }
+  const std::vector<HalSampler::Channel>& channels() const
+  {
+    return m_sampler.channels();
+  }
+
+  void set_trigger(int entry, Trigger trigger, double threshold);
+  Trigger trigger(int entry) const;
+  double threshold(int entry) const;
+  void set_window(double pre, double post);
+
+  std::vector<Status> status() const;
+  std::vector<Capture> captures() const;
+  // goes up with every capture and clear, to see when captures() changed
+  std::uint64_t taken() const;
+  void clear_captures();
+
+private:
+  struct Entry
+  {
+    std::string name;
+    Trigger trigger = Trigger::NONE;
+    double threshold = 0.5;
+    Status status;
+    bool started = false;
+  };
+
+  void _scan();
+  void _capture(std::uint64_t sample, int entry);
+
+  HalSampler m_sampler;
+  mutable std::mutex m_mutex;
+  std::vector<Entry> m_entries;
+  double m_pre = 0.1;
+  double m_post = 0.1;
+  std::vector<Capture> m_captures;
+  std::uint64_t m_taken = 0;
+  std::atomic<bool> m_stop = false;
+  std::thread m_thread;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,76 @@
+/*
+ * heightmap.hpp
+ *
+ * Z heightmap stock removal simulation
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace ImCNC {
+
+class Toolpath;
+
+// the top of the stock as a grid of heights, cut by a flat end mill moving
+// along straight segments. this only covers 3 axis work, the tool never
+// undercuts.
+//
+// the grid is split into square tiles of c_tile_size nodes, which are both
+// the unit of parallel work and of change tracking.
+class Heightmap
+{
+public:
+  static constexpr int c_tile_size = 64;
+
+  // stock box xmin, xmax, ymin, ymax, zmin, zmax and the node spacing, in
+  // program coordinates. every tile is dirty afterwards.
+  int reset(const std::array<double, 6>& stock, double cell);
+
+  // one move of the tool tip
+  void cut(const std::array<double, 3>& from, const std::array<double, 3>& to,
+           double radius);
+  // the whole program, spread over threads by tile
+  void cut(const Toolpath& toolpath, double radius, unsigned threads = 0);
+
+  int nodes_x() const { return m_nx; }
+  int nodes_y() const { return m_ny; }
+  double node_x(int i) const { return m_stock[0] + i * m_cell; }
+  double node_y(int j) const { return m_stock[2] + j * m_cell; }
+  float height(int i, int j) const { return m_heights[j * m_nx + i]; }
+
+  int tiles_x() const { return m_tx; }
+  int tiles_y() const { return m_ty; }
+  // out of range tiles are never dirty
+  bool dirty(int tx, int ty) const;
+  void clear_dirty();
+
+private:
+  // node rectangle [i0, i1) x [j0, j1)
+  struct Rect
+  {
+    int i0, i1, j0, j1;
+  };
+
+  Rect _reach(const std::array<double, 3>& from,
+              const std::array<double, 3>& to, double radius) const;
+  Rect _tile_rect(int tx, int ty) const;
+  // returns true if any node got lower
+  bool _sweep(const std::array<double, 3>& from,
+              const std::array<double, 3>& to, double radius, Rect rect);
+  void _mark(const Rect& rect);
+
+  std::array<double, 6> m_stock{0, 0, 0, 0, 0, 0};
+  double m_cell = 1;
+  int m_nx = 0;
+  int m_ny = 0;
+  int m_tx = 0;
+  int m_ty = 0;
+  std::vector<float> m_heights;
+  std::vector<std::uint8_t> m_dirty;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,57 @@
+/*
+ * interp_source.hpp
+ *
+ * preview toolpaths from the LinuxCNC interpreter
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+namespace ImCNC {
+
+class CanonRing;
+class Toolpath;
+
+// runs the real interpreter on a program in a worker process
+// (preview_interp, next to the cockpit binary) against a canon that only
+// passes the moves on, like AXIS does with gcodemodule. so remaps,
+// subroutines, named parameters and cutter compensation come out the way
+// the machine will run them. the canon calls come back through a CanonRing
+// and are built into a toolpath on a thread of the source's own.
+//
+// the toolpath is in the program coordinates the program starts moving in,
+// inches are converted to mm.
+class InterpSource
+{
+public:
+  // called on the source's thread with the toolpath, or nullptr if the
+  // worker failed. a cancelled run doesn't call back.
+  using Done = std::function<void(std::shared_ptr<Toolpath>)>;
+
+  InterpSource();
+  ~InterpSource();
+
+  // cancels the run before. -1 if the worker can't be started, done isn't
+  // called then.
+  int start(const std::string& path, const std::string& ini, Done done);
+  void cancel();
+
+private:
+  void _run(Done done);
+  bool _worker_exited();
+
+  std::unique_ptr<CanonRing> m_ring;
+  std::thread m_thread;
+  // guards m_pid, the thread reaps the worker
+  std::mutex m_mutex;
+  pid_t m_pid = -1;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,27 @@
+/*
+ * limit_check.hpp
+ *
+ * soft limit check of a loaded program
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <array>
+
+namespace ImCNC {
+
+class Toolpath;
+
+// per axis (X, Y, Z) the first line moving outside the limits, 0 if none
+using LimitLines = std::array<int, 3>;
+
+// transform maps program to machine coordinates, as the upper 3x4 of a row
+// major matrix. limits are xmin, xmax, ymin, ymax, zmin, zmax in machine
+// coordinates. the vertices are split over up to threads threads.
+LimitLines check_limits(const Toolpath& toolpath,
+                        const std::array<double, 12>& transform,
+                        const std::array<double, 6>& limits,
+                        unsigned threads = 0);
+
+} // namespace ImCNC
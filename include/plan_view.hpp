@@ -0,0 +1,58 @@
+/*
+ * plan_view.hpp
+ *
+ * 2D toolpath preview drawn with ImGui only
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "imgui.h"
+#include "toolpath_lod.hpp"
+
+#include <array>
+#include <future>
+#include <memory>
+#include <vector>
+
+namespace ImCNC {
+
+class ProgramSource;
+class Toolpath;
+
+// XY, XZ or YZ projection of the loaded program into the window's draw
+// list, for stations where the VTK preview is too heavy. it follows the
+// executing line and the tool like the preview does.
+class PlanView
+{
+public:
+  explicit PlanView(ProgramSource& program);
+  void show();
+
+private:
+  void _update_toolpath();
+  void _fit(const ImVec2& size);
+  void _handle_input(const ImVec2& pos, const ImVec2& size);
+  void _draw_toolpath(ImDrawList* draw_list);
+  void _draw_tool(ImDrawList* draw_list, const ImVec2& pos,
+                  const ImVec2& size);
+
+  ProgramSource& m_program;
+  std::shared_ptr<const Toolpath> m_toolpath;
+  // one per plane, built when the plane is first looked at
+  std::array<std::shared_ptr<const ToolpathLod>, 3> m_lods;
+  std::future<std::shared_ptr<const ToolpathLod>> m_building;
+
+  ToolpathLod::Plane m_plane = ToolpathLod::Plane::XY;
+  std::array<double, 2> m_center{0, 0};
+  double m_scale = 1;
+  bool m_fit = true;
+
+  // the last picture is drawn again as long as the view doesn't change
+  const ToolpathLod* m_drawn = nullptr;
+  ToolpathLod::View m_view;
+  ToolpathLod::Picture m_picture;
+  std::vector<ImVec2> m_points;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,51 @@
+/*
+ * position_estimator.hpp
+ *
+ * tool position between status updates
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <array>
+#include <chrono>
+
+namespace ImCNC {
+
+// status arrives at the task cycle, not at the frame rate, so a moving tool
+// would stutter. the estimator keeps the last two samples and carries the
+// position forward along the direction of the last one at the reported
+// velocity, but never further than one sample interval (capped at
+// c_max_extrapolation) and never further than the last sample moved. a
+// stopping machine reports zero velocity and the estimate falls back onto
+// the sample.
+class PositionEstimator
+{
+public:
+  using Clock = std::chrono::steady_clock;
+  using Point = std::array<double, 3>;
+
+  static constexpr Clock::duration c_max_extrapolation =
+      std::chrono::milliseconds(100);
+
+  // a status sample taken at time, velocity is the tool tip speed. the same
+  // sample passed twice is ignored.
+  void update(Clock::time_point time, const Point& position, double velocity);
+  Point estimate(Clock::time_point now) const;
+  const Point& sampled() const { return m_last.position; }
+  bool empty() const { return m_samples == 0; }
+
+private:
+  struct Sample
+  {
+    Clock::time_point time;
+    Point position{0, 0, 0};
+  };
+
+  Sample m_last;
+  Sample m_previous;
+  int m_samples = 0;
+  double m_velocity = 0;
+};
+
+} // namespace ImCNC
@@ -0,0 +1,79 @@
+/*
+ * program_source.hpp
+ *
+ * the toolpath of the program task has open, for every view showing it
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "file_watcher.hpp"
+#include "gcode_parser.hpp"
+#include "interp_source.hpp"
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+
+namespace ImCNC {
+
+class Toolpath;
+
+// loads the program task has open once for the 3D preview and the plan
+// view both, and again whenever it changes on disk. the interpreter
+// (InterpSource) builds the toolpath. the built-in parser runs next to it
+// with its cache and incremental updates, so a small edit to a large
+// program is shown right away; its toolpath is replaced by the
+// interpreter's once that is there, and stays if the interpreter can't be
+// run. both run on threads of their own, the views pick the result up when
+// it's there.
+class ProgramSource
+{
+public:
+  ~ProgramSource();
+
+  // UI thread, once per frame while a view is shown
+  void update();
+  // the last toolpath loaded, nullptr before the first. views compare it
+  // with the one they show to notice a new one.
+  std::shared_ptr<const Toolpath> toolpath();
+  // true from a new program or change until its toolpath is there
+  bool loading();
+
+private:
+  void _open();
+  void _load_builtin(const std::string& path, std::uint64_t serial);
+  // toolpath nullptr if the load ended without a new one. a built-in one
+  // doesn't replace the interpreter's of the same open.
+  void _publish(std::uint64_t serial, std::shared_ptr<const Toolpath> toolpath,
+                bool builtin);
+
+  // UI thread only
+  std::string m_file;
+  FileWatcher m_watcher;
+  InterpSource m_interp;
+  // one built-in load at a time, for the open with this serial
+  std::future<void> m_builtin;
+  std::uint64_t m_builtin_serial = 0;
+
+  // built-in load thread only
+  std::string m_parsed_file;
+  std::shared_ptr<const Toolpath> m_parsed;
+  GCodeParser::Index m_parse_index;
+  std::future<void> m_cache_store;
+
+  // guarded by m_mutex
+  std::mutex m_mutex;
+  std::shared_ptr<const Toolpath> m_toolpath;
+  // set when m_toolpath came from the built-in parser, the interpreter's
+  // replaces it
+  bool m_toolpath_builtin = false;
+  // of the last open and of the last one that finished, results of an
+  // older one are dropped
+  std::uint64_t m_serial = 0;
+  std::uint64_t m_finished = 0;
+};
+
+} // namespace ImCNC
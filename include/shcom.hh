@@ -21,6 +21,7 @@
 #include "emc_nml.hh"
 #include "linuxcnc.h" // INCH_PER_MM
 #include "nml_oi.hh"  // NML_ERROR_LEN
+#include "position_estimator.hpp"
 
 #include <array>
 #include <memory>
@@ -66,6 +67,11 @@ public:
   int emc_error_nml_get();
   int try_nml(double retry_time = 10.0, double retry_interval = 1.0);
   int update_status();
+  // actual XYZ position carried forward from the last status update, for
+  // displays that refresh faster than status arrives
+  ImCNC::PositionEstimator::Point estimated_position() const;
+  // [KINS]KINEMATICS, the module and its arguments
+  const std::string& kinematics() const { return m_kinematics; }
   int update_error();
 
   int emc_command_wait_received();
@@ -140,6 +146,7 @@ private:
   EMC_UPDATE_TYPE m_emc_update_type;
   EMC_WAIT_TYPE m_emc_wait_type;
   EMC_STAT* m_status;
+  ImCNC::PositionEstimator m_position_estimator;
 
   // the current command number
   int m_emc_command_serial_number;
@@ -157,6 +164,7 @@ private:
 
   std::string m_parameter_filename;
   std::string m_tool_table_filename;
+  std::string m_kinematics;
 };
 
 extern std::string error_string;
@@ -0,0 +1,124 @@
+/*
+ * toolpath.hpp
+ *
+ * toolpath geometry for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace ImCNC {
+
+enum class MotionType : std::uint8_t { NONE, TRAVERSE, FEED, ARC };
+
+// the whole program is one continuous polyline, every vertex is the end point
+// of a segment starting at the vertex before it. vertices are appended in
+// program order, so the vertices produced by a source line are contiguous
+// and every line knows where its range starts.
+//
+// to keep large programs small, vertices are stored in chunks of
+// c_chunk_size as float offsets from the chunk's origin (its first vertex).
+// connectivity is implicit and per line data lives in a side table.
+//
+// a toolpath is built with set_origin()/move_to()/finish() and can only be
+// read after finish(), or it adopts buffers someone else built (the cache).
+class Toolpath
+{
+public:
+  static constexpr std::size_t c_chunk_size = 65536;
+
+  using Point = std::array<double, 3>;
+  using Offset = std::array<float, 3>;
+  // xmin, xmax, ymin, ymax, zmin, zmax
+  using Bounds = std::array<double, 6>;
+
+  struct Line
+  {
+    std::uint32_t first_vertex;
+    MotionType type;
+    std::uint8_t reserved[3];
+  };
+
+  // vertices [index * c_chunk_size, (index + 1) * c_chunk_size)
+  struct Chunk
+  {
+    Point origin;
+    Bounds bounds;
+  };
+
+  void clear();
+
+  // start of the program, the position before the first move
+  void set_origin(double x, double y, double z);
+  void move_to(int line, MotionType type, double x, double y, double z);
+  // no more moves, closes the line index
+  void finish();
+  // instead of set_origin(): start with the first vertices and the lines
+  // before line of another toolpath, then go on with move_to()
+  void resume(const Toolpath& from, std::size_t vertices, int line);
+  // the lines from line on of another toolpath and their vertices, line
+  // numbers moved by line_delta. whole chunks are copied where the chunk
+  // boundaries line up.
+  void append(const Toolpath& from, int line, int line_delta);
+
+  // use buffers owned by storage instead of building them. lines must
+  // include the sentinel entry.
+  void adopt(std::shared_ptr<const void> storage,
+             std::span<const Offset> offsets, std::span<const Chunk> chunks,
+             std::span<const Line> lines);
+
+  std::size_t vertex_count() const { return m_offset_view.size(); }
+  // vertices moved to so far, while building
+  std::size_t added_count() const { return m_offsets.size(); }
+  Point point(std::size_t index) const
+  {
+    const auto& origin = m_chunk_view[index / c_chunk_size].origin;
+    const auto& offset = m_offset_view[index];
+    return {origin[0] + offset[0], origin[1] + offset[1],
+            origin[2] + offset[2]};
+  }
+  const Bounds& bounds() const { return m_bounds; }
+
+  std::size_t chunk_count() const { return m_chunk_view.size(); }
+  const Chunk& chunk(std::size_t index) const { return m_chunk_view[index]; }
+  // vertices of a chunk as [begin, end)
+  std::pair<std::size_t, std::size_t> chunk_vertices(std::size_t index) const;
+  std::span<const Offset> offsets() const { return m_offset_view; }
+  std::span<const Chunk> chunks() const { return m_chunk_view; }
+
+  // number of source lines, including line 0 (the origin)
+  int line_count() const { return static_cast<int>(m_line_view.size()) - 1; }
+  MotionType line_type(int line) const { return m_line_view[line].type; }
+  std::span<const Line> lines() const { return m_line_view; }
+  // vertices produced by the lines [first, last), as [begin, end)
+  std::pair<std::size_t, std::size_t> line_vertices(int first,
+                                                    int last) const;
+  // the line that produced a vertex, i.e. the segment ending there
+  int vertex_line(std::size_t vertex) const;
+
+private:
+  void _extend_lines(int line);
+  void _add_vertex(double x, double y, double z);
+  void _update_bounds();
+
+  std::vector<Offset> m_offsets;
+  std::vector<Chunk> m_chunks;
+  // indexed by line number, with one sentinel entry past the last line
+  std::vector<Line> m_lines;
+  std::shared_ptr<const void> m_storage;
+
+  std::span<const Offset> m_offset_view;
+  std::span<const Chunk> m_chunk_view;
+  std::span<const Line> m_line_view;
+  Bounds m_bounds{0, 0, 0, 0, 0, 0};
+};
+
+} // namespace ImCNC
@@ -0,0 +1,80 @@
+/*
+ * toolpath_actor.hpp
+ *
+ * VTK actor of the toolpath for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "toolpath.hpp"
+#include "vtkActor.h"
+#include "vtkAssembly.h"
+#include "vtkSmartPointer.h"
+#include "vtkUnsignedCharArray.h"
+
+#include <memory>
+#include <vector>
+
+class vtkCamera;
+
+namespace ImCNC {
+
+// the toolpath is drawn as one part per Toolpath chunk. only chunks in
+// view are expanded into VTK arrays; expanded chunks that left the view are
+// kept around until there are more than c_expanded_vertices of them.
+class ToolpathActor
+{
+public:
+  enum class State { PENDING, CURRENT, DONE };
+
+  ToolpathActor() { m_assembly = vtkSmartPointer<vtkAssembly>::New(); }
+
+  vtkSmartPointer<vtkAssembly> get_actor() { return m_assembly; }
+
+  void set_toolpath(std::shared_ptr<const Toolpath> toolpath);
+
+  // recolors only the lines between the previous and the new motion line,
+  // returns true if anything changed
+  bool set_motion_line(int line);
+
+  // expands the chunks that came into view and hides the ones that left
+  // it. called right before rendering.
+  void update_visibility(vtkCamera* camera, double aspect);
+
+private:
+  static constexpr std::size_t c_expanded_vertices = std::size_t{1} << 22;
+
+  struct Part
+  {
+    vtkSmartPointer<vtkActor> actor;
+    vtkSmartPointer<vtkUnsignedCharArray> colors;
+    // vertices drawn, [first, end)
+    std::size_t first = 0;
+    std::size_t end = 0;
+    bool visible = false;
+  };
+
+  // only the side planes count. the clipping range is fitted to what gets
+  // rendered, so far away chunks would never make it in otherwise.
+  static bool _in_view(const Toolpath::Bounds& bounds, const double* planes);
+  void _expand(std::size_t index);
+  void _release(Part& part);
+  const unsigned char* _line_color(int line, State state) const;
+
+  // vertices [begin, end), as far as the part draws them
+  void _paint(Part& part, std::size_t begin, std::size_t end,
+              const unsigned char* c);
+
+  // lines [first, last), in the expanded parts only
+  void _color(int first, int last, State state);
+
+  std::shared_ptr<const Toolpath> m_toolpath;
+  int m_motion_line = 0;
+
+  std::vector<Part> m_parts;
+  std::size_t m_expanded = 0;
+  vtkSmartPointer<vtkAssembly> m_assembly;
+};
+
+} // namespace ImCNC
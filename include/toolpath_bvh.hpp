@@ -0,0 +1,38 @@
+/*
+ * toolpath_bvh.hpp
+ *
+ * segment lookup for picking in the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "bvh.hpp"
+
+#include <memory>
+
+namespace ImCNC {
+
+class Toolpath;
+
+// BVH over the segments of a toolpath, segment i runs from vertex i to
+// vertex i + 1.
+class ToolpathBvh
+{
+public:
+  void build(std::shared_ptr<const Toolpath> toolpath);
+  void clear();
+
+  // returns the line of the segment closest to the ray from near to far, or
+  // 0 if none is within tolerance. the tolerance grows linearly from
+  // tol_near to tol_far along the ray, which turns a pick radius in pixels
+  // into world units for both parallel and perspective projection.
+  int pick(const double near[3], const double far[3], double tol_near,
+           double tol_far) const;
+
+private:
+  std::shared_ptr<const Toolpath> m_toolpath;
+  Bvh m_bvh;
+};
+
+} // namespace ImCNC
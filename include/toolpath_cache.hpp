@@ -0,0 +1,56 @@
+/*
+ * toolpath_cache.hpp
+ *
+ * on-disk cache of preview toolpaths
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "gcode_parser.hpp"
+
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <string>
+
+namespace ImCNC {
+
+class Toolpath;
+
+// hash of the file content, computed in blocks on all cores. returns -1 if
+// the file can't be read.
+int hash_file(const std::string& path, std::uint64_t& hash);
+
+// toolpaths keyed by the content hash of their program, one file each in
+// $XDG_CACHE_HOME/cockpit (~/.cache/cockpit), with the parse index that
+// lets a change be parsed incrementally. the files are laid out so the
+// buffers can be used straight from a private mapping. a store drops the
+// least recently used entries once the cache has grown past its limit.
+class ToolpathCache
+{
+public:
+  ToolpathCache();
+
+  // nullptr on a miss or if the entry is from an older version
+  std::shared_ptr<Toolpath> load(std::uint64_t key,
+                                 GCodeParser::Index& index) const;
+  int store(std::uint64_t key, const Toolpath& toolpath,
+            const GCodeParser::Index& index) const;
+
+private:
+  std::string _file_name(std::uint64_t key) const;
+  void _trim() const;
+
+  std::string m_dir;
+};
+
+// the toolpath of a program, from the cache if it's there. a freshly parsed
+// one is written to the cache in the background, store has to be waited for
+// before exit. a program that can't be read gives an empty toolpath. index
+// comes from the parse or the cache entry.
+std::shared_ptr<Toolpath> load_toolpath(const std::string& path,
+                                        std::future<void>& store,
+                                        GCodeParser::Index& index);
+
+} // namespace ImCNC
@@ -0,0 +1,118 @@
+/*
+ * toolpath_lod.hpp
+ *
+ * toolpath reduced for drawing in 2D
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#pragma once
+
+#include "toolpath.hpp"
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace ImCNC {
+
+// the toolpath projected onto one plane at a few levels of detail. each
+// level drops the vertices that stay within its tolerance of the line from
+// the last vertex kept (never across a change of motion type). a view draws
+// from the coarsest level below a pixel and then drops whatever falls on
+// pixels drawn before, so what ends up in the draw list is bounded by the
+// screen much more than by the program.
+//
+// every level is cut into blocks of c_block_size vertices with their
+// bounds for culling. the full resolution level uses the toolpath's own
+// offsets.
+class ToolpathLod
+{
+public:
+  static constexpr std::size_t c_block_size = 4096;
+
+  enum class Plane { XY, XZ, YZ };
+
+  struct View
+  {
+    // program coordinates at the center of the rectangle
+    std::array<double, 2> center{0, 0};
+    // pixels per mm
+    double scale = 1;
+    // x, y, width, height in pixels
+    std::array<float, 4> rect{0, 0, 0, 0};
+
+    bool operator==(const View&) const = default;
+  };
+
+  // points [first, first + count) drawn as one polyline
+  struct Run
+  {
+    std::uint32_t first;
+    std::uint32_t count;
+    bool traverse;
+  };
+
+  // a redraw's output. every point knows the toolpath vertex it stands for,
+  // so the executed part can be colored without drawing again.
+  struct Picture
+  {
+    std::vector<std::array<float, 2>> points;
+    std::vector<std::uint32_t> sources;
+    std::vector<Run> runs;
+    // pixels covered by feeds and traverses, kept to save the allocation
+    std::vector<std::uint64_t> covered;
+  };
+
+  void build(std::shared_ptr<const Toolpath> toolpath, Plane plane);
+  const std::shared_ptr<const Toolpath>& toolpath() const
+  {
+    return m_toolpath;
+  }
+  Plane plane() const { return m_plane; }
+
+  // points are in pixels. short segments over pixels that already have a
+  // segment of the same type are left out.
+  void draw(const View& view, Picture& picture) const;
+
+private:
+  struct Block
+  {
+    Toolpath::Point origin;
+    // including the vertex before the block, where its first segment starts
+    Toolpath::Bounds bounds;
+    std::uint32_t first;
+    std::uint32_t end;
+  };
+
+  struct Level
+  {
+    // in mm, 0 for full resolution
+    double tolerance = 0;
+    std::vector<Toolpath::Offset> storage;
+    std::span<const Toolpath::Offset> offsets;
+    // toolpath vertex of each vertex, empty for full resolution
+    std::vector<std::uint32_t> sources;
+    std::vector<Block> blocks;
+
+    std::size_t source(std::size_t index) const
+    {
+      return sources.empty() ? index : sources[index];
+    }
+  };
+
+  void _decimate(const Level& from, double tolerance, Level& to) const;
+  const Level& _level(double scale) const;
+
+  std::shared_ptr<const Toolpath> m_toolpath;
+  Plane m_plane = Plane::XY;
+  // horizontal and vertical axis of the plane
+  int m_u = 0;
+  int m_v = 1;
+  // by increasing tolerance
+  std::vector<Level> m_levels;
+};
+
+} // namespace ImCNC
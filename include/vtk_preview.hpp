@@ -8,29 +8,164 @@
 #pragma once
 
 #include "VtkViewer.h"
+#include "collision.hpp"
+#include "limit_check.hpp"
 
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
 class vtkCamera;
+class vtkObject;
+class vtkProp;
 class vtkRenderer;
+class vtkTransform;
+struct GLFWwindow;
 
 namespace ImCNC {
 
+class Heightmap;
+class FixtureActor;
+class HighlightActor;
+class ProgramSource;
+class StockActor;
 class ToolActor;
+class Toolpath;
+class ToolpathActor;
+class ToolpathBvh;
 
 class VtkPreview
 {
 public:
-  VtkPreview();
+  explicit VtkPreview(ProgramSource& program);
   ~VtkPreview();
-  void open_file(std::string path);
   void show();
 
+  // line of the last segment clicked in the preview, 0 if there was no
+  // click since the last call
+  int picked_line();
+  // draws the segments of that line highlighted, 0 for none
+  void highlight_line(int line);
+
 private:
-  void _update_camera(vtkCamera& camera, double x, double y, double z,
-                      double vx, double vy, double vz);
+  // one half of the double buffered render target. the texture lives in
+  // the shared namespace, the FBO belongs to the render thread's context.
+  struct RenderBuffer
+  {
+    unsigned fbo = 0;
+    unsigned tex = 0;
+    int width = 0;
+    int height = 0;
+  };
+
+  void _update_camera(double x, double y, double z, double vx, double vy,
+                      double vz);
+  void _add_actor(const vtkSmartPointer<vtkProp>& actor);
+  void _watch(vtkObject* object, unsigned long event);
+  void _update_offsets();
+  std::array<double, 12> _machine_transform() const;
+  std::array<double, 12> _tool_tip_transform() const;
+  void _check_limits();
+  void _show_collisions();
+  void _check_collisions(double radius, double length, double clearance);
+  void _show_stock();
+  void _reset_stock();
+  void _cut_stock(std::array<double, 3> position, double radius);
+  bool _stock_busy() const;
+  void _update_tool_position();
+  void _update_motion_line();
+  void _set_toolpath(std::shared_ptr<const Toolpath> toolpath);
+  void _render_viewport();
+  void _process_events();
+  void _pick(double x, double y);
+
+  // everything touching the VTK scene runs on the render thread, the UI
+  // posts it there.
+  void _post(std::function<void()> command);
+  void _render_loop();
+  void _render_frame();
+  void _resize_buffer(RenderBuffer& buffer);
+
+  // set by VTK observers whenever something that ends up in the image
+  // changes; the FBO texture is only re-rendered when this is set.
+  static void _on_modified(vtkObject* caller, unsigned long event,
+                           void* client_data, void* call_data);
+  bool m_dirty = true;
+  bool m_rendering = false;
+  std::array<double, 3> m_tool_position{0, 0, 0};
+
+  // UI thread only
+  ImVec2 m_viewport_size{0, 0};
+  int m_displayed = -1;
+  ProgramSource& m_program;
+  std::shared_ptr<const Toolpath> m_program_toolpath;
+  int m_motion_line = 0;
+  int m_highlight_line = 0;
+  std::array<double, 10> m_offsets{};
+  std::array<double, 6> m_limits{};
+  bool m_stock_enabled = false;
+  bool m_stock_follow = false;
+  std::array<float, 6> m_stock_box{0, 100, 0, 100, -20, 0};
+  float m_stock_cell = 0.5f;
+  bool m_collision_enabled = false;
+  char m_mesh_path[256] = "";
+  float m_clearance = 2.0f;
+
+  // render thread only
+  std::array<RenderBuffer, 2> m_buffers;
+  int m_width = 0;
+  int m_height = 0;
+  std::shared_ptr<const Toolpath> m_toolpath;
+  std::unique_ptr<ToolpathBvh> m_bvh;
+  std::future<std::unique_ptr<ToolpathBvh>> m_bvh_pending;
+  // program to machine coordinates, shared by the toolpath and highlight
+  vtkSmartPointer<vtkTransform> m_transform;
+  std::array<double, 6> m_soft_limits{};
+  // the part of m_transform that moves the controlled point off the tip
+  std::array<double, 3> m_tool_offset{};
+  std::future<void> m_limit_check;
+  // something changed while m_limit_check ran
+  bool m_limit_pending = false;
+  // written by m_stock_sweep while it runs
+  std::unique_ptr<Heightmap> m_heightmap;
+  std::future<void> m_stock_sweep;
+  std::optional<std::array<double, 3>> m_stock_position;
+  std::vector<CollisionMesh> m_meshes;
+  std::future<void> m_collision_check;
+
+  // shared, guarded by m_mutex
+  std::mutex m_mutex;
+  std::condition_variable m_wakeup;
+  std::vector<std::function<void()>> m_commands;
+  int m_latched = -1;
+  bool m_quit = false;
+  LimitLines m_limit_lines{0, 0, 0};
+  std::string m_collision_summary;
+
+  // last completed frame, -1 until there is one
+  std::atomic<int> m_front = -1;
+  std::atomic<int> m_picked_line = 0;
+
+  GLFWwindow* m_context = nullptr;
+  std::thread m_render_thread;
+
   VtkViewer m_viewer;
+  vtkSmartPointer<vtkCamera> m_camera;
   std::unique_ptr<ToolActor> m_tool_actor;
+  std::unique_ptr<ToolpathActor> m_toolpath_actor;
+  std::unique_ptr<HighlightActor> m_highlight_actor;
+  std::unique_ptr<HighlightActor> m_limit_actor;
+  std::unique_ptr<StockActor> m_stock_actor;
+  std::unique_ptr<FixtureActor> m_fixture_actor;
+  std::unique_ptr<HighlightActor> m_collision_actor;
 };
 
-} // namespace ImCNC
\ No newline at end of file
+} // namespace ImCNC
@@ -0,0 +1,112 @@
+/*
+ * bvh.cpp
+ *
+ * bounding volume hierarchy over axis aligned boxes
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "bvh.hpp"
+
+#include <bit>
+#include <numeric>
+#include <thread>
+
+namespace ImCNC {
+
+static constexpr std::uint32_t c_leaf_size = 4;
+
+void Bvh::clear()
+{
+  m_nodes.clear();
+  m_indices.clear();
+}
+
+void Bvh::build(const std::vector<Aabb>& boxes, unsigned threads)
+{
+  clear();
+  if (boxes.empty())
+    return;
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  std::vector<std::array<float, 3>> centers(boxes.size());
+  for (std::size_t i = 0; i < boxes.size(); i++) {
+    for (int k = 0; k < 3; k++)
+      centers[i][k] = (boxes[i].min[k] + boxes[i].max[k]) * 0.5f;
+  }
+
+  m_indices.resize(boxes.size());
+  std::iota(m_indices.begin(), m_indices.end(), 0);
+
+  // every level below the root doubles the number of subtrees built at the
+  // same time
+  int depth = std::bit_width(threads) - 1;
+  m_nodes.reserve(2 * boxes.size() / c_leaf_size + 1);
+  _build(boxes, centers, 0, static_cast<std::uint32_t>(boxes.size()), depth,
+         m_nodes);
+}
+
+void Bvh::_build(const std::vector<Aabb>& boxes,
+                 const std::vector<std::array<float, 3>>& centers,
+                 std::uint32_t begin, std::uint32_t end, int depth,
+                 std::vector<Node>& nodes)
+{
+  Aabb box, center_box;
+  for (auto i = begin; i < end; i++) {
+    const auto& c = centers[m_indices[i]];
+    box.extend(boxes[m_indices[i]]);
+    center_box.extend(c[0], c[1], c[2]);
+  }
+
+  auto index = nodes.size();
+  nodes.push_back({box, begin, end - begin});
+  if (end - begin <= c_leaf_size)
+    return;
+
+  int axis = 0;
+  for (int k = 1; k < 3; k++) {
+    if (center_box.max[k] - center_box.min[k] >
+        center_box.max[axis] - center_box.min[axis])
+      axis = k;
+  }
+
+  auto mid = begin + (end - begin) / 2;
+  std::nth_element(m_indices.begin() + begin, m_indices.begin() + mid,
+                   m_indices.begin() + end,
+                   [&centers, axis](std::uint32_t a, std::uint32_t b) {
+                     return centers[a][axis] < centers[b][axis];
+                   });
+
+  nodes[index].count = 0;
+
+  if (depth <= 0) {
+    _build(boxes, centers, begin, mid, depth, nodes);
+    nodes[index].first = static_cast<std::uint32_t>(nodes.size());
+    _build(boxes, centers, mid, end, depth, nodes);
+    return;
+  }
+
+  // subtrees go into their own vectors and are appended afterwards, with
+  // the right child links moved by the position they end up at
+  std::vector<Node> left, right;
+  std::thread worker([&] {
+    _build(boxes, centers, begin, mid, depth - 1, left);
+  });
+  _build(boxes, centers, mid, end, depth - 1, right);
+  worker.join();
+
+  auto append = [&nodes](const std::vector<Node>& subtree) {
+    auto base = static_cast<std::uint32_t>(nodes.size());
+    for (auto node : subtree) {
+      if (node.count == 0)
+        node.first += base;
+      nodes.push_back(node);
+    }
+  };
+  append(left);
+  nodes[index].first = static_cast<std::uint32_t>(nodes.size());
+  append(right);
+}
+
+} // namespace ImCNC
@@ -0,0 +1,179 @@
+/*
+ * canon_ring.cpp
+ *
+ * canon calls passed from the interpreter worker to the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "canon_ring.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <linux/futex.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace ImCNC {
+
+static constexpr std::uint32_t c_cancelled = 1;
+static constexpr std::uint32_t c_closed = 2;
+
+// head and tail count bytes and never wrap, the sequence numbers are bumped
+// whenever they move and are what the other side sleeps on
+struct CanonRing::Shared
+{
+  alignas(64) std::atomic<std::uint64_t> head;
+  std::atomic<std::uint32_t> head_seq;
+  alignas(64) std::atomic<std::uint64_t> tail;
+  std::atomic<std::uint32_t> tail_seq;
+  alignas(64) std::atomic<std::uint32_t> flags;
+  alignas(64) unsigned char data[c_capacity];
+};
+
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free &&
+                  std::atomic<std::uint32_t>::is_always_lock_free,
+              "the ring is shared between processes");
+
+// shared futexes, the ring is mapped by two processes
+static void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t value,
+                       int timeout_ms)
+{
+  struct timespec timeout = {timeout_ms / 1000,
+                             (timeout_ms % 1000) * 1000000L};
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT,
+          value, &timeout, nullptr, 0);
+}
+
+static void futex_wake(std::atomic<std::uint32_t>& word)
+{
+  syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE,
+          INT_MAX, nullptr, nullptr, 0);
+}
+
+CanonRing::~CanonRing()
+{
+  if (m_shared)
+    munmap(m_shared, sizeof(Shared));
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+int CanonRing::create()
+{
+  m_fd = memfd_create("cockpit-canon", MFD_CLOEXEC);
+  if (m_fd < 0)
+    return -1;
+  if (ftruncate(m_fd, sizeof(Shared)) != 0)
+    return -1;
+
+  void* map = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, m_fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  m_shared = new (map) Shared;
+  return 0;
+}
+
+int CanonRing::attach(int fd)
+{
+  void* map = mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return -1;
+  m_fd = fd;
+  m_shared = static_cast<Shared*>(map);
+  return 0;
+}
+
+int CanonRing::write(const void* data, std::size_t size)
+{
+  auto& shared = *m_shared;
+  auto p = static_cast<const unsigned char*>(data);
+
+  while (size > 0) {
+    auto seq = shared.tail_seq.load(std::memory_order_acquire);
+    if (cancelled())
+      return -1;
+
+    auto head = shared.head.load(std::memory_order_relaxed);
+    auto tail = shared.tail.load(std::memory_order_acquire);
+    std::size_t space = c_capacity - (head - tail);
+    if (space == 0) {
+      futex_wait(shared.tail_seq, seq, 100);
+      continue;
+    }
+
+    std::size_t n = std::min(space, size);
+    std::size_t at = head % c_capacity;
+    std::size_t first = std::min(n, c_capacity - at);
+    std::memcpy(shared.data + at, p, first);
+    std::memcpy(shared.data, p + first, n - first);
+
+    shared.head.store(head + n, std::memory_order_release);
+    shared.head_seq.fetch_add(1, std::memory_order_release);
+    futex_wake(shared.head_seq);
+    p += n;
+    size -= n;
+  }
+  return 0;
+}
+
+void CanonRing::close_writer()
+{
+  m_shared->flags.fetch_or(c_closed, std::memory_order_release);
+  m_shared->head_seq.fetch_add(1, std::memory_order_release);
+  futex_wake(m_shared->head_seq);
+}
+
+bool CanonRing::cancelled() const
+{
+  return m_shared->flags.load(std::memory_order_acquire) & c_cancelled;
+}
+
+std::size_t CanonRing::read(void* data, std::size_t size, int timeout_ms)
+{
+  auto& shared = *m_shared;
+  auto seq = shared.head_seq.load(std::memory_order_acquire);
+  auto tail = shared.tail.load(std::memory_order_relaxed);
+  auto head = shared.head.load(std::memory_order_acquire);
+
+  if (head == tail) {
+    if (closed() || timeout_ms <= 0)
+      return 0;
+    futex_wait(shared.head_seq, seq, timeout_ms);
+    head = shared.head.load(std::memory_order_acquire);
+    if (head == tail)
+      return 0;
+  }
+
+  std::size_t n = std::min<std::size_t>(head - tail, size);
+  std::size_t at = tail % c_capacity;
+  std::size_t first = std::min(n, c_capacity - at);
+  auto p = static_cast<unsigned char*>(data);
+  std::memcpy(p, shared.data + at, first);
+  std::memcpy(p + first, shared.data, n - first);
+
+  shared.tail.store(tail + n, std::memory_order_release);
+  shared.tail_seq.fetch_add(1, std::memory_order_release);
+  futex_wake(shared.tail_seq);
+  return n;
+}
+
+bool CanonRing::closed() const
+{
+  return m_shared->flags.load(std::memory_order_acquire) & c_closed;
+}
+
+void CanonRing::cancel()
+{
+  m_shared->flags.fetch_or(c_cancelled, std::memory_order_release);
+  m_shared->tail_seq.fetch_add(1, std::memory_order_release);
+  futex_wake(m_shared->tail_seq);
+}
+
+} // namespace ImCNC
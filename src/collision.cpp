@@ -0,0 +1,260 @@
+/*
+ * collision.cpp
+ *
+ * tool against fixture collision check
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "collision.hpp"
+
+#include "geometry.hpp"
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace ImCNC {
+
+static bool degenerate(const Triangle& t)
+{
+  Vec a{t[0][0], t[0][1], t[0][2]};
+  Vec b{t[1][0], t[1][1], t[1][2]};
+  Vec c{t[2][0], t[2][1], t[2][2]};
+  Vec n = cross(sub(b, a), sub(c, a));
+  return dot(n, n) <= 1e-18;
+}
+
+int load_stl(const std::string& path, std::vector<Triangle>& triangles)
+{
+  std::ifstream f(path, std::ios::binary);
+  if (!f.good())
+    return -1;
+
+  std::string data((std::istreambuf_iterator<char>(f)),
+                   std::istreambuf_iterator<char>());
+
+  // binary files have an 80 byte header, a count and 50 bytes per
+  // triangle. ASCII files start with "solid", but so do some binary ones,
+  // the size is what tells them apart.
+  std::uint32_t count = 0;
+  if (data.size() >= 84)
+    std::memcpy(&count, data.data() + 80, sizeof(count));
+
+  if (data.size() >= 84 && data.size() == 84 + 50 * std::size_t{count}) {
+    triangles.reserve(triangles.size() + count);
+    for (std::uint32_t i = 0; i < count; i++) {
+      // normal first, then the corners
+      Triangle t;
+      std::memcpy(t.data(), data.data() + 84 + 50 * std::size_t{i} + 12,
+                  sizeof(t));
+      if (!degenerate(t))
+        triangles.push_back(t);
+    }
+    return 0;
+  }
+
+  if (data.compare(0, 5, "solid") != 0)
+    return -1;
+
+  std::istringstream in(data);
+  std::string word;
+  Triangle t;
+  int corner = 0;
+  while (in >> word) {
+    if (word != "vertex")
+      continue;
+    auto& v = t[corner];
+    if (!(in >> v[0] >> v[1] >> v[2]))
+      return -1;
+    if (++corner == 3) {
+      corner = 0;
+      if (!degenerate(t))
+        triangles.push_back(t);
+    }
+  }
+  return 0;
+}
+
+void CollisionCheck::set_meshes(const std::vector<CollisionMesh>& meshes,
+                                unsigned threads)
+{
+  m_triangles.clear();
+  m_part.clear();
+  m_spheres.clear();
+  for (const auto& mesh : meshes) {
+    m_triangles.insert(m_triangles.end(), mesh.triangles.begin(),
+                       mesh.triangles.end());
+    m_part.insert(m_part.end(), mesh.triangles.size(), mesh.part);
+  }
+
+  std::vector<Aabb> boxes(m_triangles.size());
+  m_spheres.resize(m_triangles.size());
+  for (std::size_t i = 0; i < m_triangles.size(); i++) {
+    const auto& t = m_triangles[i];
+    auto& sphere = m_spheres[i];
+    for (int k = 0; k < 3; k++)
+      sphere[k] = (t[0][k] + t[1][k] + t[2][k]) / 3;
+    sphere[3] = 0;
+    for (const auto& v : t) {
+      boxes[i].extend(v[0], v[1], v[2]);
+      float d2 = 0;
+      for (int k = 0; k < 3; k++)
+        d2 += (v[k] - sphere[k]) * (v[k] - sphere[k]);
+      sphere[3] = std::max(sphere[3], std::sqrt(d2));
+    }
+  }
+  m_bvh.build(boxes, threads);
+}
+
+std::vector<CollisionCheck::Hit>
+CollisionCheck::check(const Toolpath& toolpath,
+                      const std::array<double, 12>& transform, double radius,
+                      double length, double clearance, unsigned threads) const
+{
+  std::vector<Hit> hits;
+  if (m_bvh.empty() || toolpath.vertex_count() < 3)
+    return hits;
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  auto to_machine = [&transform](const Toolpath::Point& p) {
+    Vec m;
+    for (int i = 0; i < 3; i++) {
+      m[i] = transform[4 * i] * p[0] + transform[4 * i + 1] * p[1] +
+             transform[4 * i + 2] * p[2] + transform[4 * i + 3];
+    }
+    return m;
+  };
+
+  const double reach = radius + clearance;
+
+  // the tool axis sweeps a parallelogram (a vertical segment for plunges),
+  // the tool is everything within radius of it
+  auto sweep = [&](std::size_t v, std::vector<Hit>& found) {
+    Vec a = to_machine(toolpath.point(v - 1));
+    Vec b = to_machine(toolpath.point(v));
+    Vec a_top{a[0], a[1], a[2] + length};
+    Vec b_top{b[0], b[1], b[2] + length};
+    bool rapid = toolpath.line_type(toolpath.vertex_line(v)) ==
+                 MotionType::TRAVERSE;
+    bool plunge = std::hypot(b[0] - a[0], b[1] - a[1]) < 1e-9;
+
+    Aabb box;
+    for (const auto& p : {a, b, a_top, b_top})
+      box.extend(p[0], p[1], p[2]);
+    for (int i = 0; i < 3; i++) {
+      box.min[i] -= static_cast<float>(reach);
+      box.max[i] += static_cast<float>(reach);
+    }
+
+    // in XY the sweep stays within reach of the line through the move,
+    // which culls a lot more than the box for diagonal moves
+    double nx = a[1] - b[1], ny = b[0] - a[0];
+    double norm = std::hypot(nx, ny);
+    auto beside = [&](const Aabb& node) {
+      if (plunge)
+        return false;
+      double lo = 0, hi = 0;
+      for (int k = 0; k < 4; k++) {
+        double x = (k & 1) ? node.max[0] : node.min[0];
+        double y = (k & 2) ? node.max[1] : node.min[1];
+        double d = ((x - a[0]) * nx + (y - a[1]) * ny) / norm;
+        lo = (k == 0) ? d : std::min(lo, d);
+        hi = (k == 0) ? d : std::max(hi, d);
+      }
+      return lo > reach || hi < -reach;
+    };
+
+    // a plunge sweeps the axis from the lower end up to the higher top
+    const Vec& low = (a[2] < b[2]) ? a : b;
+    const Vec& high = (a[2] < b[2]) ? b_top : a_top;
+
+    double best = reach * reach;
+    bool hit = false;
+    auto visit = [&](std::uint32_t index) {
+      if (m_part[index] && !rapid)
+        return true;
+
+      // the bounding sphere's distance is cheap and usually enough to skip
+      // the exact test
+      const auto& sphere = m_spheres[index];
+      Vec c{sphere[0], sphere[1], sphere[2]};
+      double dc;
+      if (plunge) {
+        double s;
+        dc = segment_distance2(c, c, low, high, s);
+      }
+      else {
+        Vec p = sub(c, closest_on_triangle(c, a, b, b_top));
+        Vec q = sub(c, closest_on_triangle(c, a, b_top, a_top));
+        dc = std::min(dot(p, p), dot(q, q));
+      }
+      double bound = std::sqrt(dc) - sphere[3];
+      if (bound > 0 && bound * bound >= best)
+        return true;
+
+      const auto& tri = m_triangles[index];
+      std::array<Vec, 3> u;
+      for (int k = 0; k < 3; k++)
+        u[k] = {tri[k][0], tri[k][1], tri[k][2]};
+
+      double d2;
+      if (plunge) {
+        d2 = segment_triangle_distance2(low, high, u);
+      }
+      else {
+        d2 = std::min(triangle_distance2({a, b, b_top}, u),
+                      triangle_distance2({a, b_top, a_top}, u));
+      }
+      if (d2 < best) {
+        best = d2;
+        hit = true;
+      }
+      // a collision is a collision, how deep doesn't matter
+      return best >= radius * radius;
+    };
+
+    m_bvh.query(
+        [&](const Aabb& node) { return node.overlaps(box) && !beside(node); },
+        visit);
+
+    if (hit)
+      found.push_back({toolpath.vertex_line(v), std::sqrt(best) - radius});
+  };
+
+  // the first move comes from wherever the parser started and is left out
+  const std::size_t first = 2;
+  const std::size_t end = toolpath.vertex_count();
+  std::vector<std::vector<Hit>> found(threads);
+  auto worker = [&](unsigned t) {
+    auto begin = first + (end - first) * t / threads;
+    auto stop = first + (end - first) * (t + 1) / threads;
+    for (auto v = begin; v < stop; v++)
+      sweep(v, found[t]);
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+
+  // threads ran over consecutive ranges, so this is sorted by line already
+  for (const auto& f : found) {
+    for (const auto& h : f) {
+      if (!hits.empty() && hits.back().line == h.line)
+        hits.back().distance = std::min(hits.back().distance, h.distance);
+      else
+        hits.push_back(h);
+    }
+  }
+  return hits;
+}
+
+} // namespace ImCNC
@@ -0,0 +1,74 @@
+/*
+ * file_watcher.cpp
+ *
+ * notices when a file is rewritten
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "file_watcher.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdio.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace ImCNC {
+
+FileWatcher::~FileWatcher()
+{
+  if (m_fd >= 0)
+    close(m_fd);
+}
+
+int FileWatcher::watch(const std::string& path)
+{
+  if (m_fd < 0) {
+    m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (m_fd < 0) {
+      fprintf(stderr, "file watcher: inotify_init1 failed: %s\n",
+              strerror(errno));
+      return -1;
+    }
+  }
+  if (m_wd >= 0) {
+    inotify_rm_watch(m_fd, m_wd);
+    m_wd = -1;
+  }
+
+  auto slash = path.rfind('/');
+  std::string dir = ".";
+  if (slash != std::string::npos)
+    dir = path.substr(0, std::max<std::size_t>(slash, 1));
+  m_name = path.substr(slash == std::string::npos ? 0 : slash + 1);
+
+  m_wd = inotify_add_watch(m_fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+  if (m_wd < 0) {
+    fprintf(stderr, "file watcher: can't watch %s: %s\n", dir.c_str(),
+            strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+bool FileWatcher::changed()
+{
+  if (m_wd < 0)
+    return false;
+
+  alignas(struct inotify_event) char buffer[4096];
+  bool changed = false;
+  ssize_t n;
+  while ((n = read(m_fd, buffer, sizeof(buffer))) > 0) {
+    for (char* p = buffer; p < buffer + n;) {
+      auto event = reinterpret_cast<const struct inotify_event*>(p);
+      if (event->wd == m_wd && event->len > 0 && m_name == event->name)
+        changed = true;
+      p += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return changed;
+}
+
+} // namespace ImCNC
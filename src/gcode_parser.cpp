@@ -0,0 +1,537 @@
+/*
+ * gcode_parser.cpp
+ *
+ * minimal g-code reader for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "gcode_parser.hpp"
+
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <numbers>
+#include <string_view>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace ImCNC {
+
+// maximum deviation of the arc segments from the real arc, in mm
+static constexpr double c_arc_tolerance = 0.01;
+static constexpr int c_max_arc_segments = 10000;
+
+namespace {
+
+struct Block
+{
+  std::array<bool, 26> has{};
+  std::array<double, 26> value{};
+  std::vector<int> gcodes; // G code * 10
+  std::vector<int> mcodes;
+
+  bool word(char letter) const { return has[letter - 'A']; }
+  double get(char letter) const { return value[letter - 'A']; }
+  bool gcode(int code) const
+  {
+    return std::find(gcodes.begin(), gcodes.end(), code) != gcodes.end();
+  }
+};
+
+// splits a line into words, drops comments and everything that is not a
+// plain letter/number pair
+Block read_block(const std::string& line)
+{
+  Block block;
+  const char* p = line.c_str();
+
+  while (*p) {
+    char c = static_cast<char>(std::toupper(static_cast<unsigned char>(*p)));
+
+    if (c == '(') {
+      while (*p && *p != ')')
+        p++;
+      if (*p)
+        p++;
+      continue;
+    }
+    if (c == ';')
+      break;
+    if (c < 'A' || c > 'Z') {
+      p++;
+      continue;
+    }
+
+    p++;
+    while (*p == ' ' || *p == '\t')
+      p++;
+    char* end;
+    double value = std::strtod(p, &end);
+    if (end == p)
+      continue; // parameters, expressions...
+    p = end;
+
+    if (c == 'G')
+      block.gcodes.push_back(static_cast<int>(std::lround(value * 10)));
+    else if (c == 'M')
+      block.mcodes.push_back(static_cast<int>(std::lround(value)));
+    else {
+      block.has[c - 'A'] = true;
+      block.value[c - 'A'] = value;
+    }
+  }
+  return block;
+}
+
+// the whole program read in, then line by line like std::getline does.
+// read, not mapped: an editor truncating the file during a parse would be
+// a SIGBUS on the mapping.
+class ProgramFile
+{
+public:
+  int open(const std::string& path)
+  {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      return -1;
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    // up to where the file ends by now, if it got shorter
+    m_data.resize(static_cast<std::size_t>(st.st_size));
+    std::size_t size = 0;
+    while (size < m_data.size()) {
+      ssize_t n = read(fd, m_data.data() + size, m_data.size() - size);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        close(fd);
+        return -1;
+      }
+      if (n == 0)
+        break;
+      size += static_cast<std::size_t>(n);
+    }
+    close(fd);
+    m_data.resize(size);
+    return 0;
+  }
+
+  // the line at offset, which moves on to the next one. false at the end.
+  bool next(std::size_t& offset, std::string_view& line) const
+  {
+    if (offset >= m_data.size())
+      return false;
+
+    const char* begin = m_data.data() + offset;
+    std::size_t rest = m_data.size() - offset;
+    auto end = static_cast<const char*>(std::memchr(begin, '\n', rest));
+    std::size_t length = end ? end - begin : rest;
+    line = {begin, length};
+    offset += length + (end ? 1 : 0);
+    return true;
+  }
+
+private:
+  std::string m_data;
+};
+
+std::uint64_t line_hash(std::string_view line)
+{
+  constexpr std::uint64_t k = 0x9E3779B185EBCA87ull;
+  const char* p = line.data();
+  std::size_t n = line.size();
+  std::uint64_t h = n * k;
+  std::uint64_t w;
+
+  for (; n >= 8; p += 8, n -= 8) {
+    std::memcpy(&w, p, 8);
+    h = std::rotl((h ^ w) * k, 31);
+  }
+  w = 0;
+  std::memcpy(&w, p, n);
+  h = (h ^ w) * k;
+  h ^= h >> 29;
+  h *= 0xBF58476D1CE4E5B9ull;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace
+
+int GCodeParser::parse(const std::string& path, Toolpath& toolpath)
+{
+  std::ifstream f(path);
+
+  if (!f.good())
+    return -1;
+  return parse(f, toolpath);
+}
+
+int GCodeParser::parse(std::istream& in, Toolpath& toolpath)
+{
+  m_state = State{};
+  const auto& pos = m_state.position;
+  toolpath.set_origin(pos[0], pos[1], pos[2]);
+
+  std::string line;
+  int line_nr = 0;
+  while (std::getline(in, line)) {
+    line_nr++;
+    if (!_parse_line(line_nr, line, toolpath))
+      break;
+  }
+
+  toolpath.finish();
+  return 0;
+}
+
+int GCodeParser::parse(const std::string& path, Toolpath& toolpath,
+                       Index& index)
+{
+  ProgramFile file;
+  if (file.open(path) != 0)
+    return -1;
+
+  index = Index{};
+  m_state = State{};
+  const auto& pos = m_state.position;
+  toolpath.set_origin(pos[0], pos[1], pos[2]);
+
+  std::size_t offset = 0;
+  std::string_view line;
+  std::string text;
+  int line_nr = 0;
+  bool running = true;
+  // past the program end the lines are only hashed
+  while (file.next(offset, line)) {
+    line_nr++;
+    index.line_hashes.push_back(line_hash(line));
+    if (!running)
+      continue;
+
+    if (line_nr == 1 || line_nr % c_checkpoint_lines == 0) {
+      index.checkpoints.push_back(
+          {line_nr, static_cast<std::uint32_t>(toolpath.added_count()),
+           m_state});
+    }
+    text.assign(line);
+    running = _parse_line(line_nr, text, toolpath);
+    if (!running)
+      index.end_line = line_nr;
+  }
+
+  toolpath.finish();
+  return 0;
+}
+
+int GCodeParser::update(const std::string& path, const Toolpath& old,
+                        const Index& old_index, Toolpath& toolpath,
+                        Index& index)
+{
+  ProgramFile file;
+  if (file.open(path) != 0)
+    return -1;
+
+  const auto& old_hashes = old_index.line_hashes;
+  const auto& old_checkpoints = old_index.checkpoints;
+  index = Index{};
+  auto& hashes = index.line_hashes;
+
+  // hash the lines and note where the old checkpoints in the unchanged
+  // head of the program start
+  std::vector<std::size_t> starts;
+  std::size_t prefix = 0;
+  std::size_t offset = 0;
+  std::string_view line;
+  bool same = true;
+  for (std::size_t start = offset; file.next(offset, line); start = offset) {
+    std::size_t i = hashes.size();
+    if (same && starts.size() < old_checkpoints.size() &&
+        old_checkpoints[starts.size()].line == static_cast<int>(i + 1))
+      starts.push_back(start);
+
+    hashes.push_back(line_hash(line));
+    same = same && i < old_hashes.size() && hashes[i] == old_hashes[i];
+    if (same)
+      prefix = i + 1;
+  }
+
+  const std::size_t old_n = old_hashes.size();
+  const std::size_t new_n = hashes.size();
+  if (prefix == old_n && prefix == new_n) {
+    index = old_index;
+    return 1;
+  }
+  if (old_index.end_line > 0 &&
+      prefix >= static_cast<std::size_t>(old_index.end_line))
+  {
+    // changed after the program end
+    index.checkpoints = old_checkpoints;
+    index.end_line = old_index.end_line;
+    return 1;
+  }
+  if (starts.empty())
+    return parse(path, toolpath, index);
+
+  std::size_t suffix = 0;
+  while (suffix < std::min(old_n, new_n) - prefix &&
+         old_hashes[old_n - 1 - suffix] == hashes[new_n - 1 - suffix])
+    suffix++;
+  const int delta = static_cast<int>(new_n) - static_cast<int>(old_n);
+
+  const std::size_t restart = starts.size() - 1;
+  const auto& checkpoint = old_checkpoints[restart];
+  toolpath.resume(old, checkpoint.vertex, checkpoint.line);
+  index.checkpoints.assign(old_checkpoints.begin(),
+                           old_checkpoints.begin() + restart);
+  m_state = checkpoint.state;
+
+  offset = starts[restart];
+  std::string text;
+  int line_nr = checkpoint.line - 1;
+  std::size_t next = restart + 1;
+  while (file.next(offset, line)) {
+    line_nr++;
+
+    // in the unchanged tail, the rest can be copied once the state is the
+    // same as at an old checkpoint
+    if (static_cast<std::size_t>(line_nr) > new_n - suffix) {
+      int old_line = line_nr - delta;
+      while (next < old_checkpoints.size() &&
+             old_checkpoints[next].line < old_line)
+        next++;
+      if (next < old_checkpoints.size() &&
+          old_checkpoints[next].line == old_line &&
+          old_checkpoints[next].state == m_state)
+      {
+        const auto& from = old_checkpoints[next];
+        auto vertex_delta = static_cast<std::int64_t>(toolpath.added_count()) -
+                            from.vertex;
+        toolpath.append(old, from.line, delta);
+        for (auto c = old_checkpoints.begin() + next;
+             c != old_checkpoints.end(); c++)
+        {
+          index.checkpoints.push_back(
+              {c->line + delta,
+               static_cast<std::uint32_t>(c->vertex + vertex_delta),
+               c->state});
+        }
+        if (old_index.end_line > 0)
+          index.end_line = old_index.end_line + delta;
+        toolpath.finish();
+        return 0;
+      }
+    }
+
+    if (line_nr == checkpoint.line || line_nr % c_checkpoint_lines == 0) {
+      index.checkpoints.push_back(
+          {line_nr, static_cast<std::uint32_t>(toolpath.added_count()),
+           m_state});
+    }
+    text.assign(line);
+    if (!_parse_line(line_nr, text, toolpath)) {
+      index.end_line = line_nr;
+      break;
+    }
+  }
+
+  toolpath.finish();
+  return 0;
+}
+
+bool GCodeParser::_parse_line(int line_nr, const std::string& line,
+                              Toolpath& toolpath)
+{
+  // o-words (subroutines, loops) are beyond this parser
+  auto first = line.find_first_not_of(" \t/");
+  if (first != std::string::npos &&
+      (line[first] == 'o' || line[first] == 'O'))
+    return true;
+
+  Block block = read_block(line);
+  auto& state = m_state;
+
+  for (auto code : block.gcodes) {
+    switch (code) {
+    case 0:
+    case 10:
+    case 20:
+    case 30:
+    case 800:
+      state.motion_mode = (code == 800) ? -1 : code;
+      break;
+    case 170:
+    case 180:
+    case 190:
+      state.plane = code;
+      break;
+    case 200:
+      state.units = 25.4;
+      break;
+    case 210:
+      state.units = 1.0;
+      break;
+    case 900:
+      state.absolute = true;
+      break;
+    case 910:
+      state.absolute = false;
+      break;
+    case 901:
+      state.arc_absolute = true;
+      break;
+    case 911:
+      state.arc_absolute = false;
+      break;
+    default:
+      break;
+    }
+  }
+
+  // axis words of these don't describe a move of the current motion mode
+  bool non_motion = block.gcode(100) || block.gcode(280) ||
+                    block.gcode(300) || block.gcode(920) ||
+                    block.gcode(281) || block.gcode(301);
+
+  constexpr char axis_letters[] = {'X', 'Y', 'Z'};
+  constexpr char offset_letters[] = {'I', 'J', 'K'};
+  bool has_axis = false;
+  bool has_offset = false;
+  std::array<double, 3> end = state.position;
+  std::array<double, 3> offset{0, 0, 0};
+
+  for (int i = 0; i < 3; i++) {
+    if (block.word(axis_letters[i])) {
+      double v = block.get(axis_letters[i]) * state.units;
+      end[i] = state.absolute ? v : state.position[i] + v;
+      has_axis = true;
+    }
+    if (block.word(offset_letters[i])) {
+      offset[i] = block.get(offset_letters[i]) * state.units;
+      has_offset = true;
+    }
+  }
+
+  if (has_axis && !non_motion) {
+    switch (state.motion_mode) {
+    case 0:
+      toolpath.move_to(line_nr, MotionType::TRAVERSE, end[0], end[1], end[2]);
+      break;
+    case 10:
+      toolpath.move_to(line_nr, MotionType::FEED, end[0], end[1], end[2]);
+      break;
+    case 20:
+    case 30: {
+      double radius = block.word('R') ? block.get('R') * state.units : 0;
+      int turns = block.word('P') ? static_cast<int>(block.get('P')) : 1;
+      _arc(line_nr, state.motion_mode == 20, end, offset, has_offset, radius,
+           turns, toolpath);
+      break;
+    }
+    default:
+      break;
+    }
+    state.position = end;
+  }
+
+  for (auto code : block.mcodes) {
+    if (code == 2 || code == 30)
+      return false;
+  }
+  return true;
+}
+
+void GCodeParser::_arc(int line_nr, bool clockwise,
+                       const std::array<double, 3>& end,
+                       const std::array<double, 3>& offset, bool has_offset,
+                       double radius, int turns, Toolpath& toolpath)
+{
+  constexpr double pi = std::numbers::pi;
+  const auto& start = m_state.position;
+
+  // a, b span the plane, h is the helix axis. G18 is ZX so the usual
+  // clockwise test holds looking down the plane normal.
+  int a = 0, b = 1, h = 2;
+  if (m_state.plane == 180) {
+    a = 2;
+    b = 0;
+    h = 1;
+  }
+  else if (m_state.plane == 190) {
+    a = 1;
+    b = 2;
+    h = 0;
+  }
+
+  double ca, cb;
+  if (has_offset) {
+    ca = m_state.arc_absolute ? offset[a] : start[a] + offset[a];
+    cb = m_state.arc_absolute ? offset[b] : start[b] + offset[b];
+  }
+  else {
+    // radius format, center on the perpendicular bisector of the chord.
+    // negative radius selects the arc longer than half a circle.
+    double dx = end[a] - start[a];
+    double dy = end[b] - start[b];
+    double chord = std::hypot(dx, dy);
+    if (chord == 0 || std::abs(radius) < chord / 2) {
+      toolpath.move_to(line_nr, MotionType::ARC, end[0], end[1], end[2]);
+      return;
+    }
+    double d = std::sqrt(radius * radius - chord * chord / 4);
+    if (clockwise != (radius < 0))
+      d = -d;
+    ca = start[a] + dx / 2 - d * dy / chord;
+    cb = start[b] + dy / 2 + d * dx / chord;
+  }
+
+  double r = std::hypot(start[a] - ca, start[b] - cb);
+  double a0 = std::atan2(start[b] - cb, start[a] - ca);
+  double a1 = std::atan2(end[b] - cb, end[a] - ca);
+  double sweep = a1 - a0;
+
+  if (clockwise) {
+    if (sweep >= 0)
+      sweep -= 2 * pi;
+  }
+  else {
+    if (sweep <= 0)
+      sweep += 2 * pi;
+  }
+  if (turns > 1)
+    sweep += (clockwise ? -2 * pi : 2 * pi) * (turns - 1);
+
+  double step = (r > c_arc_tolerance)
+                    ? 2 * std::acos(1 - c_arc_tolerance / r)
+                    : pi / 2;
+  int segments = static_cast<int>(std::ceil(std::abs(sweep) / step));
+  segments = std::clamp(segments, 1, c_max_arc_segments);
+
+  std::array<double, 3> p;
+  for (int i = 1; i < segments; i++) {
+    double t = static_cast<double>(i) / segments;
+    double angle = a0 + sweep * t;
+    p[a] = ca + r * std::cos(angle);
+    p[b] = cb + r * std::sin(angle);
+    p[h] = start[h] + (end[h] - start[h]) * t;
+    toolpath.move_to(line_nr, MotionType::ARC, p[0], p[1], p[2]);
+  }
+  toolpath.move_to(line_nr, MotionType::ARC, end[0], end[1], end[2]);
+}
+
+} // namespace ImCNC
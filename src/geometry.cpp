@@ -0,0 +1,157 @@
+/*
+ * geometry.cpp
+ *
+ * distance tests between points, segments and triangles
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "geometry.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ImCNC {
+
+// Ericson, Real-Time Collision Detection, 5.1.9
+double segment_distance2(const Vec& p0, const Vec& p1, const Vec& q0,
+                         const Vec& q1, double& s)
+{
+  Vec d1 = sub(p1, p0);
+  Vec d2 = sub(q1, q0);
+  Vec r = sub(p0, q0);
+  double a = dot(d1, d1);
+  double e = dot(d2, d2);
+  double f = dot(d2, r);
+  double t;
+
+  if (e <= 1e-12) {
+    // q is a point
+    t = 0;
+    s = (a > 1e-12) ? std::clamp(-dot(d1, r) / a, 0.0, 1.0) : 0.0;
+  }
+  else {
+    double c = dot(d1, r);
+    double b = dot(d1, d2);
+    double denom = a * e - b * b;
+
+    s = (denom > 1e-12) ? std::clamp((b * f - c * e) / denom, 0.0, 1.0) : 0.0;
+    t = (b * s + f) / e;
+    if (t < 0) {
+      t = 0;
+      s = (a > 1e-12) ? std::clamp(-c / a, 0.0, 1.0) : 0.0;
+    }
+    else if (t > 1) {
+      t = 1;
+      s = (a > 1e-12) ? std::clamp((b - c) / a, 0.0, 1.0) : 0.0;
+    }
+  }
+
+  Vec cp, cq;
+  for (int i = 0; i < 3; i++) {
+    cp[i] = p0[i] + d1[i] * s;
+    cq[i] = q0[i] + d2[i] * t;
+  }
+  Vec d = sub(cp, cq);
+  return dot(d, d);
+}
+
+// Ericson, 5.1.5
+Vec closest_on_triangle(const Vec& p, const Vec& a, const Vec& b,
+                        const Vec& c)
+{
+  auto along = [](const Vec& o, const Vec& d, double t) {
+    return Vec{o[0] + d[0] * t, o[1] + d[1] * t, o[2] + d[2] * t};
+  };
+
+  Vec ab = sub(b, a);
+  Vec ac = sub(c, a);
+  Vec ap = sub(p, a);
+  double d1 = dot(ab, ap);
+  double d2 = dot(ac, ap);
+  if (d1 <= 0 && d2 <= 0)
+    return a;
+
+  Vec bp = sub(p, b);
+  double d3 = dot(ab, bp);
+  double d4 = dot(ac, bp);
+  if (d3 >= 0 && d4 <= d3)
+    return b;
+
+  double vc = d1 * d4 - d3 * d2;
+  if (vc <= 0 && d1 >= 0 && d3 <= 0)
+    return along(a, ab, d1 / (d1 - d3));
+
+  Vec cp = sub(p, c);
+  double d5 = dot(ab, cp);
+  double d6 = dot(ac, cp);
+  if (d6 >= 0 && d5 <= d6)
+    return c;
+
+  double vb = d5 * d2 - d1 * d6;
+  if (vb <= 0 && d2 >= 0 && d6 <= 0)
+    return along(a, ac, d2 / (d2 - d6));
+
+  double va = d3 * d6 - d5 * d4;
+  if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+    return along(b, sub(c, b), (d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+  double denom = 1.0 / (va + vb + vc);
+  double v = vb * denom;
+  double w = vc * denom;
+  return {a[0] + ab[0] * v + ac[0] * w, a[1] + ab[1] * v + ac[1] * w,
+          a[2] + ab[2] * v + ac[2] * w};
+}
+
+double segment_triangle_distance2(const Vec& p0, const Vec& p1,
+                                  const std::array<Vec, 3>& t)
+{
+  // Moeller-Trumbore, limited to the segment
+  Vec d = sub(p1, p0);
+  Vec e1 = sub(t[1], t[0]);
+  Vec e2 = sub(t[2], t[0]);
+  Vec h = cross(d, e2);
+  double det = dot(e1, h);
+  if (std::abs(det) > 1e-12) {
+    Vec s = sub(p0, t[0]);
+    double u = dot(s, h) / det;
+    Vec q = cross(s, e1);
+    double v = dot(d, q) / det;
+    double k = dot(e2, q) / det;
+    if (u >= 0 && v >= 0 && u + v <= 1 && k >= 0 && k <= 1)
+      return 0;
+  }
+
+  // otherwise the closest points are on the segment's ends or on one of
+  // the triangle's edges
+  double s;
+  double best = std::min(segment_distance2(p0, p1, t[0], t[1], s),
+                         segment_distance2(p0, p1, t[1], t[2], s));
+  best = std::min(best, segment_distance2(p0, p1, t[2], t[0], s));
+  for (const auto& p : {p0, p1}) {
+    Vec c = sub(p, closest_on_triangle(p, t[0], t[1], t[2]));
+    best = std::min(best, dot(c, c));
+  }
+  return best;
+}
+
+double triangle_distance2(const std::array<Vec, 3>& t,
+                          const std::array<Vec, 3>& u)
+{
+  // intersecting triangles have an edge of one passing through the other,
+  // for disjoint ones an edge or a corner of one is closest to the other
+  double best = segment_triangle_distance2(t[0], t[1], u);
+  best = std::min(best, segment_triangle_distance2(t[1], t[2], u));
+  best = std::min(best, segment_triangle_distance2(t[2], t[0], u));
+  if (best == 0)
+    return 0;
+
+  Vec n = cross(sub(t[1], t[0]), sub(t[2], t[0]));
+  if (dot(n, n) > 1e-12) {
+    best = std::min(best, segment_triangle_distance2(u[0], u[1], t));
+    best = std::min(best, segment_triangle_distance2(u[1], u[2], t));
+    best = std::min(best, segment_triangle_distance2(u[2], u[0], t));
+  }
+  return best;
+}
+
+} // namespace ImCNC
@@ -0,0 +1,112 @@
+/*
+ * hal_dro.cpp
+ *
+ * axis positions read from the motion pins
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_dro.hpp"
+
+#include "hal_snapshot.hpp"
+
+#include <cctype>
+#include <cstring>
+#include <stdio.h>
+
+namespace ImCNC {
+
+static constexpr char c_axis_letters[] = "xyzabcuvw";
+
+void HalDro::set_kinematics(const std::string& kinematics)
+{
+  m_joints.fill(-1);
+  if (kinematics.compare(0, 8, "trivkins") != 0 ||
+      (kinematics.size() > 8 &&
+       !std::isspace(static_cast<unsigned char>(kinematics[8]))))
+    return;
+
+  // without coordinates= every axis has a joint, in order
+  std::string coordinates = "xyzabcuvw";
+  auto at = kinematics.find("coordinates=");
+  if (at != std::string::npos) {
+    coordinates.clear();
+    for (at += 12; at < kinematics.size(); at++) {
+      auto c = static_cast<unsigned char>(kinematics[at]);
+      if (std::isspace(c))
+        break;
+      coordinates.push_back(static_cast<char>(std::tolower(c)));
+    }
+  }
+
+  for (int joint = 0; joint < static_cast<int>(coordinates.size()); joint++) {
+    const char* letter = std::strchr(c_axis_letters, coordinates[joint]);
+    if (!letter || !*letter)
+      continue;
+    int axis = static_cast<int>(letter - c_axis_letters);
+    if (m_joints[axis] < 0)
+      m_joints[axis] = joint;
+  }
+  m_stamp = 0;
+}
+
+int HalDro::update()
+{
+  auto now = std::chrono::steady_clock::now();
+  if (now - m_checked >= c_refresh) {
+    m_checked = now;
+    std::uint64_t stamp = HalSnapshot::current_stamp();
+    if (stamp == 0)
+      m_found = false;
+    else if (stamp != m_stamp) {
+      m_stamp = stamp;
+      _resolve();
+    }
+  }
+  return m_found ? 0 : -1;
+}
+
+void HalDro::_resolve()
+{
+  HalSnapshot snapshot;
+  m_cmd.fill(nullptr);
+  m_fb.fill(nullptr);
+  m_found = false;
+  if (snapshot.take() != 0)
+    return;
+
+  auto find_pin = [&](const char* name) -> const volatile double* {
+    for (const auto& pin : snapshot.pins) {
+      if (pin.type == HAL_FLOAT && std::strcmp(name, pin.name) == 0)
+        return static_cast<const volatile double*>(pin.value);
+    }
+    return nullptr;
+  };
+  char name[32];
+  for (int axis = 0; axis < c_axes; axis++) {
+    snprintf(name, sizeof(name), "axis.%c.pos-cmd", c_axis_letters[axis]);
+    m_cmd[axis] = find_pin(name);
+    m_found = m_found || m_cmd[axis];
+    if (m_joints[axis] >= 0) {
+      snprintf(name, sizeof(name), "joint.%d.pos-fb", m_joints[axis]);
+      m_fb[axis] = find_pin(name);
+    }
+  }
+}
+
+bool HalDro::commanded(int axis, double& position) const
+{
+  if (!m_cmd[axis])
+    return false;
+  position = *m_cmd[axis];
+  return true;
+}
+
+bool HalDro::actual(int axis, double& position) const
+{
+  if (!m_fb[axis])
+    return false;
+  position = *m_fb[axis];
+  return true;
+}
+
+} // namespace ImCNC
@@ -0,0 +1,369 @@
+/*
+ * hal_graph.cpp
+ *
+ * the HAL netlist as a graph of components
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_graph.hpp"
+
+#include "hal_snapshot.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <stdio.h>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+namespace ImCNC {
+
+static constexpr char c_layout_magic[8] = {'C', 'K', 'P', 'T',
+                                           'H', 'G', 'R', 'F'};
+static constexpr std::uint32_t c_layout_version = 1;
+static constexpr int c_sweeps = 8;
+static constexpr int c_loose_per_column = 16;
+static constexpr float c_column_gap = 120;
+static constexpr float c_row_gap = 24;
+
+static std::uint64_t mix(std::uint64_t h, std::uint64_t v)
+{
+  return std::rotl(h ^ v, 27) * 0x9E3779B185EBCA87ull;
+}
+
+static std::uint64_t name_hash(const char* name)
+{
+  std::uint64_t h = 0xCBF29CE484222325ull;
+  for (const char* c = name; *c; c++)
+    h = (h ^ static_cast<unsigned char>(*c)) * 0x100000001B3ull;
+  return h;
+}
+
+void HalGraph::build(const HalSnapshot& snapshot)
+{
+  nodes.clear();
+  links.clear();
+  pin_nodes.assign(snapshot.pins.size(), -1);
+  nodes.resize(snapshot.comps.size());
+  for (std::size_t c = 0; c < nodes.size(); c++)
+    nodes[c].comp = static_cast<int>(c);
+
+  std::unordered_map<std::string_view, int> signal_index;
+  for (std::size_t s = 0; s < snapshot.signals.size(); s++)
+    signal_index.emplace(snapshot.signals[s].name, static_cast<int>(s));
+
+  std::vector<int> writer(snapshot.signals.size(), -1);
+  std::vector<std::vector<int>> others(snapshot.signals.size());
+  for (int i = 0; i < static_cast<int>(snapshot.pins.size()); i++) {
+    const auto& pin = snapshot.pins[i];
+    if (pin.owner < 0)
+      continue;
+    auto& node = nodes[pin.owner];
+    auto it = signal_index.find(pin.signal);
+    if (!pin.signal[0] || it == signal_index.end()) {
+      node.unlinked++;
+      continue;
+    }
+    pin_nodes[i] = pin.owner;
+    if (pin.dir == HAL_OUT) {
+      node.outputs.push_back(i);
+      writer[it->second] = i;
+    }
+    else {
+      node.inputs.push_back(i);
+      others[it->second].push_back(i);
+    }
+  }
+
+  for (int s = 0; s < static_cast<int>(writer.size()); s++) {
+    auto& to = others[s];
+    int from = writer[s];
+    if (from < 0) {
+      auto io = std::find_if(to.begin(), to.end(), [&](int pin) {
+        return snapshot.pins[pin].dir == HAL_IO;
+      });
+      if (io == to.end())
+        continue;
+      from = *io;
+      to.erase(io);
+    }
+    for (int pin : to)
+      links.push_back({from, pin, s});
+  }
+
+  key = mix(1, nodes.size());
+  for (const auto& comp : snapshot.comps)
+    key = mix(key, name_hash(comp.name));
+  for (const auto& link : links) {
+    key = mix(key, name_hash(snapshot.pins[link.from].name));
+    key = mix(key, name_hash(snapshot.pins[link.to].name));
+  }
+}
+
+HalLayout layout_graph(const HalGraph& graph,
+                       const std::vector<std::array<float, 2>>& sizes)
+{
+  const int n = static_cast<int>(graph.nodes.size());
+  HalLayout layout;
+  layout.key = graph.key;
+  layout.positions.resize(n);
+
+  std::vector<std::pair<int, int>> edges;
+  for (const auto& link : graph.links) {
+    int from = graph.pin_nodes[link.from];
+    int to = graph.pin_nodes[link.to];
+    if (from != to)
+      edges.emplace_back(from, to);
+  }
+  std::sort(edges.begin(), edges.end());
+  edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+  std::vector<std::vector<int>> out(n);
+  for (auto [from, to] : edges)
+    out[from].push_back(to);
+
+  // depth first, an edge back to a node still on the stack closes a cycle
+  // and is turned around
+  enum : std::uint8_t { NEW, OPEN, DONE };
+  std::vector<std::uint8_t> state(n, NEW);
+  std::vector<std::pair<int, std::size_t>> stack;
+  std::vector<std::pair<int, int>> dag;
+  for (int root = 0; root < n; root++) {
+    if (state[root] != NEW)
+      continue;
+    state[root] = OPEN;
+    stack.emplace_back(root, 0);
+    while (!stack.empty()) {
+      auto& [v, next] = stack.back();
+      if (next == out[v].size()) {
+        state[v] = DONE;
+        stack.pop_back();
+        continue;
+      }
+      int w = out[v][next++];
+      if (state[w] == OPEN)
+        dag.emplace_back(w, v);
+      else {
+        dag.emplace_back(v, w);
+        if (state[w] == NEW) {
+          state[w] = OPEN;
+          stack.emplace_back(w, 0);
+        }
+      }
+    }
+  }
+
+  std::vector<std::vector<int>> succ(n), pred(n);
+  for (auto [from, to] : dag) {
+    succ[from].push_back(to);
+    pred[to].push_back(from);
+  }
+
+  // longest path from the sources, in topological order
+  std::vector<int> layer(n, 0);
+  std::vector<int> incoming(n);
+  std::vector<int> ready;
+  for (int v = 0; v < n; v++) {
+    incoming[v] = static_cast<int>(pred[v].size());
+    if (incoming[v] == 0)
+      ready.push_back(v);
+  }
+  while (!ready.empty()) {
+    int v = ready.back();
+    ready.pop_back();
+    for (int w : succ[v]) {
+      layer[w] = std::max(layer[w], layer[v] + 1);
+      if (--incoming[w] == 0)
+        ready.push_back(w);
+    }
+  }
+
+  std::vector<std::vector<int>> columns;
+  std::vector<int> loose;
+  for (int v = 0; v < n; v++) {
+    if (succ[v].empty() && pred[v].empty()) {
+      loose.push_back(v);
+      continue;
+    }
+    if (layer[v] >= static_cast<int>(columns.size()))
+      columns.resize(layer[v] + 1);
+    columns[layer[v]].push_back(v);
+  }
+  const int linked_columns = static_cast<int>(columns.size());
+
+  // position in the column relative to its height, so columns of
+  // different sizes compare
+  std::vector<double> rank(n, 0);
+  auto update_rank = [&](const std::vector<int>& column) {
+    for (std::size_t i = 0; i < column.size(); i++)
+      rank[column[i]] = (i + 0.5) / column.size();
+  };
+  for (const auto& column : columns)
+    update_rank(column);
+
+  std::vector<double> center(n);
+  for (int sweep = 0; sweep < c_sweeps; sweep++) {
+    bool down = sweep % 2 == 0;
+    for (int i = 0; i < linked_columns; i++) {
+      auto& column = columns[down ? i : linked_columns - 1 - i];
+      for (int v : column) {
+        const auto& neighbours = down ? pred[v] : succ[v];
+        if (neighbours.empty()) {
+          center[v] = rank[v];
+          continue;
+        }
+        double sum = 0;
+        for (int w : neighbours)
+          sum += rank[w];
+        center[v] = sum / neighbours.size();
+      }
+      std::stable_sort(column.begin(), column.end(),
+                       [&](int a, int b) { return center[a] < center[b]; });
+      update_rank(column);
+    }
+  }
+
+  for (std::size_t i = 0; i < loose.size(); i += c_loose_per_column) {
+    auto end = std::min(loose.size(), i + c_loose_per_column);
+    columns.emplace_back(loose.begin() + i, loose.begin() + end);
+  }
+
+  // columns side by side, each centered on the tallest
+  std::vector<float> heights(columns.size(), 0);
+  float tallest = 0;
+  for (std::size_t c = 0; c < columns.size(); c++) {
+    for (int v : columns[c])
+      heights[c] += sizes[v][1] + c_row_gap;
+    tallest = std::max(tallest, heights[c]);
+  }
+  float x = 0;
+  for (std::size_t c = 0; c < columns.size(); c++) {
+    float width = 0;
+    float y = std::round((tallest - heights[c]) / 2);
+    for (int v : columns[c]) {
+      layout.positions[v] = {x, y};
+      y += sizes[v][1] + c_row_gap;
+      width = std::max(width, sizes[v][0]);
+    }
+    x += width + c_column_gap;
+  }
+  return layout;
+}
+
+namespace {
+
+struct LayoutHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t count;
+  std::uint64_t key;
+};
+
+} // namespace
+
+HalGraphLayouts::HalGraphLayouts()
+{
+  if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    m_dir = std::string(xdg) + "/cockpit";
+  else if (const char* home = getenv("HOME"); home && *home)
+    m_dir = std::string(home) + "/.cache/cockpit";
+}
+
+const HalLayout* HalGraphLayouts::get(
+    const HalGraph& graph, const std::vector<std::array<float, 2>>& sizes)
+{
+  if (m_pending.valid() &&
+      m_pending.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+  {
+    HalLayout layout = m_pending.get();
+    _store(layout);
+    m_layouts[layout.key] = std::move(layout);
+  }
+
+  auto it = m_layouts.find(graph.key);
+  if (it != m_layouts.end())
+    return &it->second;
+
+  HalLayout layout;
+  if (_load(graph.key, graph.nodes.size(), layout) == 0)
+    return &(m_layouts[graph.key] = std::move(layout));
+
+  // one at a time, the graph may have changed again once it is done
+  if (!m_pending.valid())
+    m_pending = std::async(std::launch::async, layout_graph, graph, sizes);
+  return nullptr;
+}
+
+std::string HalGraphLayouts::_file_name(std::uint64_t key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.graph",
+           static_cast<unsigned long long>(key));
+  return m_dir + name;
+}
+
+int HalGraphLayouts::_load(std::uint64_t key, std::size_t nodes,
+                           HalLayout& layout) const
+{
+  if (m_dir.empty())
+    return -1;
+
+  FILE* f = fopen(_file_name(key).c_str(), "rb");
+  if (!f)
+    return -1;
+
+  LayoutHeader header;
+  layout.key = key;
+  layout.positions.resize(nodes);
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+            std::memcmp(header.magic, c_layout_magic,
+                        sizeof(c_layout_magic)) == 0 &&
+            header.version == c_layout_version && header.key == key &&
+            header.count == nodes &&
+            fread(layout.positions.data(), sizeof(layout.positions[0]),
+                  nodes, f) == nodes;
+  fclose(f);
+  return ok ? 0 : -1;
+}
+
+int HalGraphLayouts::_store(const HalLayout& layout) const
+{
+  if (m_dir.empty())
+    return -1;
+
+  std::error_code ec;
+  std::filesystem::create_directories(m_dir, ec);
+  if (ec)
+    return -1;
+
+  // written next to it and renamed, a reader never sees half a file
+  std::string name = _file_name(layout.key);
+  std::string tmp = name + ".tmp";
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (!f)
+    return -1;
+
+  LayoutHeader header{};
+  std::memcpy(header.magic, c_layout_magic, sizeof(c_layout_magic));
+  header.version = c_layout_version;
+  header.count = static_cast<std::uint32_t>(layout.positions.size());
+  header.key = layout.key;
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(layout.positions.data(), sizeof(layout.positions[0]),
+                   layout.positions.size(),
+                   f) == layout.positions.size();
+  ok = fclose(f) == 0 && ok;
+  if (!ok || std::rename(tmp.c_str(), name.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    return -1;
+  }
+  return 0;
+}
+
+} // namespace ImCNC
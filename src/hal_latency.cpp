@@ -0,0 +1,209 @@
+/*
+ * hal_latency.cpp
+ *
+ * runtime distribution of the HAL threads and functions
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_latency.hpp"
+
+#include "hal_snapshot.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace ImCNC {
+
+static int bucket_of(double ns)
+{
+  if (ns <= HalLatency::c_first_bucket)
+    return 0;
+  int b = static_cast<int>(8 * std::log2(ns / HalLatency::c_first_bucket));
+  return std::clamp(b, 0, HalLatency::c_buckets - 1);
+}
+
+// upper end of a bucket
+static double bucket_ns(int bucket)
+{
+  return HalLatency::c_first_bucket * std::exp2((bucket + 1) / 8.0);
+}
+
+// rtapi_get_clocks() is the TSC on x86 and ns everywhere else
+static double measure_ns_per_clock()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  auto c0 = __rdtsc();
+  struct timespec wait = {0, 20000000};
+  nanosleep(&wait, nullptr);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  auto c1 = __rdtsc();
+  double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+  return c1 > c0 ? ns / (c1 - c0) : 1;
+#else
+  return 1;
+#endif
+}
+
+// measured once, the first time on the poll thread. it takes 20 ms, the UI
+// shouldn't wait for that every time the HAL structure changes.
+static double ns_per_clock()
+{
+  static const double ns = measure_ns_per_clock();
+  return ns;
+}
+
+HalLatency::~HalLatency()
+{
+  stop();
+}
+
+void HalLatency::start(const HalSnapshot& snapshot)
+{
+  stop();
+  m_sources.clear();
+
+  auto find_pin = [&](const std::string& name) -> const volatile void* {
+    for (const auto& pin : snapshot.pins) {
+      if (name == pin.name && pin.type == HAL_S32)
+        return pin.value;
+    }
+    return nullptr;
+  };
+  auto find_param = [&](const std::string& name) -> const volatile void* {
+    for (const auto& param : snapshot.params) {
+      if (name == param.name && param.type == HAL_S32)
+        return param.value;
+    }
+    return nullptr;
+  };
+  auto add = [&](const char* name, bool thread, int item, long period) {
+    auto time = find_pin(std::string(name) + ".time");
+    if (!time)
+      return;
+    auto& source = m_sources.emplace_back();
+    source.stats.name = name;
+    source.stats.thread = thread;
+    source.stats.item = item;
+    source.stats.period = period;
+    source.time = static_cast<const volatile std::int32_t*>(time);
+    source.tmax = static_cast<const volatile std::int32_t*>(
+        find_param(std::string(name) + ".tmax"));
+    source.window.resize(c_window);
+  };
+  for (std::size_t i = 0; i < snapshot.threads.size(); i++) {
+    const auto& thread = snapshot.threads[i];
+    add(thread.name, true, static_cast<int>(i), thread.period);
+  }
+  for (std::size_t i = 0; i < snapshot.functs.size(); i++)
+    add(snapshot.functs[i].name, false, static_cast<int>(i), 0);
+  if (m_sources.empty())
+    return;
+
+  m_stop = false;
+  m_thread = std::thread(&HalLatency::_poll, this);
+}
+
+void HalLatency::stop()
+{
+  if (!m_thread.joinable())
+    return;
+
+  m_stop = true;
+  m_thread.join();
+}
+
+void HalLatency::stats(std::vector<Stats>& out) const
+{
+  std::lock_guard lock(m_mutex);
+  out.resize(m_sources.size());
+  for (std::size_t i = 0; i < m_sources.size(); i++)
+    out[i] = m_sources[i].stats;
+}
+
+void HalLatency::_add(Source& source, double ns)
+{
+  if (source.window_size == c_window)
+    source.histogram[bucket_of(source.window[source.window_at])]--;
+  else
+    source.window_size++;
+  source.window[source.window_at] = static_cast<float>(ns);
+  source.window_at = (source.window_at + 1) % c_window;
+  source.histogram[bucket_of(ns)]++;
+
+  auto& stats = source.stats;
+  stats.runs++;
+  if (stats.thread && ns > stats.period)
+    stats.overruns++;
+  source.step_max = std::max(source.step_max, static_cast<float>(ns));
+}
+
+void HalLatency::_update(Source& source)
+{
+  auto& stats = source.stats;
+  std::memmove(stats.history.data(), stats.history.data() + 1,
+               (c_history - 1) * sizeof(float));
+  stats.history[c_history - 1] = source.step_max;
+  source.step_max = 0;
+
+  int n = source.window_size;
+  if (n == 0)
+    return;
+  int p50 = (n + 1) / 2, p99 = static_cast<int>(std::ceil(n * 0.99));
+  int count = 0;
+  stats.p50 = stats.p99 = 0;
+  for (int b = 0; b < c_buckets; b++) {
+    count += source.histogram[b];
+    if (stats.p50 == 0 && count >= p50)
+      stats.p50 = bucket_ns(b);
+    if (count >= p99) {
+      stats.p99 = bucket_ns(b);
+      break;
+    }
+  }
+  double sum = 0;
+  float max = 0;
+  for (int i = 0; i < n; i++) {
+    sum += source.window[i];
+    max = std::max(max, source.window[i]);
+  }
+  stats.mean = sum / n;
+  stats.max = max;
+}
+
+void HalLatency::_poll()
+{
+  m_ns_per_clock = ns_per_clock();
+  using Clock = std::chrono::steady_clock;
+  auto next_step = Clock::now() + c_history_step;
+
+  while (!m_stop.load(std::memory_order_relaxed)) {
+    {
+      std::lock_guard lock(m_mutex);
+      for (auto& source : m_sources) {
+        std::int32_t time = *source.time;
+        if (time != source.last) {
+          source.last = time;
+          _add(source, time * m_ns_per_clock);
+        }
+        if (source.tmax)
+          source.stats.tmax = *source.tmax * m_ns_per_clock;
+      }
+
+      if (Clock::now() >= next_step) {
+        next_step += c_history_step;
+        for (auto& source : m_sources)
+          _update(source);
+      }
+    }
+    std::this_thread::sleep_for(c_poll);
+  }
+}
+
+} // namespace ImCNC
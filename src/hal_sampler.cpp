@@ -0,0 +1,250 @@
+/*
+ * hal_sampler.cpp
+ *
+ * HAL values sampled at a fixed rate
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_sampler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <time.h>
+
+namespace ImCNC {
+
+// samples this close to being overwritten aren't read
+static constexpr std::uint64_t c_margin = HalSampler::c_capacity / 8;
+
+static double now_seconds()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double read_value(hal_type_t type, const volatile void* value)
+{
+  switch (type) {
+  case HAL_BIT:
+    return *static_cast<const volatile char*>(value) ? 1 : 0;
+  case HAL_S32:
+    return *static_cast<const volatile std::int32_t*>(value);
+  case HAL_U32:
+    return *static_cast<const volatile std::uint32_t*>(value);
+  case HAL_FLOAT:
+    return *static_cast<const volatile double*>(value);
+  default:
+    return 0;
+  }
+}
+
+HalSampler::~HalSampler()
+{
+  stop();
+}
+
+int HalSampler::start(std::vector<Channel> channels, double rate)
+{
+  stop();
+  if (channels.empty() || rate <= 0)
+    return -1;
+
+  m_channels = std::move(channels);
+  m_rate = std::min(rate, c_max_rate);
+  m_times = std::make_unique<std::atomic<double>[]>(c_capacity);
+  m_values = std::make_unique<std::atomic<double>[]>(m_channels.size() *
+                                                     c_capacity);
+  m_count = 0;
+  m_missed = 0;
+  m_stop = false;
+  m_thread = std::thread(&HalSampler::_sample, this);
+  return 0;
+}
+
+void HalSampler::stop()
+{
+  stop_capture();
+  if (!m_thread.joinable())
+    return;
+
+  m_stop = true;
+  m_thread.join();
+}
+
+void HalSampler::_sample()
+{
+  const auto period = static_cast<long>(1e9 / m_rate);
+  const std::size_t channels = m_channels.size();
+  struct timespec next;
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  for (std::uint64_t i = 0; !m_stop.load(std::memory_order_relaxed); i++) {
+    std::size_t at = i % c_capacity;
+    for (std::size_t c = 0; c < channels; c++) {
+      m_values[c * c_capacity + at].store(
+          read_value(m_channels[c].type, m_channels[c].value),
+          std::memory_order_relaxed);
+    }
+    m_times[at].store(now_seconds(), std::memory_order_relaxed);
+    m_count.store(i + 1, std::memory_order_release);
+
+    // absolute deadlines, ticks that are already past are skipped
+    next.tv_nsec += period;
+    while (next.tv_nsec >= 1000000000) {
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long late = (now.tv_sec - next.tv_sec) * 1000000000L +
+                (now.tv_nsec - next.tv_nsec);
+    if (late > 0) {
+      long skip = late / period + 1;
+      m_missed.fetch_add(skip, std::memory_order_relaxed);
+      next.tv_nsec += skip * period;
+      next.tv_sec += next.tv_nsec / 1000000000;
+      next.tv_nsec %= 1000000000;
+    }
+    clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, nullptr);
+  }
+}
+
+double HalSampler::time(std::uint64_t sample) const
+{
+  return m_times[sample % c_capacity].load(std::memory_order_relaxed);
+}
+
+double HalSampler::value(int channel, std::uint64_t sample) const
+{
+  return m_values[channel * c_capacity + sample % c_capacity].load(
+      std::memory_order_relaxed);
+}
+
+bool HalSampler::kept(std::uint64_t sample) const
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+  return sample + c_capacity > count();
+}
+
+void HalSampler::decimate(int channel, std::uint64_t first,
+                          std::uint64_t last, int columns, float* min,
+                          float* max) const
+{
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  std::fill(min, min + columns, nan);
+  std::fill(max, max + columns, nan);
+
+  std::uint64_t count = this->count();
+  last = std::min(last, count);
+  if (count > c_capacity - c_margin)
+    first = std::max(first, count - (c_capacity - c_margin));
+  if (first >= last || columns <= 0)
+    return;
+
+  const double span = static_cast<double>(last - first);
+  for (std::uint64_t i = first; i < last; i++) {
+    int column = static_cast<int>((i - first) * columns / span);
+    float v = static_cast<float>(value(channel, i));
+    if (std::isnan(min[column]) || v < min[column])
+      min[column] = v;
+    if (std::isnan(max[column]) || v > max[column])
+      max[column] = v;
+  }
+
+  // columns of samples overwritten while they were read are dropped
+  for (std::uint64_t i = first; i < last && !kept(i); i++) {
+    int column = static_cast<int>((i - first) * columns / span);
+    min[column] = max[column] = nan;
+  }
+}
+
+int HalSampler::capture(const std::string& path)
+{
+  stop_capture();
+  if (!running())
+    return -1;
+
+  std::FILE* f = std::fopen(path.c_str(), "wb");
+  if (!f) {
+    fprintf(stderr, "sampler: can't write %s\n", path.c_str());
+    return -1;
+  }
+  bool csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+
+  if (csv) {
+    fprintf(f, "time");
+    for (const auto& channel : m_channels)
+      fprintf(f, ",%s", channel.name.c_str());
+    fprintf(f, "\n");
+  }
+  else {
+    fprintf(f, "cockpit-samples 1\nrate %g\nchannels %zu\ntime", m_rate,
+            m_channels.size());
+    for (const auto& channel : m_channels)
+      fprintf(f, " %s", channel.name.c_str());
+    fprintf(f, "\ndata\n");
+  }
+
+  m_captured = 0;
+  m_dropped = 0;
+  m_stop_capture = false;
+  m_writer = std::thread(&HalSampler::_write, this, f, csv);
+  return 0;
+}
+
+void HalSampler::stop_capture()
+{
+  if (!m_writer.joinable())
+    return;
+
+  m_stop_capture = true;
+  m_writer.join();
+}
+
+// starts at the newest sample, the rest follows as it comes in
+void HalSampler::_write(std::FILE* f, bool csv)
+{
+  const std::size_t channels = m_channels.size();
+  std::vector<double> row(channels + 1);
+  std::uint64_t next = count();
+  bool stopping = false;
+
+  while (!stopping) {
+    stopping = m_stop_capture.load(std::memory_order_relaxed);
+    std::uint64_t count = this->count();
+    if (count > next + c_capacity - c_margin) {
+      std::uint64_t first = count - (c_capacity - c_margin);
+      m_dropped.fetch_add(first - next, std::memory_order_relaxed);
+      next = first;
+    }
+
+    for (; next < count; next++) {
+      row[0] = time(next);
+      for (std::size_t c = 0; c < channels; c++)
+        row[c + 1] = value(static_cast<int>(c), next);
+      if (!kept(next)) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+
+      if (csv) {
+        fprintf(f, "%.9f", row[0]);
+        for (std::size_t c = 1; c <= channels; c++)
+          fprintf(f, ",%.9g", row[c]);
+        fprintf(f, "\n");
+      }
+      else
+        fwrite(row.data(), sizeof(double), row.size(), f);
+      m_captured.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (!stopping)
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  }
+  std::fclose(f);
+}
+
+} // namespace ImCNC
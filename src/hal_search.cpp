@@ -0,0 +1,154 @@
+/*
+ * hal_search.cpp
+ *
+ * finding HAL names as they are typed
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_search.hpp"
+
+#include "hal_snapshot.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+namespace ImCNC {
+
+static char lower(char c)
+{
+  return static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+}
+
+// a bit per letter and digit, one for everything else
+static std::uint64_t char_bit(char c)
+{
+  if (c >= 'a' && c <= 'z')
+    return 1ull << (c - 'a');
+  if (c >= '0' && c <= '9')
+    return 1ull << (26 + c - '0');
+  return 1ull << 36;
+}
+
+static bool starts_part(const char* name, std::size_t at)
+{
+  if (at == 0)
+    return true;
+  char c = name[at - 1];
+  return c == '.' || c == '-' || c == '_';
+}
+
+// false if the query's characters don't appear in the name in order
+static bool match(const char* name, std::size_t length,
+                  const std::string& query, int& score)
+{
+  score = 0;
+  int run = 0;
+  std::size_t at = 0;
+
+  for (char q : query) {
+    const void* found = std::memchr(name + at, q, length - at);
+    if (!found)
+      return false;
+    std::size_t i = static_cast<const char*>(found) - name;
+
+    if (i == at && at > 0) {
+      run++;
+      score += 4 * run;
+    }
+    else
+      run = 0;
+    if (starts_part(name, i))
+      score += 8;
+    score -= static_cast<int>(std::min<std::size_t>(i - at, 8));
+    at = i + 1;
+  }
+  // shorter names for the same match first
+  score = score * 64 + std::max(0, 63 - static_cast<int>(length / 2));
+  return true;
+}
+
+void HalSearch::_add(const char* name, Kind kind, int item)
+{
+  Entry entry{static_cast<std::uint32_t>(m_names.size()), 0, 0, kind, item};
+  for (const char* c = name; *c; c++) {
+    char l = lower(*c);
+    m_names.push_back(l);
+    entry.mask |= char_bit(l);
+  }
+  entry.length = static_cast<std::uint32_t>(m_names.size() - entry.name);
+  m_entries.push_back(entry);
+}
+
+void HalSearch::build(const HalSnapshot& snapshot)
+{
+  m_names.clear();
+  m_entries.clear();
+  for (std::size_t i = 0; i < snapshot.pins.size(); i++)
+    _add(snapshot.pins[i].name, Kind::PIN, static_cast<int>(i));
+  for (std::size_t i = 0; i < snapshot.params.size(); i++)
+    _add(snapshot.params[i].name, Kind::PARAM, static_cast<int>(i));
+  for (std::size_t i = 0; i < snapshot.signals.size(); i++)
+    _add(snapshot.signals[i].name, Kind::SIGNAL, static_cast<int>(i));
+
+  // the next search starts over
+  std::string query;
+  std::swap(query, m_query);
+  m_matches.clear();
+  m_results.clear();
+  search(query.c_str());
+}
+
+const std::vector<HalSearch::Result>& HalSearch::search(const char* query)
+{
+  std::string q;
+  for (const char* c = query; *c; c++) {
+    if (!std::isspace(static_cast<unsigned char>(*c)))
+      q.push_back(lower(*c));
+  }
+  if (q == m_query)
+    return m_results;
+
+  bool narrowing = !m_query.empty() && q.size() > m_query.size() &&
+                   q.compare(0, m_query.size(), m_query) == 0;
+  m_query = q;
+  m_results.clear();
+  if (q.empty()) {
+    m_matches.clear();
+    return m_results;
+  }
+
+  std::uint64_t mask = 0;
+  for (char c : q)
+    mask |= char_bit(c);
+
+  auto test = [&](int index, std::vector<int>& matches) {
+    const auto& entry = m_entries[index];
+    if ((entry.mask & mask) != mask)
+      return;
+    int score;
+    if (!match(m_names.data() + entry.name, entry.length, q, score))
+      return;
+    matches.push_back(index);
+    m_results.push_back({entry.kind, entry.item, score});
+  };
+
+  std::vector<int> matches;
+  if (narrowing) {
+    for (int index : m_matches)
+      test(index, matches);
+  }
+  else {
+    for (int index = 0; index < static_cast<int>(m_entries.size()); index++)
+      test(index, matches);
+  }
+  m_matches = std::move(matches);
+
+  std::stable_sort(m_results.begin(), m_results.end(),
+                   [](const Result& a, const Result& b) {
+                     return a.score > b.score;
+                   });
+  return m_results;
+}
+
+} // namespace ImCNC
@@ -0,0 +1,213 @@
+/*
+ * hal_snapshot.cpp
+ *
+ * private copy of the HAL lists
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_snapshot.hpp"
+
+// clang-format off
+#include "hal.h"
+#include "../src/hal/hal_priv.h"
+// clang-format on
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <utility>
+
+namespace ImCNC {
+
+static void copy_name(char* to, const char* from)
+{
+  std::memcpy(to, from, HAL_NAME_LEN + 1);
+  to[HAL_NAME_LEN] = '\0';
+}
+
+static std::uint64_t mix(std::uint64_t h, std::uint64_t v)
+{
+  return std::rotl(h ^ v, 27) * 0x9E3779B185EBCA87ull;
+}
+
+std::uint64_t HalSnapshot::locked_stamp()
+{
+  std::uint64_t h = 1;
+
+  for (auto next = hal_data->comp_list_ptr; next != 0;) {
+    h = mix(h, next);
+    next = static_cast<const hal_comp_t*>(SHMPTR(next))->next_ptr;
+  }
+  for (auto next = hal_data->pin_list_ptr; next != 0;) {
+    auto pin = static_cast<const hal_pin_t*>(SHMPTR(next));
+    h = mix(h, (std::uint64_t(pin->signal) << 32) | std::uint32_t(next));
+    next = pin->next_ptr;
+  }
+  for (auto next = hal_data->sig_list_ptr; next != 0;) {
+    h = mix(h, next);
+    next = static_cast<const hal_sig_t*>(SHMPTR(next))->next_ptr;
+  }
+  for (auto next = hal_data->param_list_ptr; next != 0;) {
+    h = mix(h, next);
+    next = static_cast<const hal_param_t*>(SHMPTR(next))->next_ptr;
+  }
+  for (auto next = hal_data->funct_list_ptr; next != 0;) {
+    auto funct = static_cast<const hal_funct_t*>(SHMPTR(next));
+    h = mix(h, (std::uint64_t(funct->users) << 32) | std::uint32_t(next));
+    next = funct->next_ptr;
+  }
+  for (auto next = hal_data->thread_list_ptr; next != 0;) {
+    h = mix(h, next);
+    next = static_cast<const hal_thread_t*>(SHMPTR(next))->next_ptr;
+  }
+  return h;
+}
+
+std::uint64_t HalSnapshot::current_stamp()
+{
+  if (!hal_data)
+    return 0;
+
+  rtapi_mutex_get(&(hal_data->mutex));
+  std::uint64_t h = locked_stamp();
+  rtapi_mutex_give(&(hal_data->mutex));
+  return h;
+}
+
+int HalSnapshot::take()
+{
+  if (!hal_data)
+    return -1;
+
+  comps.clear();
+  pins.clear();
+  signals.clear();
+  params.clear();
+  functs.clear();
+  threads.clear();
+  thread_functs.clear();
+
+  rtapi_mutex_get(&(hal_data->mutex));
+
+  stamp = locked_stamp();
+  for (auto next = hal_data->comp_list_ptr; next != 0;) {
+    auto comp = static_cast<const hal_comp_t*>(SHMPTR(next));
+    auto& c = comps.emplace_back();
+    copy_name(c.name, comp->name);
+    c.comp_id = comp->comp_id;
+    c.pid = comp->pid;
+    c.type = comp->type;
+    c.offset = next;
+    next = comp->next_ptr;
+  }
+
+  for (auto next = hal_data->pin_list_ptr; next != 0;) {
+    auto pin = static_cast<const hal_pin_t*>(SHMPTR(next));
+    auto& p = pins.emplace_back();
+    copy_name(p.name, pin->name);
+    p.type = pin->type;
+    p.dir = pin->dir;
+    p.owner = pin->owner_ptr; // an offset for now
+    if (pin->signal) {
+      auto sig = static_cast<const hal_sig_t*>(SHMPTR(pin->signal));
+      copy_name(p.signal, sig->name);
+      p.value = SHMPTR(sig->data_ptr);
+    }
+    else {
+      p.signal[0] = '\0';
+      p.value = &(pin->dummysig);
+    }
+    next = pin->next_ptr;
+  }
+
+  for (auto next = hal_data->sig_list_ptr; next != 0;) {
+    auto sig = static_cast<const hal_sig_t*>(SHMPTR(next));
+    auto& s = signals.emplace_back();
+    copy_name(s.name, sig->name);
+    s.type = sig->type;
+    s.readers = sig->readers;
+    s.writers = sig->writers;
+    s.bidirs = sig->bidirs;
+    s.value = SHMPTR(sig->data_ptr);
+    next = sig->next_ptr;
+  }
+
+  for (auto next = hal_data->param_list_ptr; next != 0;) {
+    auto param = static_cast<const hal_param_t*>(SHMPTR(next));
+    auto& p = params.emplace_back();
+    copy_name(p.name, param->name);
+    p.type = param->type;
+    p.dir = param->dir;
+    p.value = SHMPTR(param->data_ptr);
+    next = param->next_ptr;
+  }
+
+  for (auto next = hal_data->funct_list_ptr; next != 0;) {
+    auto funct = static_cast<const hal_funct_t*>(SHMPTR(next));
+    auto comp = static_cast<const hal_comp_t*>(SHMPTR(funct->owner_ptr));
+    auto& f = functs.emplace_back();
+    copy_name(f.name, funct->name);
+    copy_name(f.owner, comp->name);
+    f.uses_fp = funct->uses_fp;
+    f.reentrant = funct->reentrant;
+    f.maxtime = &(funct->maxtime);
+    f.offset = next;
+    f.thread = -1;
+    next = funct->next_ptr;
+  }
+
+  for (auto next = hal_data->thread_list_ptr; next != 0;) {
+    auto thread = static_cast<const hal_thread_t*>(SHMPTR(next));
+    auto& t = threads.emplace_back();
+    copy_name(t.name, thread->name);
+    t.period = thread->period;
+    t.priority = thread->priority;
+    t.task_id = thread->task_id;
+    t.first_funct = static_cast<int>(thread_functs.size());
+
+    // offsets for now, the list is circular through the thread
+    auto root = &(thread->funct_list);
+    auto entry = static_cast<const hal_list_t*>(SHMPTR(root->next));
+    while (entry != root) {
+      auto funct_entry = reinterpret_cast<const hal_funct_entry_t*>(entry);
+      thread_functs.push_back(funct_entry->funct_ptr);
+      entry = static_cast<const hal_list_t*>(SHMPTR(entry->next));
+    }
+    t.funct_count = static_cast<int>(thread_functs.size()) - t.first_funct;
+    next = thread->next_ptr;
+  }
+
+  rtapi_mutex_give(&(hal_data->mutex));
+
+  std::vector<std::pair<int, int>> comp_offsets;
+  for (int c = 0; c < static_cast<int>(comps.size()); c++)
+    comp_offsets.emplace_back(comps[c].offset, c);
+  std::sort(comp_offsets.begin(), comp_offsets.end());
+  for (auto& pin : pins) {
+    auto it = std::lower_bound(comp_offsets.begin(), comp_offsets.end(),
+                               std::make_pair(pin.owner, 0));
+    pin.owner = it != comp_offsets.end() && it->first == pin.owner
+                    ? it->second
+                    : -1;
+  }
+
+  for (int t = 0; t < static_cast<int>(threads.size()); t++) {
+    const auto& thread = threads[t];
+    for (int i = 0; i < thread.funct_count; i++) {
+      int& index = thread_functs[thread.first_funct + i];
+      int offset = index;
+      index = -1;
+      for (int f = 0; f < static_cast<int>(functs.size()); f++) {
+        if (functs[f].offset == offset) {
+          index = f;
+          if (functs[f].thread < 0)
+            functs[f].thread = t;
+          break;
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+} // namespace ImCNC
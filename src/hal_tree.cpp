@@ -0,0 +1,115 @@
+/*
+ * hal_tree.cpp
+ *
+ * HAL names as a tree for the browser
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_tree.hpp"
+
+#include "imgui.h"
+
+#include <cstring>
+
+namespace ImCNC {
+
+void HalTree::_begin()
+{
+  m_was_open.clear();
+  for (const auto& node : m_nodes) {
+    if (node.item < 0 && node.open)
+      m_was_open.insert(node.path);
+  }
+  m_nodes.clear();
+  m_branches.clear();
+}
+
+void HalTree::_add(const char* name, int item)
+{
+  // close the branches that aren't a prefix of the name
+  while (!m_branches.empty()) {
+    const auto& path = m_nodes[m_branches.back()].path;
+    if (std::strncmp(name, path.c_str(), path.size()) == 0 &&
+        name[path.size()] == '.')
+      break;
+    m_nodes[m_branches.back()].end = static_cast<int>(m_nodes.size());
+    m_branches.pop_back();
+  }
+
+  std::size_t at = 0;
+  if (!m_branches.empty())
+    at = m_nodes[m_branches.back()].path.size() + 1;
+
+  // open the rest, the last part is the leaf
+  for (const char* dot; (dot = std::strchr(name + at, '.'));) {
+    std::size_t length = dot - name;
+    Node branch{std::string(name, length), at,
+                static_cast<int>(m_branches.size()), 0, -1, false};
+    branch.open = m_was_open.count(branch.path) > 0;
+    m_branches.push_back(static_cast<int>(m_nodes.size()));
+    m_nodes.push_back(std::move(branch));
+    at = length + 1;
+  }
+
+  int index = static_cast<int>(m_nodes.size());
+  m_nodes.push_back({std::string(name), at,
+                     static_cast<int>(m_branches.size()), index + 1, item,
+                     false});
+}
+
+void HalTree::_end()
+{
+  for (int branch : m_branches)
+    m_nodes[branch].end = static_cast<int>(m_nodes.size());
+  m_branches.clear();
+  m_was_open.clear();
+  _update_rows();
+}
+
+void HalTree::_update_rows()
+{
+  m_rows.clear();
+  for (int i = 0; i < static_cast<int>(m_nodes.size());) {
+    const auto& node = m_nodes[i];
+    m_rows.push_back(i);
+    i = (node.item < 0 && !node.open) ? node.end : i + 1;
+  }
+}
+
+void HalTree::draw(const std::function<void(int, const char*)>& leaf)
+{
+  const float spacing = ImGui::GetTreeNodeToLabelSpacing();
+  bool toggled = false;
+
+  ImGuiListClipper clipper;
+  clipper.Begin(static_cast<int>(m_rows.size()));
+  while (clipper.Step()) {
+    for (int row = clipper.DisplayStart; row < clipper.DisplayEnd; row++) {
+      auto& node = m_nodes[m_rows[row]];
+      const char* label = node.path.c_str() + node.label;
+
+      // Indent(0) would indent by the default width
+      if (node.depth > 0)
+        ImGui::Indent(node.depth * spacing);
+      if (node.item < 0) {
+        ImGui::SetNextItemOpen(node.open);
+        bool open =
+            ImGui::TreeNodeEx(node.path.c_str(),
+                              ImGuiTreeNodeFlags_NoTreePushOnOpen, "%s", label);
+        if (open != node.open) {
+          node.open = open;
+          toggled = true;
+        }
+      }
+      else
+        leaf(node.item, label);
+      if (node.depth > 0)
+        ImGui::Unindent(node.depth * spacing);
+    }
+  }
+
+  if (toggled)
+    _update_rows();
+}
+
+} // namespace ImCNC
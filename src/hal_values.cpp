@@ -0,0 +1,371 @@
+/*
+ * hal_values.cpp
+ *
+ * every HAL value at one moment, saved and compared
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_values.hpp"
+
+// clang-format off
+#include "hal.h"
+#include "../src/hal/hal_priv.h"
+// clang-format on
+#include "hal_snapshot.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <stdio.h>
+
+namespace ImCNC {
+
+static constexpr char c_values_magic[8] = {'C', 'K', 'P', 'T',
+                                           'H', 'V', 'A', 'L'};
+static constexpr std::uint32_t c_values_version = 1;
+
+namespace {
+
+struct FileHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t entries;
+  std::uint32_t names;
+  std::uint32_t bits;
+  std::uint32_t s32s;
+  std::uint32_t u32s;
+  std::uint32_t floats;
+  std::uint32_t reserved;
+  std::int64_t time;
+};
+
+struct FileEntry
+{
+  std::uint32_t name;
+  std::uint8_t kind;
+  std::uint8_t type;
+  std::uint16_t reserved;
+  std::uint32_t index;
+};
+
+} // namespace
+
+static std::vector<int>* entries_of(HalValues::Layout& layout,
+                                    hal_type_t type)
+{
+  switch (type) {
+  case HAL_BIT:
+    return &layout.bit_entries;
+  case HAL_S32:
+    return &layout.s32_entries;
+  case HAL_U32:
+    return &layout.u32_entries;
+  case HAL_FLOAT:
+    return &layout.float_entries;
+  default:
+    return nullptr;
+  }
+}
+
+static bool name_less(const HalValues::Layout& a, int ea,
+                      const HalValues::Layout& b, int eb)
+{
+  if (a.entries[ea].kind != b.entries[eb].kind)
+    return a.entries[ea].kind < b.entries[eb].kind;
+  return std::strcmp(a.name(ea), b.name(eb)) < 0;
+}
+
+// the key and the name order, once the entries are there
+static void finish(HalValues::Layout& layout)
+{
+  std::uint64_t h = 0xCBF29CE484222325ull;
+  for (char c : layout.names)
+    h = (h ^ static_cast<unsigned char>(c)) * 0x100000001B3ull;
+  for (const auto& entry : layout.entries) {
+    h = (h ^ static_cast<std::uint64_t>(entry.kind)) * 0x100000001B3ull;
+    h = (h ^ static_cast<std::uint64_t>(entry.type)) * 0x100000001B3ull;
+  }
+  layout.key = h;
+
+  layout.by_name.resize(layout.entries.size());
+  for (std::size_t i = 0; i < layout.by_name.size(); i++)
+    layout.by_name[i] = static_cast<int>(i);
+  std::sort(layout.by_name.begin(), layout.by_name.end(),
+            [&](int a, int b) { return name_less(layout, a, layout, b); });
+}
+
+static std::shared_ptr<const HalValues::Layout> make_layout(
+    const HalSnapshot& snapshot)
+{
+  auto layout = std::make_shared<HalValues::Layout>();
+  layout->stamp = snapshot.stamp;
+
+  auto add = [&](const char* name, HalSearch::Kind kind, hal_type_t type,
+                 const volatile void* value) {
+    auto list = entries_of(*layout, type);
+    if (!list)
+      return;
+    layout->entries.push_back({static_cast<std::uint32_t>(layout->names.size()),
+                               kind, type,
+                               static_cast<std::uint32_t>(list->size())});
+    list->push_back(static_cast<int>(layout->entries.size()) - 1);
+    layout->names.append(name);
+    layout->names.push_back('\0');
+    layout->sources.push_back(value);
+  };
+  for (const auto& pin : snapshot.pins)
+    add(pin.name, HalSearch::Kind::PIN, pin.type, pin.value);
+  for (const auto& param : snapshot.params)
+    add(param.name, HalSearch::Kind::PARAM, param.type, param.value);
+  for (const auto& sig : snapshot.signals)
+    add(sig.name, HalSearch::Kind::SIGNAL, sig.type, sig.value);
+
+  finish(*layout);
+  return layout;
+}
+
+int HalValues::take(const HalSnapshot& snapshot)
+{
+  if (!hal_data)
+    return -1;
+
+  if (!layout || layout->stamp != snapshot.stamp)
+    layout = make_layout(snapshot);
+  bits.resize(layout->bit_entries.size());
+  s32s.resize(layout->s32_entries.size());
+  u32s.resize(layout->u32_entries.size());
+  floats.resize(layout->float_entries.size());
+
+  const auto& entries = layout->entries;
+  const auto& sources = layout->sources;
+  rtapi_mutex_get(&(hal_data->mutex));
+  // the pointers are only good for the structure they were taken from
+  if (HalSnapshot::locked_stamp() != layout->stamp) {
+    rtapi_mutex_give(&(hal_data->mutex));
+    return -1;
+  }
+  for (std::size_t i = 0; i < entries.size(); i++) {
+    const auto& entry = entries[i];
+    switch (entry.type) {
+    case HAL_BIT:
+      bits[entry.index] =
+          *static_cast<const volatile std::uint8_t*>(sources[i]);
+      break;
+    case HAL_S32:
+      s32s[entry.index] =
+          *static_cast<const volatile std::int32_t*>(sources[i]);
+      break;
+    case HAL_U32:
+      u32s[entry.index] =
+          *static_cast<const volatile std::uint32_t*>(sources[i]);
+      break;
+    default:
+      floats[entry.index] = *static_cast<const volatile double*>(sources[i]);
+      break;
+    }
+  }
+  rtapi_mutex_give(&(hal_data->mutex));
+
+  time = std::time(nullptr);
+  return 0;
+}
+
+double HalValues::value(int entry) const
+{
+  const auto& e = layout->entries[entry];
+  switch (e.type) {
+  case HAL_BIT:
+    return bits[e.index] ? 1 : 0;
+  case HAL_S32:
+    return s32s[e.index];
+  case HAL_U32:
+    return u32s[e.index];
+  default:
+    return floats[e.index];
+  }
+}
+
+template <typename T>
+static bool write_array(FILE* f, const std::vector<T>& v)
+{
+  return fwrite(v.data(), sizeof(T), v.size(), f) == v.size();
+}
+
+template <typename T>
+static bool read_array(FILE* f, std::vector<T>& v, std::uint32_t count)
+{
+  v.resize(count);
+  return fread(v.data(), sizeof(T), count, f) == count;
+}
+
+int HalValues::save(const char* path) const
+{
+  if (!layout)
+    return -1;
+
+  FILE* f = fopen(path, "wb");
+  if (!f) {
+    fprintf(stderr, "can't write %s\n", path);
+    return -1;
+  }
+
+  FileHeader header{};
+  std::memcpy(header.magic, c_values_magic, sizeof(c_values_magic));
+  header.version = c_values_version;
+  header.entries = static_cast<std::uint32_t>(layout->entries.size());
+  header.names = static_cast<std::uint32_t>(layout->names.size());
+  header.bits = static_cast<std::uint32_t>(bits.size());
+  header.s32s = static_cast<std::uint32_t>(s32s.size());
+  header.u32s = static_cast<std::uint32_t>(u32s.size());
+  header.floats = static_cast<std::uint32_t>(floats.size());
+  header.time = time;
+
+  std::vector<FileEntry> entries;
+  for (const auto& entry : layout->entries) {
+    entries.push_back({entry.name, static_cast<std::uint8_t>(entry.kind),
+                       static_cast<std::uint8_t>(entry.type), 0,
+                       entry.index});
+  }
+
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+            fwrite(layout->names.data(), 1, layout->names.size(), f) ==
+                layout->names.size() &&
+            write_array(f, entries) && write_array(f, bits) &&
+            write_array(f, s32s) && write_array(f, u32s) &&
+            write_array(f, floats);
+  ok = fclose(f) == 0 && ok;
+  if (!ok) {
+    fprintf(stderr, "can't write %s\n", path);
+    return -1;
+  }
+  return 0;
+}
+
+int HalValues::load(const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  if (!f) {
+    fprintf(stderr, "can't read %s\n", path);
+    return -1;
+  }
+
+  // read aside, the values stay as they were if the file is no good
+  auto loaded = std::make_shared<Layout>();
+  FileHeader header;
+  std::vector<FileEntry> entries;
+  std::vector<std::uint8_t> new_bits;
+  std::vector<std::int32_t> new_s32s;
+  std::vector<std::uint32_t> new_u32s;
+  std::vector<double> new_floats;
+  bool ok = fread(&header, sizeof(header), 1, f) == 1 &&
+            std::memcmp(header.magic, c_values_magic,
+                        sizeof(c_values_magic)) == 0 &&
+            header.version == c_values_version;
+  if (ok) {
+    loaded->names.resize(header.names);
+    ok = fread(loaded->names.data(), 1, header.names, f) == header.names &&
+         read_array(f, entries, header.entries) &&
+         read_array(f, new_bits, header.bits) &&
+         read_array(f, new_s32s, header.s32s) &&
+         read_array(f, new_u32s, header.u32s) &&
+         read_array(f, new_floats, header.floats);
+  }
+  fclose(f);
+  ok = ok && (loaded->names.empty() || loaded->names.back() == '\0');
+
+  for (std::size_t i = 0; ok && i < entries.size(); i++) {
+    const auto& e = entries[i];
+    Entry entry{e.name, static_cast<HalSearch::Kind>(e.kind),
+                static_cast<hal_type_t>(e.type), e.index};
+    auto list = entries_of(*loaded, entry.type);
+    std::size_t size = entry.type == HAL_BIT   ? new_bits.size()
+                       : entry.type == HAL_S32 ? new_s32s.size()
+                       : entry.type == HAL_U32 ? new_u32s.size()
+                                               : new_floats.size();
+    ok = list && e.kind <= static_cast<std::uint8_t>(HalSearch::Kind::SIGNAL) &&
+         e.name < loaded->names.size() && e.index == list->size() &&
+         e.index < size;
+    if (ok) {
+      list->push_back(static_cast<int>(i));
+      loaded->entries.push_back(entry);
+    }
+  }
+  ok = ok && loaded->bit_entries.size() == new_bits.size() &&
+       loaded->s32_entries.size() == new_s32s.size() &&
+       loaded->u32_entries.size() == new_u32s.size() &&
+       loaded->float_entries.size() == new_floats.size();
+  if (!ok) {
+    fprintf(stderr, "%s is not a HAL values file\n", path);
+    return -1;
+  }
+
+  finish(*loaded);
+  layout = std::move(loaded);
+  bits = std::move(new_bits);
+  s32s = std::move(new_s32s);
+  u32s = std::move(new_u32s);
+  floats = std::move(new_floats);
+  time = static_cast<std::time_t>(header.time);
+  return 0;
+}
+
+template <typename T>
+static void compare(const std::vector<T>& a, const std::vector<T>& b,
+                    const std::vector<int>& entries,
+                    std::vector<HalValueChange>& changes)
+{
+  if (a.empty() || std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0)
+    return;
+  for (std::size_t i = 0; i < a.size(); i++) {
+    if (std::memcmp(&a[i], &b[i], sizeof(T)) != 0)
+      changes.push_back({entries[i], entries[i]});
+  }
+}
+
+std::vector<HalValueChange> diff(const HalValues& a, const HalValues& b)
+{
+  std::vector<HalValueChange> changes;
+  const auto& la = *a.layout;
+  const auto& lb = *b.layout;
+
+  // the same entries in the same order, the arrays are compared as they
+  // are
+  if (la.key == lb.key && la.entries.size() == lb.entries.size()) {
+    compare(a.bits, b.bits, la.bit_entries, changes);
+    compare(a.s32s, b.s32s, la.s32_entries, changes);
+    compare(a.u32s, b.u32s, la.u32_entries, changes);
+    compare(a.floats, b.floats, la.float_entries, changes);
+    std::sort(changes.begin(), changes.end(),
+              [&](const HalValueChange& x, const HalValueChange& y) {
+                return name_less(la, x.a, la, y.a);
+              });
+    return changes;
+  }
+
+  std::size_t i = 0;
+  std::size_t j = 0;
+  while (i < la.by_name.size() || j < lb.by_name.size()) {
+    int ea = i < la.by_name.size() ? la.by_name[i] : -1;
+    int eb = j < lb.by_name.size() ? lb.by_name[j] : -1;
+    if (eb < 0 || (ea >= 0 && name_less(la, ea, lb, eb))) {
+      changes.push_back({ea, -1});
+      i++;
+    }
+    else if (ea < 0 || name_less(lb, eb, la, ea)) {
+      changes.push_back({-1, eb});
+      j++;
+    }
+    else {
+      if (la.entries[ea].type != lb.entries[eb].type ||
+          std::bit_cast<std::uint64_t>(a.value(ea)) !=
+              std::bit_cast<std::uint64_t>(b.value(eb)))
+        changes.push_back({ea, eb});
+      i++;
+      j++;
+    }
+  }
+  return changes;
+}
+
+} // namespace ImCNC
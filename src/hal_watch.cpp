@@ -0,0 +1,214 @@
+/*
+ * hal_watch.cpp
+ *
+ * HAL values watched for changes and triggers
+ * (c) 2022-2023 Robert Schöftner rs@unfoo.net
+ */
+
+#include "hal_watch.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace ImCNC {
+
+static constexpr std::chrono::milliseconds c_scan{10};
+// samples this close to being overwritten aren't looked at
+static constexpr std::uint64_t c_margin = HalSampler::c_capacity / 8;
+
+HalWatch::~HalWatch()
+{
+  stop();
+}
+
+int HalWatch::start(std::vector<HalSampler::Channel> channels, double rate)
+{
+  stop();
+
+  std::vector<Entry> entries;
+  for (const auto& channel : channels) {
+    auto& entry = entries.emplace_back();
+    entry.name = channel.name;
+    for (const auto& old : m_entries) {
+      if (old.name == entry.name) {
+        entry.trigger = old.trigger;
+        entry.threshold = old.threshold;
+      }
+    }
+  }
+  {
+    std::lock_guard lock(m_mutex);
+    m_entries = std::move(entries);
+  }
+
+  if (m_sampler.start(std::move(channels), rate) != 0)
+    return -1;
+  m_stop = false;
+  m_thread = std::thread(&HalWatch::_scan, this);
+  return 0;
+}
+
+void HalWatch::stop()
+{
+  if (m_thread.joinable()) {
+    m_stop = true;
+    m_thread.join();
+  }
+  m_sampler.stop();
+}
+
+void HalWatch::set_trigger(int entry, Trigger trigger, double threshold)
+{
+  std::lock_guard lock(m_mutex);
+  m_entries[entry].trigger = trigger;
+  m_entries[entry].threshold = threshold;
+}
+
+HalWatch::Trigger HalWatch::trigger(int entry) const
+{
+  std::lock_guard lock(m_mutex);
+  return m_entries[entry].trigger;
+}
+
+double HalWatch::threshold(int entry) const
+{
+  std::lock_guard lock(m_mutex);
+  return m_entries[entry].threshold;
+}
+
+void HalWatch::set_window(double pre, double post)
+{
+  std::lock_guard lock(m_mutex);
+  m_pre = pre;
+  m_post = post;
+}
+
+std::vector<HalWatch::Status> HalWatch::status() const
+{
+  std::lock_guard lock(m_mutex);
+  std::vector<Status> status;
+  for (const auto& entry : m_entries)
+    status.push_back(entry.status);
+  return status;
+}
+
+std::vector<HalWatch::Capture> HalWatch::captures() const
+{
+  std::lock_guard lock(m_mutex);
+  return m_captures;
+}
+
+std::uint64_t HalWatch::taken() const
+{
+  std::lock_guard lock(m_mutex);
+  return m_taken;
+}
+
+void HalWatch::clear_captures()
+{
+  std::lock_guard lock(m_mutex);
+  m_captures.clear();
+  // never back to a count the UI has seen
+  m_taken++;
+}
+
+void HalWatch::_scan()
+{
+  const int channels = static_cast<int>(m_sampler.channels().size());
+  std::vector<double> last(channels);
+  std::uint64_t next = 0;
+  // a fired trigger waits here for its post-trigger samples
+  std::uint64_t pending = 0;
+  int pending_entry = -1;
+
+  while (!m_stop.load(std::memory_order_relaxed)) {
+    std::uint64_t count = m_sampler.count();
+    if (count > next + HalSampler::c_capacity - c_margin)
+      next = count - (HalSampler::c_capacity - c_margin);
+
+    {
+      std::lock_guard lock(m_mutex);
+      const auto post = static_cast<std::uint64_t>(m_post * m_sampler.rate());
+
+      for (; next < count; next++) {
+        for (int c = 0; c < channels; c++) {
+          auto& entry = m_entries[c];
+          double v = m_sampler.value(c, next);
+          double before = last[c];
+          last[c] = v;
+          if (!entry.started) {
+            entry.started = true;
+            entry.status.value = v;
+            continue;
+          }
+          if (v == before)
+            continue;
+
+          entry.status.value = v;
+          entry.status.changes++;
+          bool fired = false;
+          switch (entry.trigger) {
+          case Trigger::RISING:
+            fired = before < entry.threshold && v >= entry.threshold;
+            break;
+          case Trigger::FALLING:
+            fired = before >= entry.threshold && v < entry.threshold;
+            break;
+          case Trigger::CHANGE:
+            fired = true;
+            break;
+          case Trigger::NONE:
+            break;
+          }
+          if (fired && pending_entry < 0) {
+            pending = next;
+            pending_entry = c;
+          }
+        }
+      }
+
+      if (pending_entry >= 0 && count > pending + post) {
+        _capture(pending, pending_entry);
+        pending_entry = -1;
+      }
+    }
+    std::this_thread::sleep_for(c_scan);
+  }
+}
+
+// called with the mutex held
+void HalWatch::_capture(std::uint64_t sample, int entry)
+{
+  const auto& channels = m_sampler.channels();
+  const double rate = m_sampler.rate();
+  auto pre = static_cast<std::uint64_t>(m_pre * rate);
+  auto post = static_cast<std::uint64_t>(m_post * rate);
+  std::uint64_t count = m_sampler.count();
+  std::uint64_t oldest = count > HalSampler::c_capacity - c_margin
+                             ? count - (HalSampler::c_capacity - c_margin)
+                             : 0;
+  std::uint64_t first = std::max(oldest, sample > pre ? sample - pre : 0);
+  std::uint64_t last = std::min(count, sample + post + 1);
+
+  Capture capture;
+  capture.entry = entry;
+  capture.time = m_sampler.time(sample);
+  capture.trigger = static_cast<std::size_t>(sample - first);
+  capture.values.resize(channels.size());
+  for (const auto& channel : channels)
+    capture.names.push_back(channel.name);
+  for (std::uint64_t i = first; i < last; i++) {
+    capture.times.push_back(m_sampler.time(i) - capture.time);
+    for (std::size_t c = 0; c < channels.size(); c++)
+      capture.values[c].push_back(m_sampler.value(static_cast<int>(c), i));
+  }
+  if (!m_sampler.kept(first))
+    return;
+
+  if (static_cast<int>(m_captures.size()) == c_max_captures)
+    m_captures.erase(m_captures.begin());
+  m_captures.push_back(std::move(capture));
+  m_taken++;
+}
+
+} // namespace ImCNC
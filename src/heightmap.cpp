@@ -0,0 +1,243 @@
+/*
+ * heightmap.cpp
+ *
+ * Z heightmap stock removal simulation
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "heightmap.hpp"
+
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace ImCNC {
+
+// keeps a typo in the cell size from eating all memory
+static constexpr std::size_t c_max_nodes = std::size_t{1} << 24;
+
+int Heightmap::reset(const std::array<double, 6>& stock, double cell)
+{
+  double width = stock[1] - stock[0];
+  double depth = stock[3] - stock[2];
+  if (!(cell > 0) || !(width > 0) || !(depth > 0) || !(stock[5] > stock[4]))
+    return -1;
+
+  auto nx = static_cast<std::size_t>(std::ceil(width / cell)) + 1;
+  auto ny = static_cast<std::size_t>(std::ceil(depth / cell)) + 1;
+  if (nx * ny > c_max_nodes)
+    return -1;
+
+  m_stock = stock;
+  m_cell = cell;
+  m_nx = static_cast<int>(nx);
+  m_ny = static_cast<int>(ny);
+  m_tx = (m_nx + c_tile_size - 1) / c_tile_size;
+  m_ty = (m_ny + c_tile_size - 1) / c_tile_size;
+  m_heights.assign(nx * ny, static_cast<float>(stock[5]));
+  m_dirty.assign(static_cast<std::size_t>(m_tx) * m_ty, 1);
+  return 0;
+}
+
+bool Heightmap::dirty(int tx, int ty) const
+{
+  if (tx < 0 || tx >= m_tx || ty < 0 || ty >= m_ty)
+    return false;
+  return m_dirty[ty * m_tx + tx] != 0;
+}
+
+void Heightmap::clear_dirty()
+{
+  std::fill(m_dirty.begin(), m_dirty.end(), 0);
+}
+
+Heightmap::Rect Heightmap::_reach(const std::array<double, 3>& from,
+                                  const std::array<double, 3>& to,
+                                  double radius) const
+{
+  auto lo = [this](double v, double origin) {
+    return static_cast<int>(std::ceil((v - origin) / m_cell));
+  };
+  auto hi = [this](double v, double origin) {
+    return static_cast<int>(std::floor((v - origin) / m_cell)) + 1;
+  };
+
+  Rect rect{lo(std::min(from[0], to[0]) - radius, m_stock[0]),
+            hi(std::max(from[0], to[0]) + radius, m_stock[0]),
+            lo(std::min(from[1], to[1]) - radius, m_stock[2]),
+            hi(std::max(from[1], to[1]) + radius, m_stock[2])};
+  rect.i0 = std::clamp(rect.i0, 0, m_nx);
+  rect.i1 = std::clamp(rect.i1, rect.i0, m_nx);
+  rect.j0 = std::clamp(rect.j0, 0, m_ny);
+  rect.j1 = std::clamp(rect.j1, rect.j0, m_ny);
+  return rect;
+}
+
+Heightmap::Rect Heightmap::_tile_rect(int tx, int ty) const
+{
+  return {tx * c_tile_size, std::min((tx + 1) * c_tile_size, m_nx),
+          ty * c_tile_size, std::min((ty + 1) * c_tile_size, m_ny)};
+}
+
+// a node is under the tool for the part of the move where the tool axis is
+// within radius of it. z changes linearly along the move, so the lowest
+// tool tip over that part is at one of its ends.
+bool Heightmap::_sweep(const std::array<double, 3>& from,
+                       const std::array<double, 3>& to, double radius,
+                       Rect rect)
+{
+  if (std::min(from[2], to[2]) >= m_stock[5])
+    return false;
+
+  double dx = to[0] - from[0];
+  double dy = to[1] - from[1];
+  double dz = to[2] - from[2];
+  double a = dx * dx + dy * dy;
+  double r2 = radius * radius;
+  float floor = static_cast<float>(m_stock[4]);
+  bool changed = false;
+
+  for (int j = rect.j0; j < rect.j1; j++) {
+    double py = from[1] - node_y(j);
+    float* row = &m_heights[static_cast<std::size_t>(j) * m_nx];
+
+    for (int i = rect.i0; i < rect.i1; i++) {
+      double px = from[0] - node_x(i);
+      double c = px * px + py * py - r2;
+      double z;
+
+      if (a < 1e-12) {
+        if (c > 0)
+          continue;
+        z = std::min(from[2], to[2]);
+      }
+      else {
+        // |from + t * d - node|^2 = r^2
+        double b = dx * px + dy * py;
+        double disc = b * b - a * c;
+        if (disc < 0)
+          continue;
+        double root = std::sqrt(disc);
+        double t0 = std::max((-b - root) / a, 0.0);
+        double t1 = std::min((-b + root) / a, 1.0);
+        if (t0 > t1)
+          continue;
+        z = from[2] + dz * (dz < 0 ? t1 : t0);
+      }
+
+      float h = std::max(static_cast<float>(z), floor);
+      if (h < row[i]) {
+        row[i] = h;
+        changed = true;
+      }
+    }
+  }
+  return changed;
+}
+
+void Heightmap::_mark(const Rect& rect)
+{
+  if (rect.i0 >= rect.i1 || rect.j0 >= rect.j1)
+    return;
+
+  for (int ty = rect.j0 / c_tile_size; ty <= (rect.j1 - 1) / c_tile_size;
+       ty++)
+  {
+    for (int tx = rect.i0 / c_tile_size; tx <= (rect.i1 - 1) / c_tile_size;
+         tx++)
+      m_dirty[ty * m_tx + tx] = 1;
+  }
+}
+
+void Heightmap::cut(const std::array<double, 3>& from,
+                    const std::array<double, 3>& to, double radius)
+{
+  if (m_heights.empty())
+    return;
+
+  auto rect = _reach(from, to, radius);
+  if (_sweep(from, to, radius, rect))
+    _mark(rect);
+}
+
+void Heightmap::cut(const Toolpath& toolpath, double radius,
+                    unsigned threads)
+{
+  if (m_heights.empty() || toolpath.vertex_count() < 3)
+    return;
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  // the result doesn't depend on the order of the moves, so they are
+  // sorted into the tiles they reach (as a CSR table) and every tile is
+  // cut on its own. the first move comes from wherever the parser started
+  // and is left out.
+  const std::size_t first = 2;
+  const std::size_t end = toolpath.vertex_count();
+  std::vector<std::uint32_t> start(static_cast<std::size_t>(m_tx) * m_ty + 1,
+                                   0);
+  std::vector<Rect> reach(end - first);
+
+  for (auto v = first; v < end; v++) {
+    auto& rect = reach[v - first];
+    rect = _reach(toolpath.point(v - 1), toolpath.point(v), radius);
+    if (rect.i0 >= rect.i1 || rect.j0 >= rect.j1)
+      continue;
+    for (int ty = rect.j0 / c_tile_size; ty <= (rect.j1 - 1) / c_tile_size;
+         ty++)
+    {
+      for (int tx = rect.i0 / c_tile_size;
+           tx <= (rect.i1 - 1) / c_tile_size; tx++)
+        start[ty * m_tx + tx + 1]++;
+    }
+  }
+  for (std::size_t t = 1; t < start.size(); t++)
+    start[t] += start[t - 1];
+
+  std::vector<std::uint32_t> moves(start.back());
+  std::vector<std::uint32_t> fill(start.begin(), start.end() - 1);
+  for (auto v = first; v < end; v++) {
+    const auto& rect = reach[v - first];
+    if (rect.i0 >= rect.i1 || rect.j0 >= rect.j1)
+      continue;
+    for (int ty = rect.j0 / c_tile_size; ty <= (rect.j1 - 1) / c_tile_size;
+         ty++)
+    {
+      for (int tx = rect.i0 / c_tile_size;
+           tx <= (rect.i1 - 1) / c_tile_size; tx++)
+        moves[fill[ty * m_tx + tx]++] = static_cast<std::uint32_t>(v);
+    }
+  }
+
+  // tiles own their nodes, so workers never write the same memory
+  std::atomic<int> next = 0;
+  auto worker = [&] {
+    for (int t = next++; t < m_tx * m_ty; t = next++) {
+      auto tile = _tile_rect(t % m_tx, t / m_tx);
+      bool changed = false;
+      for (auto k = start[t]; k < start[t + 1]; k++) {
+        auto v = moves[k];
+        const auto& rect = reach[v - first];
+        Rect clip{std::max(rect.i0, tile.i0), std::min(rect.i1, tile.i1),
+                  std::max(rect.j0, tile.j0), std::min(rect.j1, tile.j1)};
+        changed |= _sweep(toolpath.point(v - 1), toolpath.point(v), radius,
+                          clip);
+      }
+      if (changed)
+        m_dirty[t] = 1;
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; i++)
+    workers.emplace_back(worker);
+  worker();
+  for (auto& w : workers)
+    w.join();
+}
+
+} // namespace ImCNC
@@ -14,6 +14,7 @@
 #include <string>
 
 #include "imgui.h"
+#include "imgui_internal.h"
 #include "TextEditor.h"
 // clang-format on
 
@@ -24,6 +25,7 @@
 #include "emc.hh"     // EMC NML
 #include "emccfg.h"   // DEFAULT_TRAJ_MAX_VELOCITY
 #include "emcglb.h"   // EMC_NMLFILE, TRAJ_MAX_VELOCITY, etc.
+#include "hal_dro.hpp"
 #include "inifile.hh" // INIFILE
 #include "posemath.h" // PM_POSE, TO_RAD
 #include "shcom.hh"
@@ -38,6 +40,9 @@ static void sigQuit(int sig)
 }
 
 ShCom emc;
+// the status window's DRO at servo rate, when picked
+static HalDro hal_dro;
+static bool dro_from_hal = false;
 
 int init(int argc, char* argv[])
 {
@@ -60,6 +65,7 @@ int init(int argc, char* argv[])
   emc.update_status();
   // emcCommandSerialNumber = emc.status().echo_serial_number;
   emc.ini_load(emc.status().task.ini_filename);
+  hal_dro.set_kinematics(emc.kinematics());
 
   // attach our quit function to SIGINT
   signal(SIGTERM, sigQuit);
@@ -835,6 +841,31 @@ void RightJustifiedText(const char* text)
 constexpr const auto g5x_names = std::to_array(
     {"G54", "G55", "G56", "G57", "G58", "G59", "G59.1", "G59.2", "G59.3"});
 
+// XYZABCUVW
+static double pose_axis(const EmcPose& pose, int axis)
+{
+  switch (axis) {
+  case 0:
+    return pose.tran.x;
+  case 1:
+    return pose.tran.y;
+  case 2:
+    return pose.tran.z;
+  case 3:
+    return pose.a;
+  case 4:
+    return pose.b;
+  case 5:
+    return pose.c;
+  case 6:
+    return pose.u;
+  case 7:
+    return pose.v;
+  default:
+    return pose.w;
+  }
+}
+
 void ShowStatusWindow()
 {
   emc.update_status();
@@ -873,39 +904,53 @@ void ShowStatusWindow()
       const auto& g5x_offset = emc.status().task.g5x_offset;
       const auto& g92_offset = emc.status().task.g92_offset;
       const auto& tool_offset = emc.status().task.toolOffset;
+      // the actual XYZ run ahead of the last status update like the
+      // preview's tool, the commanded position is shown as it came
+      const auto shown = emc.estimated_position();
+      double cmd[HalDro::c_axes];
+      double act[HalDro::c_axes];
+      for (int i = 0; i < HalDro::c_axes; i++) {
+        cmd[i] = pose_axis(traj.position, i);
+        act[i] = i < 3 ? shown[i] : pose_axis(traj.actualPosition, i);
+      }
+      // or straight from motion's pins, an axis without a joint of its own
+      // keeps the following error of the last status
+      if (dro_from_hal && hal_dro.update() == 0) {
+        for (int i = 0; i < HalDro::c_axes; i++) {
+          double c, a;
+          if (!hal_dro.commanded(i, c))
+            continue;
+          if (!hal_dro.actual(i, a))
+            a = c + pose_axis(traj.actualPosition, i) -
+                pose_axis(traj.position, i);
+          cmd[i] = c;
+          act[i] = a;
+        }
+      }
       struct
       {
         const bool active;
         const char* label;
         const double cmd, act, dtg, g5x_ofs, g92_ofs, tool_ofs;
       } axis_values[] = {
-          {(traj.axis_mask & 1) != 0, "X", traj.position.tran.x,
-           traj.actualPosition.tran.x, traj.dtg.tran.x, g5x_offset.tran.x,
-           g92_offset.tran.x, tool_offset.tran.x},
-          {(traj.axis_mask & 2) != 0, "Y", traj.position.tran.y,
-           traj.actualPosition.tran.y, traj.dtg.tran.y, g5x_offset.tran.y,
-           g92_offset.tran.y, tool_offset.tran.y},
-          {(traj.axis_mask & 4) != 0, "Z", traj.position.tran.z,
-           traj.actualPosition.tran.z, traj.dtg.tran.z, g5x_offset.tran.z,
-           g92_offset.tran.z, tool_offset.tran.z},
-          {(traj.axis_mask & 8) != 0, "A", traj.position.a,
-           traj.actualPosition.a, traj.dtg.a, g5x_offset.a, g92_offset.a,
-           tool_offset.a},
-          {(traj.axis_mask & 16) != 0, "B", traj.position.b,
-           traj.actualPosition.b, traj.dtg.b, g5x_offset.b, g92_offset.b,
-           tool_offset.b},
-          {(traj.axis_mask & 32) != 0, "C", traj.position.c,
-           traj.actualPosition.c, traj.dtg.c, g5x_offset.c, g92_offset.c,
-           tool_offset.c},
-          {(traj.axis_mask & 64) != 0, "U", traj.position.u,
-           traj.actualPosition.u, traj.dtg.u, g5x_offset.u, g92_offset.u,
-           tool_offset.u},
-          {(traj.axis_mask & 128) != 0, "V", traj.position.v,
-           traj.actualPosition.v, traj.dtg.v, g5x_offset.v, g92_offset.v,
-           tool_offset.v},
-          {(traj.axis_mask & 256) != 0, "W", traj.position.w,
-           traj.actualPosition.w, traj.dtg.w, g5x_offset.w, g92_offset.w,
-           tool_offset.w}};
+          {(traj.axis_mask & 1) != 0, "X", cmd[0], act[0], traj.dtg.tran.x,
+           g5x_offset.tran.x, g92_offset.tran.x, tool_offset.tran.x},
+          {(traj.axis_mask & 2) != 0, "Y", cmd[1], act[1], traj.dtg.tran.y,
+           g5x_offset.tran.y, g92_offset.tran.y, tool_offset.tran.y},
+          {(traj.axis_mask & 4) != 0, "Z", cmd[2], act[2], traj.dtg.tran.z,
+           g5x_offset.tran.z, g92_offset.tran.z, tool_offset.tran.z},
+          {(traj.axis_mask & 8) != 0, "A", cmd[3], act[3], traj.dtg.a,
+           g5x_offset.a, g92_offset.a, tool_offset.a},
+          {(traj.axis_mask & 16) != 0, "B", cmd[4], act[4], traj.dtg.b,
+           g5x_offset.b, g92_offset.b, tool_offset.b},
+          {(traj.axis_mask & 32) != 0, "C", cmd[5], act[5], traj.dtg.c,
+           g5x_offset.c, g92_offset.c, tool_offset.c},
+          {(traj.axis_mask & 64) != 0, "U", cmd[6], act[6], traj.dtg.u,
+           g5x_offset.u, g92_offset.u, tool_offset.u},
+          {(traj.axis_mask & 128) != 0, "V", cmd[7], act[7], traj.dtg.v,
+           g5x_offset.v, g92_offset.v, tool_offset.v},
+          {(traj.axis_mask & 256) != 0, "W", cmd[8], act[8], traj.dtg.w,
+           g5x_offset.w, g92_offset.w, tool_offset.w}};
 
       const double t = -emc.status().task.rotation_xy * RAD_PER_DEG;
       const double rot_sin = sin(t);
@@ -964,6 +1009,10 @@ void ShowStatusWindow()
       ImGui::PopFont();
       ImGui::EndTable();
     }
+    if (ImGui::BeginPopupContextWindow()) {
+      ImGui::MenuItem("Position from HAL", nullptr, &dro_from_hal);
+      ImGui::EndPopup();
+    }
     ImGui::EndChild();
     ImGui::SameLine();
 
@@ -1026,7 +1075,24 @@ void ShowStatusWindow()
   ImGui::End();
 }
 
-void ShowGCodeWindow()
+// line of the editor under the mouse, 0 if none. TextEditor has no API for
+// that, so this looks at its child window, which must be the last thing
+// rendered into the current window.
+static int hovered_editor_line(const TextEditor& editor)
+{
+  ImGuiWindow* window = ImGui::GetCurrentContext()->HoveredWindow;
+
+  if (window == nullptr || window->ParentWindow != ImGui::GetCurrentWindow())
+    return 0;
+
+  float y = ImGui::GetIO().MousePos.y - window->Pos.y + window->Scroll.y;
+  int line = static_cast<int>(y / ImGui::GetTextLineHeightWithSpacing()) + 1;
+  return (line <= editor.GetTotalLines()) ? line : 0;
+}
+
+// goto_line scrolls the editor to that line (if > 0), hovered_line returns
+// the line under the mouse
+void ShowGCodeWindow(int goto_line, int& hovered_line)
 {
   static TextEditor editor;
   static std::string gcode_file_name;
@@ -1058,6 +1124,8 @@ void ShowGCodeWindow()
       // why it needs -1 here and not in "breakpoints"?
       editor.SetCursorPosition({current_line - 1, 0});
     }
+    if (goto_line > 0)
+      editor.SetCursorPosition({goto_line - 1, 0});
 
     ImGui::Text(
         "%6d/%-6d %6d lines  | %s | %s | %s | %s", cpos.mLine + 1,
@@ -1066,6 +1134,7 @@ void ShowGCodeWindow()
         editor.GetLanguageDefinition().mName.c_str(), gcode_file_name.c_str());
 
     editor.Render("GCode");
+    hovered_line = hovered_editor_line(editor);
   }
   ImGui::End();
 }
@@ -9,7 +9,16 @@
 #include "../src/hal/hal_priv.h"
 // clang-format on
 
+#include "hal_graph.hpp"
+#include "hal_latency.hpp"
+#include "hal_sampler.hpp"
+#include "hal_search.hpp"
+#include "hal_snapshot.hpp"
+#include "hal_tree.hpp"
+#include "hal_values.hpp"
+#include "hal_watch.hpp"
 #include "imgui.h"
+#include "imgui_node_editor.h"
 
 #include <signal.h>
 #include <stdio.h>
@@ -17,17 +26,24 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <array>
+#include <cmath>
+#include <cstring>
+#include <ctime>
 #include <string>
 #include <vector>
 
+namespace ed = ax::NodeEditor;
+
 namespace ImCNC {
 
 static int comp_id = 0;
+// seconds between checks for a changed HAL structure
+static constexpr double c_refresh = 1.0;
 
 void exit_from_hal()
 {
-  rtapi_mutex_give(&(hal_data->mutex));
   hal_exit(comp_id);
 }
 
@@ -41,284 +57,980 @@ void initHAL()
   atexit(exit_from_hal);
 }
 
-static unsigned calc_level(const char* pin_name, const char*& name)
+// one line per pin or parameter, the value read without the lock
+static void show_value(const char* name, const char* signame, hal_type_t type,
+                       const volatile void* value_ptr)
+{
+  switch (type) {
+  case HAL_BIT:
+    ImGui::Text("%s[bit] %s: %s", name, signame,
+                (*static_cast<const volatile char*>(value_ptr)) ? "☒" : "☐");
+    break;
+  case HAL_S32:
+    ImGui::Text("%s[s32] %s: %d", name, signame,
+                *static_cast<const volatile int*>(value_ptr));
+    break;
+  case HAL_U32:
+    ImGui::Text("%s[u32] %s: %u", name, signame,
+                *static_cast<const volatile unsigned*>(value_ptr));
+    break;
+  case HAL_FLOAT:
+    ImGui::Text("%s[f64] %s: %f", name, signame,
+                *static_cast<const volatile double*>(value_ptr));
+    break;
+  default:
+    ImGui::Text("%s", name);
+    break;
+  }
+}
+
+static HalSnapshot snapshot;
+static HalTree pin_tree;
+static HalTree param_tree;
+static HalSearch search;
+static HalLatency latency;
+static char search_text[128] = "";
+
+// a pin, parameter or signal picked in the browser, looked up again by
+// name whenever the snapshot changes
+struct Source
+{
+  std::string name;
+  HalSearch::Kind kind;
+};
+
+// the scope
+static HalSampler sampler;
+static std::vector<Source> scope_sources;
+static float scope_rate = 1000;
+static float scope_window = 2;
+static char capture_path[256] = "capture.csv";
+// sampled along in every scope, to match samples to the program
+static constexpr const char* c_program_line = "motion.program-line";
+
+// the watch list
+static HalWatch watch;
+static std::vector<Source> watch_sources;
+static float watch_rate = 1000;
+static float watch_pre = 0.1f;
+static float watch_post = 0.1f;
+static int watch_shown = -1;
+
+// value snapshots to compare
+struct SavedValues
+{
+  std::string label;
+  HalValues values;
+};
+static std::vector<SavedValues> saved_values;
+static int values_a = -1;
+static int values_b = -1;
+static std::vector<HalValueChange> value_changes;
+static std::array<int, 2> diffed = {-1, -1};
+static char values_path[256] = "hal.values";
+
+// the netlist graph
+static HalGraph graph;
+static HalGraphLayouts graph_layouts;
+static std::vector<std::array<float, 2>> graph_sizes;
+static std::vector<char> graph_shown; // per node, this frame
+static std::uint64_t graph_placed = 0; // key of the layout the nodes are at
+static ed::EditorContext* graph_editor = nullptr;
+static bool graph_open = false;
+// node, pin and link ids are the indices plus these
+static constexpr std::uintptr_t c_pin_ids = 1 << 24;
+static constexpr std::uintptr_t c_link_ids = 1 << 25;
+
+// the sources' value pointers in the current snapshot
+static std::vector<HalSampler::Channel> resolve(
+    const std::vector<Source>& sources)
 {
-  unsigned level = 0;
+  std::vector<HalSampler::Channel> channels;
 
-  while (*pin_name) {
-    if (*pin_name == '.') {
-      name = pin_name + 1;
-      level++;
+  for (const auto& source : sources) {
+    if (source.kind == HalSearch::Kind::SIGNAL) {
+      for (const auto& sig : snapshot.signals) {
+        if (source.name == sig.name)
+          channels.push_back({source.name, sig.type, sig.value});
+      }
+    }
+    else if (source.kind == HalSearch::Kind::PARAM) {
+      for (const auto& param : snapshot.params) {
+        if (source.name == param.name)
+          channels.push_back({source.name, param.type, param.value});
+      }
+    }
+    else {
+      for (const auto& pin : snapshot.pins) {
+        if (source.name == pin.name)
+          channels.push_back({source.name, pin.type, pin.value});
+      }
     }
-    pin_name++;
   }
-  return level;
+  return channels;
 }
 
-static unsigned calc_level_diff(const char* a, const char* b)
+static bool add_source(std::vector<Source>& sources, const char* name,
+                       HalSearch::Kind kind)
 {
-  unsigned level = 0;
+  for (const auto& source : sources) {
+    if (source.name == name && source.kind == kind)
+      return false;
+  }
+  sources.push_back({name, kind});
+  return true;
+}
 
-  while (*a && *b && *a == *b) {
-    if (*a == '.')
-      level++;
-    a++;
-    b++;
+static void restart_scope()
+{
+  if (scope_sources.empty()) {
+    sampler.stop();
+    return;
   }
-  return level;
+  sampler.start(resolve(scope_sources), scope_rate);
 }
 
-static std::string get_name_level(const char* name, unsigned level)
+static void restart_watch()
 {
-  const char* begin = name;
-  const char* end = name;
+  if (watch_sources.empty()) {
+    watch.stop();
+    return;
+  }
+  watch.set_window(watch_pre, watch_post);
+  watch.start(resolve(watch_sources), watch_rate);
+}
 
-  while (*end && *end != '.')
-    end++;
+static void add_to_scope(const char* name, HalSearch::Kind kind)
+{
+  if (scope_sources.empty()) {
+    for (const auto& pin : snapshot.pins) {
+      if (std::strcmp(pin.name, c_program_line) == 0)
+        add_source(scope_sources, c_program_line, HalSearch::Kind::PIN);
+    }
+  }
+  if (add_source(scope_sources, name, kind))
+    restart_scope();
+}
 
-  for (unsigned i = level; i > 0 && *end; i--) {
-    begin = end + 1;
-    end = begin;
-    while (*end && *end != '.')
-      end++;
+static void source_menu(const char* name, HalSearch::Kind kind)
+{
+  if (ImGui::BeginPopupContextItem(name)) {
+    if (ImGui::MenuItem("Plot"))
+      add_to_scope(name, kind);
+    if (ImGui::MenuItem("Watch") && add_source(watch_sources, name, kind))
+      restart_watch();
+    ImGui::EndPopup();
   }
-  return std::string{begin, end};
 }
 
-void ShowHAL()
+// one column per pixel, a vertical line from the smallest to the largest
+// sample that falls into it
+static void plot_channel(int channel, std::uint64_t first, std::uint64_t last)
 {
-  ImGui::Begin("HAL");
-  // get mutex
-  rtapi_mutex_get(&(hal_data->mutex));
+  ImVec2 size = ImGui::GetContentRegionAvail();
+  size.y = 60;
+  int columns = std::max(1, static_cast<int>(size.x));
+  ImVec2 p0 = ImGui::GetCursorScreenPos();
+  ImGui::InvisibleButton("plot", size);
 
-  if (ImGui::CollapsingHeader("Components")) {
-    auto next = hal_data->comp_list_ptr;
-
-    while (next != 0) {
-      hal_comp_t* comp = static_cast<hal_comp_t*>(SHMPTR(next));
-      const char* type = "unknown";
-      if (comp->type == COMPONENT_TYPE_USER)
-        type = "user";
-      else if (comp->type == COMPONENT_TYPE_REALTIME)
-        type = "realtime";
-      else if (comp->type == COMPONENT_TYPE_OTHER)
-        type = "other";
-
-      ImGui::Text("%s-%d (%d) %s", comp->name, comp->comp_id, comp->pid, type);
-      next = comp->next_ptr;
+  static std::vector<float> min, max;
+  min.resize(columns);
+  max.resize(columns);
+  sampler.decimate(channel, first, last, columns, min.data(), max.data());
+
+  float low = INFINITY, high = -INFINITY;
+  for (int i = 0; i < columns; i++) {
+    if (!std::isnan(min[i])) {
+      low = std::min(low, min[i]);
+      high = std::max(high, max[i]);
     }
   }
+  auto draw = ImGui::GetWindowDrawList();
+  ImVec2 p1(p0.x + size.x, p0.y + size.y);
+  draw->AddRectFilled(p0, p1, IM_COL32(20, 20, 20, 255));
+  if (low > high)
+    return;
+  if (high - low < 1e-9f) {
+    low -= 0.5f;
+    high += 0.5f;
+  }
 
-  if (ImGui::CollapsingHeader("Pins")) {
-    auto next = hal_data->pin_list_ptr;
-    hal_pin_t* last_pin = 0;
-    unsigned llv = 0, open_level = 0;
-
-    while (next != 0) {
-      hal_pin_t* pin = static_cast<hal_pin_t*>(SHMPTR(next));
-
-      const char* name = "";
-      auto lv = calc_level(pin->name, name);
-      auto slv = calc_level_diff(pin->name, last_pin ? last_pin->name : "");
-
-      // unindent llv - slv levels
-      while (llv > slv) {
-        if (open_level >= llv) {
-          ImGui::TreePop();
-          open_level--;
-        }
-        llv--;
-      }
+  const ImU32 color = ImGui::GetColorU32(ImGuiCol_PlotLines);
+  auto y = [&](float v) { return p1.y - (v - low) / (high - low) * size.y; };
+  float last_min = NAN, last_max = NAN;
+  for (int i = 0; i < columns; i++) {
+    if (std::isnan(min[i]))
+      continue;
+    // reaching to the column before, so steps are joined
+    float lo = min[i], hi = max[i];
+    if (!std::isnan(last_min)) {
+      lo = std::min(lo, last_max);
+      hi = std::max(hi, last_min);
+    }
+    float x = p0.x + i + 0.5f;
+    draw->AddLine(ImVec2(x, y(lo)), ImVec2(x, y(hi) - 1), color);
+    last_min = min[i];
+    last_max = max[i];
+  }
 
-      bool disp = (slv == open_level);
-      // indent lv - slv levels
-      while (lv > slv && open_level >= slv) {
-        // get name
-        std::string s = get_name_level(pin->name, open_level);
-        disp = ImGui::TreeNode(pin->name, "%s", s.c_str());
-        if (disp) {
-          open_level++;
-          slv++;
-        }
-        else
-          break;
-      }
+  char range[64];
+  snprintf(range, sizeof(range), "%g .. %g", low, high);
+  draw->AddText(p0, IM_COL32(200, 200, 200, 255), range);
+}
 
-      void* value_ptr;
-      const char* signame = "";
+static void show_scope()
+{
+  if (scope_sources.empty())
+    return;
 
-      if (pin->signal) {
-        hal_sig_t* sig = static_cast<hal_sig_t*>(SHMPTR(pin->signal));
-        value_ptr = SHMPTR(sig->data_ptr);
-        signame = sig->name;
-      }
-      else
-        value_ptr = &(pin->dummysig);
-
-      if (disp) {
-        switch (pin->type) {
-        case HAL_BIT:
-          ImGui::Text("%s[bit] %s: %s", name, signame,
-                      (*static_cast<char*>(value_ptr)) ? "☒" : "☐");
-          // ImGui::RadioButton(name, *static_cast<char*>(value_ptr));
-          break;
-        case HAL_S32:
-          ImGui::Text("%s[s32] %s: %d", name, signame,
-                      *static_cast<int*>(value_ptr));
-          break;
-        case HAL_U32:
-          ImGui::Text("%s[u32] %s: %d", name, signame,
-                      *static_cast<unsigned*>(value_ptr));
-          break;
-        case HAL_FLOAT:
-          ImGui::Text("%s[f64] %s: %f", name, signame,
-                      *static_cast<double*>(value_ptr));
-          break;
-        default:
-          break;
-        }
+  ImGui::Begin("HAL Scope");
+  if (ImGui::InputFloat("rate [Hz]", &scope_rate, 100, 1000, "%.0f",
+                        ImGuiInputTextFlags_EnterReturnsTrue))
+  {
+    scope_rate = std::clamp(scope_rate, 1.0f, float(HalSampler::c_max_rate));
+    restart_scope();
+  }
+  ImGui::SliderFloat("window [s]", &scope_window, 0.01f, 10.0f, "%.2f",
+                     ImGuiSliderFlags_Logarithmic);
+  if (ImGui::Button(sampler.running() ? "Stop" : "Run")) {
+    if (sampler.running())
+      sampler.stop();
+    else
+      restart_scope();
+  }
+  ImGui::SameLine();
+  ImGui::Text("%llu samples, %llu missed",
+              static_cast<unsigned long long>(sampler.count()),
+              static_cast<unsigned long long>(sampler.missed()));
+
+  ImGui::InputText("##capture", capture_path, sizeof(capture_path));
+  ImGui::SameLine();
+  if (sampler.capturing()) {
+    if (ImGui::Button("Stop capture"))
+      sampler.stop_capture();
+    ImGui::SameLine();
+    ImGui::Text("%llu written, %llu dropped",
+                static_cast<unsigned long long>(sampler.captured()),
+                static_cast<unsigned long long>(sampler.dropped()));
+  }
+  else if (ImGui::Button("Capture"))
+    sampler.capture(capture_path);
+
+  std::uint64_t last = sampler.count();
+  auto window = static_cast<std::uint64_t>(scope_window * sampler.rate());
+  std::uint64_t first = last > window ? last - window : 0;
+  const auto& channels = sampler.channels();
+  int removed = -1;
+  for (int i = 0; sampler.running() && i < int(channels.size()); i++) {
+    ImGui::PushID(i);
+    if (ImGui::SmallButton("x"))
+      removed = i;
+    ImGui::SameLine();
+    ImGui::Text("%s: %g", channels[i].name.c_str(),
+                last > 0 ? sampler.value(i, last - 1) : 0.0);
+    plot_channel(i, first, last);
+    ImGui::PopID();
+  }
+  if (removed >= 0) {
+    auto name = channels[removed].name;
+    std::erase_if(scope_sources,
+                  [&](const Source& s) { return s.name == name; });
+    restart_scope();
+  }
+  ImGui::End();
+}
+
+static void show_capture(const HalWatch::Capture& capture)
+{
+  static std::vector<float> values;
+
+  ImGui::Text("%s triggered, %.3f s before to %.3f s after",
+              capture.names[capture.entry].c_str(), -capture.times.front(),
+              capture.times.back());
+  for (std::size_t c = 0; c < capture.names.size(); c++) {
+    values.assign(capture.values[c].begin(), capture.values[c].end());
+    ImGui::PushID(static_cast<int>(c));
+    ImGui::PlotLines("##capture", values.data(),
+                     static_cast<int>(values.size()), 0,
+                     capture.names[c].c_str(), 3.4e38f, 3.4e38f,
+                     ImVec2(-1, 50));
+    ImGui::PopID();
+  }
+}
+
+static void show_watch()
+{
+  static const char* const triggers[] = {"none", "rising", "falling",
+                                         "change"};
+  if (watch_sources.empty())
+    return;
+
+  ImGui::Begin("HAL Watch");
+  bool window = ImGui::SliderFloat("pre [s]", &watch_pre, 0.001f, 5.0f,
+                                   "%.3f", ImGuiSliderFlags_Logarithmic);
+  window |= ImGui::SliderFloat("post [s]", &watch_post, 0.001f, 5.0f, "%.3f",
+                               ImGuiSliderFlags_Logarithmic);
+  if (window)
+    watch.set_window(watch_pre, watch_post);
+  if (ImGui::InputFloat("rate [Hz]", &watch_rate, 100, 1000, "%.0f",
+                        ImGuiInputTextFlags_EnterReturnsTrue))
+  {
+    watch_rate = std::clamp(watch_rate, 1.0f, float(HalSampler::c_max_rate));
+    restart_watch();
+  }
+
+  const auto& channels = watch.channels();
+  auto status = watch.status();
+  int removed = -1;
+  const ImGuiTableFlags flags = ImGuiTableFlags_RowBg |
+                                ImGuiTableFlags_BordersInnerV |
+                                ImGuiTableFlags_SizingFixedFit;
+  if (watch.running() && ImGui::BeginTable("watch", 5, flags)) {
+    ImGui::TableSetupColumn("name");
+    ImGui::TableSetupColumn("value");
+    ImGui::TableSetupColumn("changes");
+    ImGui::TableSetupColumn("trigger");
+    ImGui::TableSetupColumn("threshold");
+    ImGui::TableHeadersRow();
+
+    for (int i = 0; i < static_cast<int>(channels.size()); i++) {
+      ImGui::PushID(i);
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      if (ImGui::SmallButton("x"))
+        removed = i;
+      ImGui::SameLine();
+      ImGui::TextUnformatted(channels[i].name.c_str());
+      ImGui::TableNextColumn();
+      ImGui::Text("%g", status[i].value);
+      ImGui::TableNextColumn();
+      ImGui::Text("%llu", static_cast<unsigned long long>(status[i].changes));
+
+      int trigger = static_cast<int>(watch.trigger(i));
+      float threshold = static_cast<float>(watch.threshold(i));
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(100);
+      bool changed = ImGui::Combo("##trigger", &trigger, triggers, 4);
+      ImGui::TableNextColumn();
+      ImGui::SetNextItemWidth(100);
+      changed |= ImGui::InputFloat("##threshold", &threshold);
+      if (changed)
+        watch.set_trigger(i, static_cast<HalWatch::Trigger>(trigger),
+                          threshold);
+      ImGui::PopID();
+    }
+    ImGui::EndTable();
+  }
+  if (removed >= 0) {
+    auto name = channels[removed].name;
+    std::erase_if(watch_sources,
+                  [&](const Source& s) { return s.name == name; });
+    restart_watch();
+  }
+
+  // copied only when there is a new one
+  static std::vector<HalWatch::Capture> captures;
+  static std::uint64_t taken = 0;
+  if (watch.taken() != taken) {
+    taken = watch.taken();
+    captures = watch.captures();
+  }
+  ImGui::Text("%zu captures", captures.size());
+  ImGui::SameLine();
+  if (ImGui::SmallButton("clear")) {
+    watch.clear_captures();
+    watch_shown = -1;
+  }
+  for (int i = static_cast<int>(captures.size()) - 1; i >= 0; i--) {
+    char label[128];
+    snprintf(label, sizeof(label), "%.3f %s##%d", captures[i].time,
+             captures[i].names[captures[i].entry].c_str(), i);
+    if (ImGui::Selectable(label, watch_shown == i))
+      watch_shown = i;
+  }
+  if (watch_shown >= 0 && watch_shown < static_cast<int>(captures.size()))
+    show_capture(captures[watch_shown]);
+  ImGui::End();
+}
+
+// every function with its share of its thread's period, like top
+static void show_functions()
+{
+  struct Row
+  {
+    int funct;
+    const HalLatency::Stats* stats;
+    double period;
+  };
+  static std::vector<HalLatency::Stats> stats;
+  static std::vector<Row> rows;
+  latency.stats(stats);
+
+  rows.clear();
+  for (int i = 0; i < static_cast<int>(snapshot.functs.size()); i++) {
+    const auto& funct = snapshot.functs[i];
+    double period = 0;
+    if (funct.thread >= 0)
+      period = static_cast<double>(snapshot.threads[funct.thread].period);
+    rows.push_back({i, nullptr, period});
+  }
+  for (const auto& s : stats) {
+    if (!s.thread)
+      rows[s.item].stats = &s;
+  }
+
+  enum Column { NAME, THREAD, OWNER, MEAN, PEAK, TMAX, MEAN_SHARE, PEAK_SHARE };
+  const ImGuiTableFlags flags =
+      ImGuiTableFlags_RowBg | ImGuiTableFlags_BordersInnerV |
+      ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_Sortable;
+  if (!ImGui::BeginTable("functions", 8, flags))
+    return;
+  ImGui::TableSetupColumn("function", 0, 0, NAME);
+  ImGui::TableSetupColumn("thread", 0, 0, THREAD);
+  ImGui::TableSetupColumn("owner", 0, 0, OWNER);
+  ImGui::TableSetupColumn("avg us", ImGuiTableColumnFlags_PreferSortDescending,
+                          0, MEAN);
+  ImGui::TableSetupColumn("peak us", ImGuiTableColumnFlags_PreferSortDescending,
+                          0, PEAK);
+  ImGui::TableSetupColumn("tmax us", ImGuiTableColumnFlags_PreferSortDescending,
+                          0, TMAX);
+  ImGui::TableSetupColumn("avg %",
+                          ImGuiTableColumnFlags_PreferSortDescending |
+                              ImGuiTableColumnFlags_DefaultSort,
+                          0, MEAN_SHARE);
+  ImGui::TableSetupColumn("peak %", ImGuiTableColumnFlags_PreferSortDescending,
+                          0, PEAK_SHARE);
+  ImGui::TableHeadersRow();
+
+  // sorted every frame, the values change all the time
+  auto value = [](const Row& row, int column) -> double {
+    const auto* s = row.stats;
+    switch (column) {
+    case MEAN:
+      return s ? s->mean : -1;
+    case PEAK:
+      return s ? s->max : -1;
+    case TMAX:
+      return s ? s->tmax : -1;
+    case MEAN_SHARE:
+      return s && row.period > 0 ? s->mean / row.period : -1;
+    case PEAK_SHARE:
+      return s && row.period > 0 ? s->max / row.period : -1;
+    default:
+      return 0;
+    }
+  };
+  auto text = [](const Row& row, int column) -> const char* {
+    const auto& funct = snapshot.functs[row.funct];
+    if (column == THREAD)
+      return funct.thread >= 0 ? snapshot.threads[funct.thread].name : "";
+    return column == OWNER ? funct.owner : funct.name;
+  };
+  auto specs = ImGui::TableGetSortSpecs();
+  if (specs && specs->SpecsCount > 0) {
+    const auto& spec = specs->Specs[0];
+    int column = static_cast<int>(spec.ColumnUserID);
+    bool ascending = spec.SortDirection == ImGuiSortDirection_Ascending;
+    std::stable_sort(rows.begin(), rows.end(),
+                     [&](const Row& a, const Row& b) {
+                       if (column <= OWNER) {
+                         int c = std::strcmp(text(a, column), text(b, column));
+                         return ascending ? c < 0 : c > 0;
+                       }
+                       double va = value(a, column), vb = value(b, column);
+                       return ascending ? va < vb : va > vb;
+                     });
+  }
+
+  for (const auto& row : rows) {
+    ImGui::TableNextRow();
+    for (int column = NAME; column <= PEAK_SHARE; column++) {
+      ImGui::TableNextColumn();
+      if (column <= OWNER)
+        ImGui::TextUnformatted(text(row, column));
+      else if (value(row, column) >= 0) {
+        bool share = column >= MEAN_SHARE;
+        ImGui::Text(share ? "%.1f" : "%.2f",
+                    value(row, column) * (share ? 100 : 1e-3));
       }
-      next = pin->next_ptr;
-      last_pin = pin;
-      llv = lv;
     }
+  }
+  ImGui::EndTable();
+}
+
+// runtimes of the threads and functions, in us
+static void show_latency()
+{
+  static std::vector<HalLatency::Stats> stats;
+  latency.stats(stats);
+
+  const ImGuiTableFlags flags = ImGuiTableFlags_RowBg |
+                                ImGuiTableFlags_BordersInnerV |
+                                ImGuiTableFlags_SizingFixedFit;
+  if (!ImGui::BeginTable("latency", 8, flags))
+    return;
+  ImGui::TableSetupColumn("name");
+  ImGui::TableSetupColumn("period");
+  ImGui::TableSetupColumn("p50");
+  ImGui::TableSetupColumn("p99");
+  ImGui::TableSetupColumn("max");
+  ImGui::TableSetupColumn("tmax");
+  ImGui::TableSetupColumn("overruns");
+  ImGui::TableSetupColumn("last 10 s", ImGuiTableColumnFlags_WidthStretch);
+  ImGui::TableHeadersRow();
+
+  for (const auto& s : stats) {
+    ImGui::TableNextRow();
+    ImGui::TableNextColumn();
+    ImGui::TextUnformatted(s.name.c_str());
+    ImGui::TableNextColumn();
+    if (s.thread)
+      ImGui::Text("%.1f", s.period * 1e-3);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", s.p50 * 1e-3);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", s.p99 * 1e-3);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", s.max * 1e-3);
+    ImGui::TableNextColumn();
+    ImGui::Text("%.1f", s.tmax * 1e-3);
+    ImGui::TableNextColumn();
+    if (s.thread)
+      ImGui::Text("%llu / %llu", static_cast<unsigned long long>(s.overruns),
+                  static_cast<unsigned long long>(s.runs));
+    ImGui::TableNextColumn();
+    // scaled to the period for threads, so spikes show against it
+    float top = s.thread ? static_cast<float>(s.period) : 3.4e38f;
+    ImGui::PushID(s.name.c_str());
+    ImGui::PlotLines("##history", s.history.data(),
+                     static_cast<int>(s.history.size()), 0, nullptr, 0, top,
+                     ImVec2(-1, ImGui::GetTextLineHeight()));
+    ImGui::PopID();
+  }
+  ImGui::EndTable();
+}
 
-    // unindent llv - slv levels
-    while (open_level > 0) {
-      ImGui::TreePop();
-      open_level--;
+static void show_saved_value(const HalValues& values, int entry)
+{
+  if (entry < 0) {
+    ImGui::TextDisabled("-");
+    return;
+  }
+  double v = values.value(entry);
+  switch (values.layout->entries[entry].type) {
+  case HAL_BIT:
+    ImGui::TextUnformatted(v != 0 ? "☒" : "☐");
+    break;
+  case HAL_S32:
+  case HAL_U32:
+    ImGui::Text("%.0f", v);
+    break;
+  default:
+    ImGui::Text("%f", v);
+    break;
+  }
+}
+
+static void values_combo(const char* label, int* index)
+{
+  const char* preview = *index >= 0 ? saved_values[*index].label.c_str() : "";
+  ImGui::SetNextItemWidth(200);
+  if (ImGui::BeginCombo(label, preview)) {
+    for (int i = 0; i < static_cast<int>(saved_values.size()); i++) {
+      ImGui::PushID(i);
+      if (ImGui::Selectable(saved_values[i].label.c_str(), i == *index))
+        *index = i;
+      ImGui::PopID();
     }
+    ImGui::EndCombo();
   }
+}
 
-  if (ImGui::CollapsingHeader("Signals")) {
-    auto next = hal_data->sig_list_ptr;
+// every value taken at once, two sets compared. the diff is only computed
+// again when another set is picked.
+static void show_values()
+{
+  if (ImGui::Button("Take")) {
+    SavedValues saved;
+    if (!saved_values.empty())
+      saved.values.layout = saved_values.back().values.layout;
+    if (saved.values.take(snapshot) == 0) {
+      char label[32];
+      std::strftime(label, sizeof(label), "%H:%M:%S",
+                    std::localtime(&saved.values.time));
+      saved.label = label;
+      saved_values.push_back(std::move(saved));
+      values_a = values_b >= 0 ? values_b : values_a;
+      values_b = static_cast<int>(saved_values.size()) - 1;
+    }
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Clear")) {
+    saved_values.clear();
+    values_a = values_b = -1;
+    diffed = {-1, -1};
+  }
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(200);
+  ImGui::InputText("##path", values_path, sizeof(values_path));
+  ImGui::SameLine();
+  if (ImGui::Button("Save B") && values_b >= 0)
+    saved_values[values_b].values.save(values_path);
+  ImGui::SameLine();
+  if (ImGui::Button("Load")) {
+    SavedValues saved;
+    if (saved.values.load(values_path) == 0) {
+      saved.label = values_path;
+      saved_values.push_back(std::move(saved));
+      values_a = static_cast<int>(saved_values.size()) - 1;
+    }
+  }
 
-    while (next != 0) {
-      hal_sig_t* sig = static_cast<hal_sig_t*>(SHMPTR(next));
+  values_combo("A", &values_a);
+  ImGui::SameLine();
+  values_combo("B", &values_b);
+  if (values_a < 0 || values_b < 0)
+    return;
 
-      if (ImGui::TreeNode(sig->name)) {
-        ImGui::Text("Type: %d", sig->type);
-        ImGui::Text("Readers: %d", sig->readers);
-        ImGui::Text("Writers: %d", sig->writers);
-        ImGui::Text("BiDirs: %d", sig->bidirs);
+  if (diffed != std::array<int, 2>{values_a, values_b}) {
+    diffed = {values_a, values_b};
+    value_changes =
+        diff(saved_values[values_a].values, saved_values[values_b].values);
+  }
+  const auto& a = saved_values[values_a].values;
+  const auto& b = saved_values[values_b].values;
+  ImGui::Text("%zu differ", value_changes.size());
 
-        ImGui::TreePop();
-      }
+  const ImGuiTableFlags flags = ImGuiTableFlags_RowBg |
+                                ImGuiTableFlags_BordersInnerV |
+                                ImGuiTableFlags_ScrollY;
+  float height = std::min<float>(
+      (value_changes.size() + 1) * ImGui::GetTextLineHeightWithSpacing(),
+      300.0f);
+  if (!ImGui::BeginTable("changes", 3, flags, ImVec2(0, height)))
+    return;
+  ImGui::TableSetupScrollFreeze(0, 1);
+  ImGui::TableSetupColumn("name", ImGuiTableColumnFlags_WidthStretch);
+  ImGui::TableSetupColumn("A");
+  ImGui::TableSetupColumn("B");
+  ImGui::TableHeadersRow();
 
-      next = sig->next_ptr;
+  ImGuiListClipper clipper;
+  clipper.Begin(static_cast<int>(value_changes.size()));
+  while (clipper.Step()) {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+      const auto& change = value_changes[i];
+      ImGui::TableNextRow();
+      ImGui::TableNextColumn();
+      ImGui::TextUnformatted(change.a >= 0 ? a.layout->name(change.a)
+                                           : b.layout->name(change.b));
+      ImGui::TableNextColumn();
+      show_saved_value(a, change.a);
+      ImGui::TableNextColumn();
+      show_saved_value(b, change.b);
     }
   }
+  ImGui::EndTable();
+}
 
-  if (ImGui::CollapsingHeader("Parameters")) {
-    auto next = hal_data->param_list_ptr;
-    hal_param_t* last_param = 0;
-    unsigned llv = 0, open_level = 0;
-
-    while (next != 0) {
-      hal_param_t* param = static_cast<hal_param_t*>(SHMPTR(next));
-
-      const char* name = "";
-      auto lv = calc_level(param->name, name);
-      auto slv =
-          calc_level_diff(param->name, last_param ? last_param->name : "");
-
-      // unindent llv - slv levels
-      while (llv > slv) {
-        if (open_level >= llv) {
-          ImGui::TreePop();
-          open_level--;
-        }
-        llv--;
-      }
+// without the component's name in front
+static const char* pin_label(int pin)
+{
+  const char* name = snapshot.pins[pin].name;
+  const char* comp = snapshot.comps[snapshot.pins[pin].owner].name;
+  std::size_t length = std::strlen(comp);
+  if (std::strncmp(name, comp, length) == 0 && name[length] == '.')
+    return name + length + 1;
+  return name;
+}
 
-      bool disp = (slv == open_level);
-      // indent lv - slv levels
-      while (lv > slv && open_level >= slv) {
-        // get name
-        std::string s = get_name_level(param->name, open_level);
-        disp = ImGui::TreeNode(param->name, "%s", s.c_str());
-        if (disp) {
-          open_level++;
-          slv++;
-        }
-        else
-          break;
-      }
+// what a node will take up, for the layout, before it was ever drawn
+static std::array<float, 2> node_size(const HalGraph::Node& node)
+{
+  float inputs = 0;
+  float outputs = 0;
+  for (int pin : node.inputs)
+    inputs = std::max(inputs, ImGui::CalcTextSize(pin_label(pin)).x);
+  for (int pin : node.outputs)
+    outputs = std::max(outputs, ImGui::CalcTextSize(pin_label(pin)).x);
+  float title = ImGui::CalcTextSize(snapshot.comps[node.comp].name).x;
+  float arrow = ImGui::CalcTextSize("> ").x;
+  float width = std::max(title, inputs + outputs + 2 * arrow + 16);
 
-      void* value_ptr = SHMPTR(param->data_ptr);
-      if (disp) {
-        switch (param->type) {
-        case HAL_BIT:
-          // ImGui::Text("%d %s[bit]: %d", slv, name,
-          //            *static_cast<char*>(value_ptr));
-          ImGui::RadioButton(name, *static_cast<char*>(value_ptr));
-          break;
-        case HAL_S32:
-          ImGui::Text("%d %s[s32]: %d", slv, name,
-                      *static_cast<int*>(value_ptr));
-          break;
-        case HAL_U32:
-          ImGui::Text("%d %s[u32]: %d", slv, name,
-                      *static_cast<unsigned*>(value_ptr));
-          break;
-        case HAL_FLOAT:
-          ImGui::Text("%d %s[f64]: %f", slv, name,
-                      *static_cast<double*>(value_ptr));
-          break;
-        default:
-          break;
-        }
-      }
-      next = param->next_ptr;
-      last_param = param;
-      llv = lv;
+  std::size_t rows = std::max(node.inputs.size(), node.outputs.size()) + 1;
+  if (node.unlinked)
+    rows++;
+  return {width + 16, rows * ImGui::GetTextLineHeightWithSpacing() + 16};
+}
+
+static void build_graph()
+{
+  graph.build(snapshot);
+  graph_sizes.clear();
+  for (const auto& node : graph.nodes)
+    graph_sizes.push_back(node_size(node));
+}
+
+static void show_node(int v)
+{
+  const auto& node = graph.nodes[v];
+  ed::BeginNode(ed::NodeId(v + 1));
+  ImGui::TextUnformatted(snapshot.comps[node.comp].name);
+  ImGui::BeginGroup();
+  for (int pin : node.inputs) {
+    ed::BeginPin(ed::PinId(c_pin_ids + pin), ed::PinKind::Input);
+    ImGui::Text("> %s", pin_label(pin));
+    ed::EndPin();
+  }
+  ImGui::EndGroup();
+  ImGui::SameLine();
+  ImGui::BeginGroup();
+  for (int pin : node.outputs) {
+    ed::BeginPin(ed::PinId(c_pin_ids + pin), ed::PinKind::Output);
+    ImGui::Text("%s >", pin_label(pin));
+    ed::EndPin();
+  }
+  ImGui::EndGroup();
+  if (node.unlinked)
+    ImGui::TextDisabled("%d unlinked", node.unlinked);
+  ed::EndNode();
+}
+
+// the layout is computed in the background, the nodes are placed once it
+// is there. large configs have thousands of pins, only the nodes in view
+// and those linked to them are given to the editor, so the links leaving
+// the view are still drawn.
+static void show_graph()
+{
+  if (!graph_open)
+    return;
+
+  if (!ImGui::Begin("HAL Graph", &graph_open)) {
+    ImGui::End();
+    return;
+  }
+  const HalLayout* layout = graph_layouts.get(graph, graph_sizes);
+  if (!layout) {
+    ImGui::Text("laying out %zu components...", graph.nodes.size());
+    ImGui::End();
+    return;
+  }
+
+  bool place = graph_placed != layout->key;
+  if (ImGui::Button("Layout"))
+    place = true;
+  ImGui::SameLine();
+  ImGui::Text("%zu components, %zu links", graph.nodes.size(),
+              graph.links.size());
+
+  if (!graph_editor) {
+    ed::Config config;
+    config.SettingsFile = nullptr;
+    graph_editor = ed::CreateEditor(&config);
+  }
+  ImVec2 screen_min = ImGui::GetCursorScreenPos();
+  ImVec2 avail = ImGui::GetContentRegionAvail();
+  ImVec2 screen_max(screen_min.x + avail.x, screen_min.y + avail.y);
+
+  ed::SetCurrentEditor(graph_editor);
+  ed::Begin("netlist");
+  const int n = static_cast<int>(graph.nodes.size());
+  if (place) {
+    for (int v = 0; v < n; v++) {
+      const auto& position = layout->positions[v];
+      ed::SetNodePosition(ed::NodeId(v + 1),
+                          ImVec2(position[0], position[1]));
     }
+    graph_placed = layout->key;
+    ed::NavigateToContent(0);
+  }
+
+  ImVec2 view_min = ed::ScreenToCanvas(screen_min);
+  ImVec2 view_max = ed::ScreenToCanvas(screen_max);
+  graph_shown.assign(n, 0);
+  for (int v = 0; v < n; v++) {
+    ImVec2 position = ed::GetNodePosition(ed::NodeId(v + 1));
+    ImVec2 size = ed::GetNodeSize(ed::NodeId(v + 1));
+    if (size.x <= 0)
+      size = ImVec2(graph_sizes[v][0], graph_sizes[v][1]);
+    graph_shown[v] = position.x < view_max.x && position.y < view_max.y &&
+                     position.x + size.x > view_min.x &&
+                     position.y + size.y > view_min.y;
+  }
+  for (const auto& link : graph.links) {
+    int from = graph.pin_nodes[link.from];
+    int to = graph.pin_nodes[link.to];
+    // bit 0 is in view, bit 1 only pulled in for a link
+    if ((graph_shown[from] & 1) || (graph_shown[to] & 1)) {
+      graph_shown[from] |= 2;
+      graph_shown[to] |= 2;
+    }
+  }
 
-    // unindent llv - slv levels
-    while (open_level > 0) {
-      ImGui::TreePop();
-      open_level--;
+  for (int v = 0; v < n; v++) {
+    if (graph_shown[v])
+      show_node(v);
+  }
+  for (std::size_t i = 0; i < graph.links.size(); i++) {
+    const auto& link = graph.links[i];
+    if (graph_shown[graph.pin_nodes[link.from]] &&
+        graph_shown[graph.pin_nodes[link.to]])
+    {
+      ed::Link(ed::LinkId(c_link_ids + i), ed::PinId(c_pin_ids + link.from),
+               ed::PinId(c_pin_ids + link.to));
     }
   }
 
-  if (ImGui::CollapsingHeader("Functions")) {
-    auto next = hal_data->funct_list_ptr;
+  ed::LinkId hovered = ed::GetHoveredLink();
+  if (hovered.Get()) {
+    const auto& link = graph.links[hovered.Get() - c_link_ids];
+    const auto& sig = snapshot.signals[link.signal];
+    ed::Suspend();
+    ImGui::BeginTooltip();
+    show_value(sig.name, "", sig.type, sig.value);
+    ImGui::Text("%s > %s", snapshot.pins[link.from].name,
+                snapshot.pins[link.to].name);
+    ImGui::EndTooltip();
+    ed::Resume();
+  }
+  ed::End();
+  ed::SetCurrentEditor(nullptr);
+  ImGui::End();
+}
 
-    while (next != 0) {
-      hal_funct_t* funct = static_cast<hal_funct_t*>(SHMPTR(next));
+void ShowHAL()
+{
+  static double checked = -c_refresh;
 
-      if (ImGui::TreeNode(funct->name, "%s %d", funct->name, funct->maxtime)) {
-        hal_comp_t* comp = static_cast<hal_comp_t*>(SHMPTR(funct->owner_ptr));
+  ImGui::Begin("HAL");
+  // the lists are copied and the trees rebuilt only when the HAL structure
+  // changed. the mutex is held for the check and the copy, not for drawing.
+  double now = ImGui::GetTime();
+  if (now - checked >= c_refresh) {
+    checked = now;
+    if (HalSnapshot::current_stamp() != snapshot.stamp &&
+        snapshot.take() == 0)
+    {
+      pin_tree.build(snapshot.pins);
+      param_tree.build(snapshot.params);
+      search.build(snapshot);
+      latency.start(snapshot);
+      build_graph();
+      // links may have moved the values
+      if (sampler.running())
+        restart_scope();
+      if (watch.running())
+        restart_watch();
+    }
+  }
 
-        if (funct->uses_fp)
-          ImGui::Text("uses floating point");
-        if (funct->reentrant)
-          ImGui::Text("reentrant");
-        ImGui::Text("owner %s", comp->name);
-        ImGui::Text("runtime %p", funct->runtime);
-        ImGui::Text("maxtime %d", funct->maxtime);
-        ImGui::TreePop();
+  ImGui::SetNextItemWidth(-1);
+  ImGui::InputTextWithHint("##search", "search pins, parameters, signals",
+                           search_text, sizeof(search_text));
+  const auto& results = search.search(search_text);
+  if (search_text[0]) {
+    ImGui::Text("%zu found", results.size());
+    float height = std::min<float>(
+        results.size() * ImGui::GetTextLineHeightWithSpacing(), 300.0f);
+    ImGui::BeginChild("results", ImVec2(0, height));
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(results.size()));
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        const auto& result = results[i];
+        if (result.kind == HalSearch::Kind::PIN) {
+          const auto& pin = snapshot.pins[result.item];
+          show_value(pin.name, pin.signal, pin.type, pin.value);
+          source_menu(pin.name, HalSearch::Kind::PIN);
+        }
+        else if (result.kind == HalSearch::Kind::PARAM) {
+          const auto& param = snapshot.params[result.item];
+          show_value(param.name, "", param.type, param.value);
+          source_menu(param.name, HalSearch::Kind::PARAM);
+        }
+        else {
+          const auto& sig = snapshot.signals[result.item];
+          show_value(sig.name, "", sig.type, sig.value);
+          source_menu(sig.name, HalSearch::Kind::SIGNAL);
+        }
       }
+    }
+    ImGui::EndChild();
+  }
+
+  if (ImGui::Button("Netlist graph"))
+    graph_open = true;
+
+  if (ImGui::CollapsingHeader("Components")) {
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(snapshot.comps.size()));
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        const auto& comp = snapshot.comps[i];
+        const char* type = "unknown";
+        if (comp.type == COMPONENT_TYPE_USER)
+          type = "user";
+        else if (comp.type == COMPONENT_TYPE_REALTIME)
+          type = "realtime";
+        else if (comp.type == COMPONENT_TYPE_OTHER)
+          type = "other";
 
-      next = funct->next_ptr;
+        ImGui::Text("%s-%d (%d) %s", comp.name, comp.comp_id, comp.pid,
+                    type);
+      }
     }
   }
 
-  if (ImGui::CollapsingHeader("Threads")) {
-    auto next = hal_data->thread_list_ptr;
+  if (ImGui::CollapsingHeader("Pins")) {
+    pin_tree.draw([](int item, const char* name) {
+      const auto& pin = snapshot.pins[item];
+      show_value(name, pin.signal, pin.type, pin.value);
+      source_menu(pin.name, HalSearch::Kind::PIN);
+    });
+  }
 
-    while (next != 0) {
-      hal_thread_t* thread = static_cast<hal_thread_t*>(SHMPTR(next));
+  if (ImGui::CollapsingHeader("Signals")) {
+    ImGuiListClipper clipper;
+    clipper.Begin(static_cast<int>(snapshot.signals.size()));
+    while (clipper.Step()) {
+      for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+        const auto& sig = snapshot.signals[i];
+        ImGui::Text("%s type %d readers %d writers %d bidirs %d", sig.name,
+                    sig.type, sig.readers, sig.writers, sig.bidirs);
+        source_menu(sig.name, HalSearch::Kind::SIGNAL);
+      }
+    }
+  }
+
+  if (ImGui::CollapsingHeader("Parameters")) {
+    param_tree.draw([](int item, const char* name) {
+      const auto& param = snapshot.params[item];
+      show_value(name, "", param.type, param.value);
+      source_menu(param.name, HalSearch::Kind::PARAM);
+    });
+  }
 
-      ImGui::Text("%s(%d) %ld(%d) ", thread->name, thread->task_id,
-                  thread->period, thread->priority);
+  if (ImGui::CollapsingHeader("Functions"))
+    show_functions();
 
-      next = thread->next_ptr;
+  if (ImGui::CollapsingHeader("Threads")) {
+    for (const auto& thread : snapshot.threads) {
+      ImGui::Text("%s(%d) %ld(%d) ", thread.name, thread.task_id,
+                  thread.period, thread.priority);
     }
   }
 
-  rtapi_mutex_give(&(hal_data->mutex));
+  if (ImGui::CollapsingHeader("Latency"))
+    show_latency();
+
+  if (ImGui::CollapsingHeader("Snapshots"))
+    show_values();
+
   ImGui::End();
+
+  show_scope();
+  show_watch();
+  show_graph();
 }
 
 } // namespace ImCNC
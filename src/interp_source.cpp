@@ -0,0 +1,366 @@
+/*
+ * interp_source.cpp
+ *
+ * preview toolpaths from the LinuxCNC interpreter
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "interp_source.hpp"
+
+#include "canon_ring.hpp"
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <numbers>
+#include <signal.h>
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace ImCNC {
+
+// same as the built-in parser
+static constexpr double c_arc_tolerance = 0.01;
+static constexpr int c_max_arc_segments = 10000;
+static constexpr const char* c_worker = "preview_interp";
+
+namespace {
+
+// turns canon calls into toolpath vertices. positions come in the program
+// coordinates and units in effect at the time, they are moved to the
+// coordinate system of the first move:
+// machine = R(rotation) * (program + g92) + g5x
+class CanonBuilder
+{
+public:
+  explicit CanonBuilder(Toolpath& toolpath) : m_toolpath(toolpath) {}
+
+  // false at the end of the program
+  bool apply(const CanonRecord& record);
+  void finish();
+
+private:
+  using Point = std::array<double, 3>;
+
+  struct Frame
+  {
+    Point g5x{0, 0, 0};
+    Point g92{0, 0, 0};
+    double rotation = 0;
+  };
+
+  Point _point(const CanonRecord& record) const;
+  void _move(int line, MotionType type, const Point& p);
+  void _arc(const CanonRecord& record);
+
+  Toolpath& m_toolpath;
+  bool m_started = false;
+  Frame m_frame;
+  Frame m_reference;
+  double m_units = 1.0;
+  int m_plane = 1;
+  Point m_position{0, 0, 0};
+};
+
+CanonBuilder::Point CanonBuilder::_point(const CanonRecord& record) const
+{
+  const auto* v = record.values;
+  return {v[0] * m_units, v[1] * m_units, v[2] * m_units};
+}
+
+void CanonBuilder::_move(int line, MotionType type, const Point& p)
+{
+  if (!m_started) {
+    m_reference = m_frame;
+    m_toolpath.set_origin(m_position[0], m_position[1], m_position[2]);
+    m_started = true;
+  }
+  m_position = p;
+
+  // to machine coordinates and back, with the offsets of the first move
+  const double pi = std::numbers::pi;
+  double t = m_frame.rotation * pi / 180;
+  double x = p[0] + m_frame.g92[0], y = p[1] + m_frame.g92[1];
+  Point m{x * std::cos(t) - y * std::sin(t) + m_frame.g5x[0],
+          x * std::sin(t) + y * std::cos(t) + m_frame.g5x[1],
+          p[2] + m_frame.g92[2] + m_frame.g5x[2]};
+
+  t = -m_reference.rotation * pi / 180;
+  x = m[0] - m_reference.g5x[0];
+  y = m[1] - m_reference.g5x[1];
+  m_toolpath.move_to(
+      line, type, x * std::cos(t) - y * std::sin(t) - m_reference.g92[0],
+      x * std::sin(t) + y * std::cos(t) - m_reference.g92[1],
+      m[2] - m_reference.g5x[2] - m_reference.g92[2]);
+}
+
+void CanonBuilder::_arc(const CanonRecord& record)
+{
+  constexpr double pi = std::numbers::pi;
+  const auto* v = record.values;
+  const Point start = m_position;
+
+  // first, second and axis of the plane, as canon has them: XY, YZ, XZ
+  int a = 0, b = 1, h = 2;
+  if (m_plane == 2) {
+    a = 1;
+    b = 2;
+    h = 0;
+  }
+  else if (m_plane == 3) {
+    a = 2;
+    b = 0;
+    h = 1;
+  }
+
+  Point end;
+  end[a] = v[0] * m_units;
+  end[b] = v[1] * m_units;
+  end[h] = v[5] * m_units;
+  double ca = v[2] * m_units, cb = v[3] * m_units;
+  int rotation = static_cast<int>(v[4]);
+  if (rotation == 0) {
+    _move(record.line, MotionType::ARC, end);
+    return;
+  }
+
+  // positive rotation is counterclockwise, its magnitude the turns
+  double r0 = std::hypot(start[a] - ca, start[b] - cb);
+  double r1 = std::hypot(end[a] - ca, end[b] - cb);
+  double a0 = std::atan2(start[b] - cb, start[a] - ca);
+  double a1 = std::atan2(end[b] - cb, end[a] - ca);
+  double sweep = a1 - a0;
+  if (rotation > 0) {
+    if (sweep <= 0)
+      sweep += 2 * pi;
+    sweep += 2 * pi * (rotation - 1);
+  }
+  else {
+    if (sweep >= 0)
+      sweep -= 2 * pi;
+    sweep -= 2 * pi * (-rotation - 1);
+  }
+
+  double r = std::max(r0, r1);
+  double step = (r > c_arc_tolerance) ? 2 * std::acos(1 - c_arc_tolerance / r)
+                                      : pi / 2;
+  int segments = static_cast<int>(std::ceil(std::abs(sweep) / step));
+  segments = std::clamp(segments, 1, c_max_arc_segments);
+
+  Point p;
+  for (int i = 1; i < segments; i++) {
+    double t = static_cast<double>(i) / segments;
+    double angle = a0 + sweep * t;
+    double radius = r0 + (r1 - r0) * t;
+    p[a] = ca + radius * std::cos(angle);
+    p[b] = cb + radius * std::sin(angle);
+    p[h] = start[h] + (end[h] - start[h]) * t;
+    _move(record.line, MotionType::ARC, p);
+  }
+  _move(record.line, MotionType::ARC, end);
+}
+
+bool CanonBuilder::apply(const CanonRecord& record)
+{
+  const auto* v = record.values;
+
+  switch (record.op) {
+  case CanonOp::TRAVERSE:
+    _move(record.line, MotionType::TRAVERSE, _point(record));
+    break;
+  case CanonOp::FEED:
+  case CanonOp::PROBE:
+    _move(record.line, MotionType::FEED, _point(record));
+    break;
+  case CanonOp::ARC:
+    _arc(record);
+    break;
+  case CanonOp::PLANE:
+    m_plane = static_cast<int>(v[0]);
+    break;
+  case CanonOp::UNITS:
+    m_units = v[0];
+    break;
+  case CanonOp::G5X:
+    m_frame.g5x = _point(record);
+    break;
+  case CanonOp::G92:
+    m_frame.g92 = _point(record);
+    break;
+  case CanonOp::ROTATION:
+    m_frame.rotation = v[0];
+    break;
+  case CanonOp::ERROR: {
+    std::size_t length = record.size - offsetof(CanonRecord, values);
+    fprintf(stderr, "preview: line %d: %.*s\n", record.line,
+            static_cast<int>(strnlen(reinterpret_cast<const char*>(v),
+                                     length)),
+            reinterpret_cast<const char*>(v));
+    break;
+  }
+  case CanonOp::END:
+    return false;
+  }
+  return true;
+}
+
+void CanonBuilder::finish()
+{
+  if (!m_started)
+    m_toolpath.set_origin(0, 0, 0);
+  m_toolpath.finish();
+}
+
+// the worker is installed next to us
+std::string worker_path()
+{
+  char exe[PATH_MAX];
+  ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  if (length <= 0)
+    return c_worker;
+  exe[length] = '\0';
+
+  std::string path(exe);
+  auto slash = path.rfind('/');
+  return path.substr(0, slash + 1) + c_worker;
+}
+
+} // namespace
+
+InterpSource::InterpSource() = default;
+
+InterpSource::~InterpSource()
+{
+  cancel();
+}
+
+int InterpSource::start(const std::string& path, const std::string& ini,
+                        Done done)
+{
+  cancel();
+  if (path.empty())
+    return -1;
+
+  std::string worker = worker_path();
+  if (access(worker.c_str(), X_OK) != 0)
+    return -1;
+
+  auto ring = std::make_unique<CanonRing>();
+  if (ring->create() != 0) {
+    fprintf(stderr, "preview: can't create the canon ring\n");
+    return -1;
+  }
+
+  // everything the child needs is ready before the fork, it only execs
+  std::string fd = std::to_string(ring->fd());
+  const char* argv[] = {worker.c_str(), fd.c_str(), path.c_str(),
+                        ini.c_str(), nullptr};
+  pid_t pid = fork();
+  if (pid < 0) {
+    fprintf(stderr, "preview: can't start %s\n", worker.c_str());
+    return -1;
+  }
+  if (pid == 0) {
+    fcntl(ring->fd(), F_SETFD, 0);
+    execv(argv[0], const_cast<char* const*>(argv));
+    _exit(127);
+  }
+
+  m_ring = std::move(ring);
+  m_pid = pid;
+  m_thread = std::thread(&InterpSource::_run, this, std::move(done));
+  return 0;
+}
+
+void InterpSource::cancel()
+{
+  if (!m_thread.joinable())
+    return;
+
+  {
+    std::lock_guard lock(m_mutex);
+    m_ring->cancel();
+    if (m_pid > 0)
+      kill(m_pid, SIGKILL);
+  }
+  m_thread.join();
+  m_ring.reset();
+}
+
+// peeks, the worker stays a zombie until _run reaps it
+bool InterpSource::_worker_exited()
+{
+  siginfo_t info{};
+  if (waitid(P_PID, m_pid, &info, WEXITED | WNOHANG | WNOWAIT) != 0)
+    return true;
+  return info.si_pid != 0;
+}
+
+void InterpSource::_run(Done done)
+{
+  auto toolpath = std::make_shared<Toolpath>();
+  CanonBuilder builder(*toolpath);
+  std::vector<unsigned char> buffer(1 << 20);
+  std::size_t filled = 0;
+  bool ended = false;
+  bool failed = false;
+
+  while (!ended && !failed && !m_ring->cancelled()) {
+    bool closed = m_ring->closed();
+    bool exited = _worker_exited();
+    std::size_t n = m_ring->read(buffer.data() + filled,
+                                 buffer.size() - filled, 100);
+    filled += n;
+
+    std::size_t at = 0;
+    while (!ended && filled - at >= offsetof(CanonRecord, values)) {
+      CanonRecord record;
+      std::memcpy(&record, buffer.data() + at, offsetof(CanonRecord, values));
+      if (record.size < offsetof(CanonRecord, values) ||
+          record.size > sizeof(CanonRecord))
+      {
+        fprintf(stderr, "preview: bad canon record\n");
+        failed = true;
+        break;
+      }
+      if (filled - at < record.size)
+        break;
+      std::memcpy(&record, buffer.data() + at, record.size);
+      ended = !builder.apply(record);
+      at += record.size;
+    }
+    std::memmove(buffer.data(), buffer.data() + at, filled - at);
+    filled -= at;
+
+    // the worker died or closed the ring without ending the program
+    if (!ended && n == 0 && (closed || exited))
+      failed = true;
+  }
+
+  bool cancelled = m_ring->cancelled();
+  {
+    std::lock_guard lock(m_mutex);
+    int status = 0;
+    if (!ended)
+      kill(m_pid, SIGKILL);
+    waitpid(m_pid, &status, 0);
+    m_pid = -1;
+  }
+
+  if (cancelled)
+    return;
+  if (failed) {
+    done(nullptr);
+    return;
+  }
+  builder.finish();
+  done(std::move(toolpath));
+}
+
+} // namespace ImCNC
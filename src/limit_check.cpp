@@ -0,0 +1,129 @@
+/*
+ * limit_check.cpp
+ *
+ * soft limit check of a loaded program
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "limit_check.hpp"
+
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace ImCNC {
+
+// vertices are transposed into batches of this size, so the compiler can
+// vectorize the inner loops
+static constexpr std::size_t c_batch = 256;
+static constexpr std::size_t c_none = std::numeric_limits<std::size_t>::max();
+
+namespace {
+
+using FirstVertex = std::array<std::size_t, 3>;
+
+// vertices [begin, end) of one chunk. the chunk origin is transformed in
+// double and the limits are moved by it, what's left is the linear part on
+// float offsets.
+void check_chunk(const Toolpath& toolpath, std::size_t index,
+                 std::size_t begin, std::size_t end,
+                 const std::array<double, 12>& m,
+                 const std::array<double, 6>& limits, FirstVertex& first)
+{
+  const auto& origin = toolpath.chunk(index).origin;
+  auto offsets = toolpath.offsets();
+
+  float linear[3][3], lo[3], hi[3];
+  for (int a = 0; a < 3; a++) {
+    double base = m[4 * a + 3];
+    for (int k = 0; k < 3; k++) {
+      base += m[4 * a + k] * origin[k];
+      linear[a][k] = static_cast<float>(m[4 * a + k]);
+    }
+    lo[a] = static_cast<float>(limits[2 * a] - base);
+    hi[a] = static_cast<float>(limits[2 * a + 1] - base);
+  }
+
+  float x[c_batch], y[c_batch], z[c_batch];
+  unsigned char outside[c_batch];
+
+  for (auto batch = begin; batch < end; batch += c_batch) {
+    auto n = std::min(c_batch, end - batch);
+    for (std::size_t i = 0; i < n; i++) {
+      x[i] = offsets[batch + i][0];
+      y[i] = offsets[batch + i][1];
+      z[i] = offsets[batch + i][2];
+    }
+
+    for (int a = 0; a < 3; a++) {
+      if (first[a] != c_none)
+        continue;
+
+      const float l0 = linear[a][0], l1 = linear[a][1], l2 = linear[a][2];
+      const float min = lo[a], max = hi[a];
+      unsigned char any = 0;
+      for (std::size_t i = 0; i < n; i++) {
+        float v = l0 * x[i] + l1 * y[i] + l2 * z[i];
+        outside[i] = (v < min) | (v > max);
+        any |= outside[i];
+      }
+      if (any)
+        first[a] = batch + (std::find(outside, outside + n, 1) - outside);
+    }
+
+    if (std::none_of(first.begin(), first.end(),
+                     [](std::size_t v) { return v == c_none; }))
+      return;
+  }
+}
+
+} // namespace
+
+LimitLines check_limits(const Toolpath& toolpath,
+                        const std::array<double, 12>& transform,
+                        const std::array<double, 6>& limits,
+                        unsigned threads)
+{
+  LimitLines lines{0, 0, 0};
+  auto chunks = toolpath.chunk_count();
+  if (chunks == 0)
+    return lines;
+
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<unsigned>(threads, static_cast<unsigned>(chunks));
+
+  // every thread takes a contiguous run of chunks and stops looking at an
+  // axis once it found a violation, the earliest run wins
+  std::vector<FirstVertex> first(threads, {c_none, c_none, c_none});
+  auto worker = [&](unsigned t) {
+    for (auto c = chunks * t / threads; c < chunks * (t + 1) / threads; c++) {
+      auto [begin, end] = toolpath.chunk_vertices(c);
+      // vertex 0 is where the machine was, not part of the program
+      check_chunk(toolpath, c, std::max<std::size_t>(begin, 1), end,
+                  transform, limits, first[t]);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads; t++)
+    workers.emplace_back(worker, t);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+
+  for (int a = 0; a < 3; a++) {
+    for (const auto& f : first) {
+      if (f[a] != c_none) {
+        lines[a] = toolpath.vertex_line(f[a]);
+        break;
+      }
+    }
+  }
+  return lines;
+}
+
+} // namespace ImCNC
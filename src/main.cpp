@@ -15,6 +15,8 @@
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
+#include "plan_view.hpp"
+#include "program_source.hpp"
 #include "vtk_preview.hpp"
 
 #include <stdio.h>
@@ -25,6 +27,7 @@
 #include <GL/gl3w.h>    // GL3w, initialized with gl3wInit() below
 #include <GLFW/glfw3.h> // Will drag system OpenGL headers
 #include <algorithm>
+#include <memory>
 
 static void glfw_error_callback(int error, const char* description)
 {
@@ -35,7 +38,7 @@ namespace ImCNC {
 extern int init(int argc, char* argv[]);
 extern void ShowWindow();
 extern void ShowStatusWindow();
-extern void ShowGCodeWindow();
+extern void ShowGCodeWindow(int goto_line, int& hovered_line);
 extern void ShowWCSWindow();
 extern void initHAL();
 extern void ShowHAL();
@@ -255,10 +258,17 @@ int main(int argc, char* argv[])
   bool show_gcode_window = true;
   bool show_hal_window = true;
   bool show_preview_window = false;
+  bool show_plan_window = false;
 
   ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
 
-  ImCNC::VtkPreview PreviewWindow;
+  // loads the program for both views, they keep a reference to it
+  ImCNC::ProgramSource Program;
+  // renders on its own thread with a context shared with this window, so it
+  // has to go before the window does. created when first shown, stations
+  // using the plan view only never bring up VTK.
+  std::unique_ptr<ImCNC::VtkPreview> PreviewWindow;
+  ImCNC::PlanView PlanWindow(Program);
 
   // Main loop
   while (!glfwWindowShouldClose(window)) {
@@ -291,6 +301,7 @@ int main(int argc, char* argv[])
         ImGui::MenuItem("Show GCode Window", "", &show_gcode_window);
         ImGui::MenuItem("Show HAL Window", "", &show_hal_window);
         ImGui::MenuItem("Show Preview Window", "", &show_preview_window);
+        ImGui::MenuItem("Show Plan Window", "", &show_plan_window);
         ImGui::EndMenu();
       }
       ImGui::EndMainMenuBar();
@@ -304,12 +315,24 @@ int main(int argc, char* argv[])
     ImCNC::ShowWindow();
     if (show_status_window)
       ImCNC::ShowStatusWindow();
+    // clicking a segment in the preview shows its line in the editor,
+    // hovering a line in the editor highlights its segments
+    int hovered_line = 0;
+    int picked_line = PreviewWindow ? PreviewWindow->picked_line() : 0;
     if (show_gcode_window)
-      ImCNC::ShowGCodeWindow();
+      ImCNC::ShowGCodeWindow(picked_line, hovered_line);
     if (show_hal_window)
       ImCNC::ShowHAL();
-    if (show_preview_window)
-      PreviewWindow.show();
+    if (show_preview_window || show_plan_window)
+      Program.update();
+    if (show_preview_window) {
+      if (!PreviewWindow)
+        PreviewWindow = std::make_unique<ImCNC::VtkPreview>(Program);
+      PreviewWindow->highlight_line(hovered_line);
+      PreviewWindow->show();
+    }
+    if (show_plan_window)
+      PlanWindow.show();
     ImCNC::ShowWCSWindow();
 
     // 2. Show a simple window that we create ourselves. We use a Begin/End pair
@@ -399,6 +422,7 @@ int main(int argc, char* argv[])
   }
 
   // Cleanup
+  PreviewWindow.reset();
   ImGui_ImplOpenGL3_Shutdown();
   ImGui_ImplGlfw_Shutdown();
   ImGui::DestroyContext();
@@ -0,0 +1,229 @@
+/*
+ * plan_view.cpp
+ *
+ * 2D toolpath preview drawn with ImGui only
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "plan_view.hpp"
+
+#include "program_source.hpp"
+#include "shcom.hh"
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace ImCNC {
+
+extern ShCom emc;
+
+// same colors as the 3D preview
+static const ImU32 c_done = IM_COL32(96, 96, 96, 255);
+static const ImU32 c_current = IM_COL32(255, 255, 0, 255);
+static const ImU32 c_traverse = IM_COL32(30, 144, 255, 255);
+static const ImU32 c_feed = IM_COL32(255, 255, 255, 255);
+static const ImU32 c_tool = IM_COL32(255, 99, 71, 255);
+
+template <typename T> static bool ready(const std::future<T>& future)
+{
+  return future.valid() &&
+         future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+PlanView::PlanView(ProgramSource& program) : m_program(program) {}
+
+void PlanView::_update_toolpath()
+{
+  // loaded once for the 3D preview and this view
+  auto toolpath = m_program.toolpath();
+  if (toolpath != m_toolpath) {
+    m_toolpath = toolpath;
+    m_lods = {};
+    m_drawn = nullptr;
+    m_fit = true;
+  }
+
+  if (ready(m_building)) {
+    auto lod = m_building.get();
+    if (lod->toolpath() == m_toolpath)
+      m_lods[static_cast<int>(lod->plane())] = lod;
+  }
+
+  if (m_toolpath && !m_lods[static_cast<int>(m_plane)] &&
+      !m_building.valid())
+  {
+    m_building = std::async(std::launch::async,
+                            [toolpath = m_toolpath, plane = m_plane] {
+                              auto lod = std::make_shared<ToolpathLod>();
+                              lod->build(toolpath, plane);
+                              return std::shared_ptr<const ToolpathLod>(lod);
+                            });
+  }
+}
+
+void PlanView::_fit(const ImVec2& size)
+{
+  const auto& b = m_toolpath->bounds();
+  int u = (m_plane == ToolpathLod::Plane::YZ) ? 1 : 0;
+  int v = (m_plane == ToolpathLod::Plane::XY) ? 1 : 2;
+  double width = std::max(b[2 * u + 1] - b[2 * u], 1.0);
+  double height = std::max(b[2 * v + 1] - b[2 * v], 1.0);
+
+  m_center = {(b[2 * u] + b[2 * u + 1]) / 2, (b[2 * v] + b[2 * v + 1]) / 2};
+  m_scale = 0.9 * std::min(size.x / width, size.y / height);
+  m_fit = false;
+}
+
+void PlanView::_handle_input(const ImVec2& pos, const ImVec2& size)
+{
+  ImGuiIO& io = ImGui::GetIO();
+
+  bool dragging = ImGui::IsMouseDragging(ImGuiMouseButton_Left) ||
+                  ImGui::IsMouseDragging(ImGuiMouseButton_Middle);
+  if (ImGui::IsItemActive() && dragging) {
+    m_center[0] -= io.MouseDelta.x / m_scale;
+    m_center[1] += io.MouseDelta.y / m_scale;
+  }
+
+  if (ImGui::IsItemHovered() && io.MouseWheel != 0) {
+    // the point under the mouse stays where it is
+    double mx = io.MousePos.x - (pos.x + size.x / 2);
+    double my = io.MousePos.y - (pos.y + size.y / 2);
+    double u = m_center[0] + mx / m_scale;
+    double v = m_center[1] - my / m_scale;
+    m_scale = std::clamp(m_scale * std::pow(1.2, io.MouseWheel), 1e-3, 1e5);
+    m_center = {u - mx / m_scale, v + my / m_scale};
+  }
+}
+
+void PlanView::_draw_toolpath(ImDrawList* draw_list)
+{
+  // segment j of a run ends at point j, the ones ending before the current
+  // line are done
+  int line = emc.status().task.motionLine;
+  std::pair<std::size_t, std::size_t> current{0, 0};
+  if (line > 0)
+    current = m_toolpath->line_vertices(line, line + 1);
+
+  const auto& sources = m_picture.sources;
+  for (const auto& run : m_picture.runs) {
+    const ImVec2* p = &m_points[run.first];
+    auto begin = sources.begin() + run.first;
+    auto end = begin + run.count;
+    auto split = [&](std::size_t vertex) {
+      return static_cast<int>(std::lower_bound(begin + 1, end, vertex) -
+                              begin);
+    };
+    int count = static_cast<int>(run.count);
+    int done = split(current.first);
+    int after = split(current.second);
+
+    if (done > 1)
+      draw_list->AddPolyline(p, done, c_done, ImDrawFlags_None, 1.0f);
+    if (count - done + 1 > 1) {
+      draw_list->AddPolyline(p + done - 1, count - done + 1,
+                             run.traverse ? c_traverse : c_feed,
+                             ImDrawFlags_None, 1.0f);
+    }
+    if (after > done) {
+      draw_list->AddPolyline(p + done - 1, after - done + 1, c_current,
+                             ImDrawFlags_None, 2.0f);
+    }
+  }
+}
+
+void PlanView::_draw_tool(ImDrawList* draw_list, const ImVec2& pos,
+                          const ImVec2& size)
+{
+  // machine to program coordinates, the inverse of what the 3D preview does
+  // to the toolpath
+  const auto& task = emc.status().task;
+  auto m = emc.estimated_position();
+  double x = m[0] - task.g5x_offset.tran.x - task.toolOffset.tran.x;
+  double y = m[1] - task.g5x_offset.tran.y - task.toolOffset.tran.y;
+  double t = -task.rotation_xy * RAD_PER_DEG;
+  const std::array<double, 3> p{
+      x * std::cos(t) - y * std::sin(t) - task.g92_offset.tran.x,
+      x * std::sin(t) + y * std::cos(t) - task.g92_offset.tran.y,
+      m[2] - task.g5x_offset.tran.z - task.toolOffset.tran.z -
+          task.g92_offset.tran.z};
+
+  int u = (m_plane == ToolpathLod::Plane::YZ) ? 1 : 0;
+  int v = (m_plane == ToolpathLod::Plane::XY) ? 1 : 2;
+  ImVec2 c(static_cast<float>(pos.x + size.x / 2 +
+                              (p[u] - m_center[0]) * m_scale),
+           static_cast<float>(pos.y + size.y / 2 -
+                              (p[v] - m_center[1]) * m_scale));
+  double radius = emc.status().io.tool.toolTable[0].diameter / 2;
+  draw_list->AddCircle(c, std::max(static_cast<float>(radius * m_scale), 3.0f),
+                       c_tool, 0, 1.5f);
+}
+
+void PlanView::show()
+{
+  ImGui::SetNextWindowSize(ImVec2(360, 240), ImGuiCond_FirstUseEver);
+
+  if (!ImGui::Begin("plan")) {
+    ImGui::End();
+    return;
+  }
+
+  _update_toolpath();
+
+  constexpr const char* names[] = {"XY", "XZ", "YZ"};
+  for (int i = 0; i < 3; i++) {
+    auto plane = static_cast<ToolpathLod::Plane>(i);
+    if (ImGui::RadioButton(names[i], m_plane == plane)) {
+      m_plane = plane;
+      m_fit = true;
+    }
+    ImGui::SameLine();
+  }
+  if (ImGui::Button("fit"))
+    m_fit = true;
+
+  ImVec2 pos = ImGui::GetCursorScreenPos();
+  ImVec2 size = ImGui::GetContentRegionAvail();
+  if (size.x < 1 || size.y < 1) {
+    ImGui::End();
+    return;
+  }
+
+  ImGui::InvisibleButton("canvas", size,
+                         ImGuiButtonFlags_MouseButtonLeft |
+                             ImGuiButtonFlags_MouseButtonMiddle);
+  _handle_input(pos, size);
+
+  ImDrawList* draw_list = ImGui::GetWindowDrawList();
+  ImVec2 corner(pos.x + size.x, pos.y + size.y);
+  draw_list->AddRectFilled(pos, corner, IM_COL32(0, 0, 0, 255));
+  draw_list->PushClipRect(pos, corner, true);
+
+  const auto& lod = m_lods[static_cast<int>(m_plane)];
+  if (lod) {
+    if (m_fit)
+      _fit(size);
+
+    ToolpathLod::View view{m_center, m_scale, {pos.x, pos.y, size.x, size.y}};
+    if (lod.get() != m_drawn || !(view == m_view)) {
+      lod->draw(view, m_picture);
+      m_points.resize(m_picture.points.size());
+      for (std::size_t i = 0; i < m_points.size(); i++)
+        m_points[i] = ImVec2(m_picture.points[i][0], m_picture.points[i][1]);
+      m_drawn = lod.get();
+      m_view = view;
+    }
+    _draw_toolpath(draw_list);
+    _draw_tool(draw_list, pos, size);
+  }
+  else if (m_program.loading() || m_building.valid()) {
+    draw_list->AddText(ImVec2(pos.x + 4, pos.y + 4), c_done, "loading");
+  }
+
+  draw_list->PopClipRect();
+  ImGui::End();
+}
+
+} // namespace ImCNC
@@ -0,0 +1,55 @@
+/*
+ * position_estimator.cpp
+ *
+ * tool position between status updates
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "position_estimator.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ImCNC {
+
+void PositionEstimator::update(Clock::time_point time, const Point& position,
+                               double velocity)
+{
+  if (m_samples > 0 && time == m_last.time)
+    return;
+
+  m_previous = m_last;
+  m_last = {time, position};
+  m_samples = std::min(m_samples + 1, 2);
+  m_velocity = std::abs(velocity);
+}
+
+PositionEstimator::Point
+PositionEstimator::estimate(Clock::time_point now) const
+{
+  if (m_samples < 2 || m_velocity <= 0)
+    return m_last.position;
+
+  auto interval = std::min(m_last.time - m_previous.time, c_max_extrapolation);
+  auto elapsed = std::clamp(now - m_last.time, Clock::duration::zero(),
+                            interval);
+
+  Point d;
+  for (int i = 0; i < 3; i++)
+    d[i] = m_last.position[i] - m_previous.position[i];
+  double distance = std::sqrt(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  if (distance < 1e-9)
+    return m_last.position;
+
+  // a corner or a decelerating move ends up a little behind, which looks
+  // better than overshooting and jumping back
+  double travel =
+      std::min(m_velocity * std::chrono::duration<double>(elapsed).count(),
+               distance);
+  Point p;
+  for (int i = 0; i < 3; i++)
+    p[i] = m_last.position[i] + d[i] / distance * travel;
+  return p;
+}
+
+} // namespace ImCNC
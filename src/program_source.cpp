@@ -0,0 +1,151 @@
+/*
+ * program_source.cpp
+ *
+ * the toolpath of the program task has open, for every view showing it
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "program_source.hpp"
+
+#include "shcom.hh"
+#include "toolpath.hpp"
+#include "toolpath_cache.hpp"
+
+#include <chrono>
+#include <stdio.h>
+
+namespace ImCNC {
+
+extern ShCom emc;
+
+ProgramSource::~ProgramSource()
+{
+  // a run finishing now would publish into a source that's gone
+  m_interp.cancel();
+  if (m_builtin.valid())
+    m_builtin.wait();
+}
+
+std::shared_ptr<const Toolpath> ProgramSource::toolpath()
+{
+  std::lock_guard lock(m_mutex);
+  return m_toolpath;
+}
+
+bool ProgramSource::loading()
+{
+  std::lock_guard lock(m_mutex);
+  return m_finished != m_serial;
+}
+
+void ProgramSource::update()
+{
+  const char* file = emc.status().task.file;
+  if (m_file != file) {
+    m_file = file;
+    if (!m_file.empty())
+      m_watcher.watch(m_file);
+    _open();
+  }
+  else if (m_watcher.changed()) {
+    _open();
+  }
+
+  // one built-in load at a time, only the latest open waiting for it runs
+  if (m_builtin.valid() &&
+      m_builtin.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+    return;
+
+  std::uint64_t serial;
+  {
+    std::lock_guard lock(m_mutex);
+    serial = m_serial;
+  }
+  if (serial == m_builtin_serial)
+    return;
+  m_builtin_serial = serial;
+  // parsing a large file takes a while, better the views wait than the UI
+  m_builtin =
+      std::async(std::launch::async, [this, path = m_file, serial] {
+        _load_builtin(path, serial);
+      });
+}
+
+void ProgramSource::_open()
+{
+  std::uint64_t serial;
+  {
+    std::lock_guard lock(m_mutex);
+    serial = ++m_serial;
+  }
+
+  // the built-in parser runs next to it (see update()), its toolpath is
+  // shown until this one is there, and stays if the interpreter can't run
+  m_interp.start(m_file, emc.status().task.ini_filename,
+                 [this, serial](std::shared_ptr<Toolpath> toolpath) {
+                   if (toolpath)
+                     _publish(serial, toolpath, false);
+                 });
+}
+
+void ProgramSource::_load_builtin(const std::string& path, std::uint64_t serial)
+{
+  // an open after this one runs next. one the interpreter is done with
+  // still goes on, the index has to follow the file.
+  {
+    std::lock_guard lock(m_mutex);
+    if (serial != m_serial)
+      return;
+  }
+
+  // a new program comes from the cache or is parsed in full, along with its
+  // index
+  if (!m_parsed || path != m_parsed_file) {
+    m_parsed_file = path;
+    m_parsed = load_toolpath(path, m_cache_store, m_parse_index);
+    _publish(serial, m_parsed, true);
+    return;
+  }
+
+  // the program changed on disk, it's parsed only from the checkpoint
+  // before the first changed line until the toolpath runs into the old one
+  // again, milliseconds for a small edit to a large program. an index that
+  // couldn't be built means a full parse. these aren't cached.
+  auto toolpath = std::make_shared<Toolpath>();
+  GCodeParser::Index index;
+  GCodeParser parser;
+  int result = m_parse_index.line_hashes.empty()
+                   ? parser.parse(path, *toolpath, index)
+                   : parser.update(path, *m_parsed, m_parse_index, *toolpath,
+                                   index);
+  if (result < 0) {
+    fprintf(stderr, "preview: can't read %s\n", path.c_str());
+    m_parsed.reset();
+    _publish(serial, nullptr, true);
+    return;
+  }
+  m_parse_index = std::move(index);
+  if (result == 0)
+    m_parsed = toolpath;
+  // unchanged, what is shown stays
+  _publish(serial, result == 0 ? toolpath : nullptr, true);
+}
+
+void ProgramSource::_publish(std::uint64_t serial,
+                             std::shared_ptr<const Toolpath> toolpath,
+                             bool builtin)
+{
+  std::lock_guard lock(m_mutex);
+  if (serial != m_serial)
+    return;
+  // the interpreter's toolpath isn't replaced by the built-in one
+  if (builtin && m_finished == serial && !m_toolpath_builtin)
+    return;
+  m_finished = serial;
+  if (toolpath) {
+    m_toolpath = std::move(toolpath);
+    m_toolpath_builtin = builtin;
+  }
+}
+
+} // namespace ImCNC
@@ -146,11 +146,19 @@ int ShCom::update_status()
     return -1;
     break;
 
-  case 0:             // no new data
-  case EMC_STAT_TYPE: // new data
-    // new data
+  case 0: // no new data
     break;
 
+  case EMC_STAT_TYPE: { // new data
+    const auto& traj = m_status->motion.traj;
+    m_position_estimator.update(
+        ImCNC::PositionEstimator::Clock::now(),
+        {traj.actualPosition.tran.x, traj.actualPosition.tran.y,
+         traj.actualPosition.tran.z},
+        traj.current_vel);
+    break;
+  }
+
   default:
     return -1;
     break;
@@ -159,6 +167,15 @@ int ShCom::update_status()
   return 0;
 }
 
+ImCNC::PositionEstimator::Point ShCom::estimated_position() const
+{
+  if (m_position_estimator.empty()) {
+    const auto& pos = m_status->motion.traj.actualPosition;
+    return {pos.tran.x, pos.tran.y, pos.tran.z};
+  }
+  return m_position_estimator.estimate(ImCNC::PositionEstimator::Clock::now());
+}
+
 /*
   updateError() updates "errors," which are true errors and also
   operator display and text messages.
@@ -996,6 +1013,10 @@ int ShCom::ini_load(const char* filename)
     m_parameter_filename = inistring;
   }
 
+  if (nullptr != (inistring = inifile.Find("KINEMATICS", "KINS"))) {
+    m_kinematics = inistring;
+  }
+
   // close it
   inifile.Close();
 
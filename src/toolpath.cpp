@@ -0,0 +1,202 @@
+/*
+ * toolpath.cpp
+ *
+ * toolpath geometry for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "toolpath.hpp"
+
+#include <algorithm>
+
+namespace ImCNC {
+
+void Toolpath::clear()
+{
+  m_offsets.clear();
+  m_chunks.clear();
+  m_lines.clear();
+  m_storage.reset();
+  m_offset_view = {};
+  m_chunk_view = {};
+  m_line_view = {};
+  m_bounds = {0, 0, 0, 0, 0, 0};
+}
+
+void Toolpath::set_origin(double x, double y, double z)
+{
+  clear();
+  m_lines.push_back({0, MotionType::NONE, {}});
+  move_to(0, MotionType::NONE, x, y, z);
+}
+
+void Toolpath::_extend_lines(int line)
+{
+  auto first_vertex = static_cast<std::uint32_t>(m_offsets.size());
+
+  while (static_cast<int>(m_lines.size()) <= line)
+    m_lines.push_back({first_vertex, MotionType::NONE, {}});
+}
+
+void Toolpath::move_to(int line, MotionType type, double x, double y,
+                       double z)
+{
+  _extend_lines(line);
+  // vertices have to stay in line order, a line that jumps back (can't
+  // happen without subroutines) is accounted to the last line seen
+  m_lines.back().type = type;
+  _add_vertex(x, y, z);
+}
+
+void Toolpath::_add_vertex(double x, double y, double z)
+{
+  if (m_offsets.size() % c_chunk_size == 0)
+    m_chunks.push_back({{x, y, z}, {x, x, y, y, z, z}});
+
+  auto& chunk = m_chunks.back();
+  const double p[] = {x, y, z};
+  Offset offset;
+  for (int i = 0; i < 3; i++) {
+    offset[i] = static_cast<float>(p[i] - chunk.origin[i]);
+    chunk.bounds[2 * i] = std::min(chunk.bounds[2 * i], p[i]);
+    chunk.bounds[2 * i + 1] = std::max(chunk.bounds[2 * i + 1], p[i]);
+  }
+  m_offsets.push_back(offset);
+}
+
+void Toolpath::finish()
+{
+  m_lines.push_back(
+      {static_cast<std::uint32_t>(m_offsets.size()), MotionType::NONE, {}});
+  m_offset_view = m_offsets;
+  m_chunk_view = m_chunks;
+  m_line_view = m_lines;
+  _update_bounds();
+}
+
+void Toolpath::resume(const Toolpath& from, std::size_t vertices, int line)
+{
+  clear();
+  vertices = std::min(vertices, from.vertex_count());
+  auto offsets = from.offsets().first(vertices);
+  m_offsets.assign(offsets.begin(), offsets.end());
+
+  auto chunks =
+      from.chunks().first((vertices + c_chunk_size - 1) / c_chunk_size);
+  m_chunks.assign(chunks.begin(), chunks.end());
+  // the last chunk may have lost vertices
+  if (vertices % c_chunk_size != 0) {
+    auto& chunk = m_chunks.back();
+    const auto& o = chunk.origin;
+    chunk.bounds = {o[0], o[0], o[1], o[1], o[2], o[2]};
+    for (auto i = vertices - vertices % c_chunk_size; i < vertices; i++) {
+      for (int k = 0; k < 3; k++) {
+        double p = o[k] + m_offsets[i][k];
+        chunk.bounds[2 * k] = std::min(chunk.bounds[2 * k], p);
+        chunk.bounds[2 * k + 1] = std::max(chunk.bounds[2 * k + 1], p);
+      }
+    }
+  }
+
+  // without the sentinel
+  auto lines = from.lines();
+  auto count = std::min<std::size_t>(std::max(line, 1),
+                                     lines.empty() ? 0 : lines.size() - 1);
+  m_lines.assign(lines.begin(), lines.begin() + count);
+  if (m_lines.empty())
+    m_lines.push_back({0, MotionType::NONE, {}});
+}
+
+void Toolpath::append(const Toolpath& from, int line, int line_delta)
+{
+  if (line >= from.line_count())
+    return;
+
+  // the lines in between made no moves
+  _extend_lines(line + line_delta - 1);
+  auto lines = from.lines();
+  std::size_t begin = lines[line].first_vertex;
+  auto shift = static_cast<std::int64_t>(m_offsets.size()) -
+               static_cast<std::int64_t>(begin);
+  for (int l = line; l < from.line_count(); l++) {
+    m_lines.push_back(
+        {static_cast<std::uint32_t>(lines[l].first_vertex + shift),
+         lines[l].type,
+         {}});
+  }
+
+  // vertex by vertex up to the next chunk boundary. if it is one here as
+  // well, the chunks from there on are the same and are copied as they are.
+  std::size_t end = from.vertex_count();
+  std::size_t v = begin;
+  bool aligned = m_offsets.size() % c_chunk_size == begin % c_chunk_size;
+  while (v < end && (!aligned || v % c_chunk_size != 0)) {
+    auto p = from.point(v++);
+    _add_vertex(p[0], p[1], p[2]);
+  }
+  if (v < end) {
+    auto offsets = from.offsets().subspan(v);
+    m_offsets.insert(m_offsets.end(), offsets.begin(), offsets.end());
+    auto chunks = from.chunks().subspan(v / c_chunk_size);
+    m_chunks.insert(m_chunks.end(), chunks.begin(), chunks.end());
+  }
+}
+
+void Toolpath::adopt(std::shared_ptr<const void> storage,
+                     std::span<const Offset> offsets,
+                     std::span<const Chunk> chunks,
+                     std::span<const Line> lines)
+{
+  clear();
+  m_storage = std::move(storage);
+  m_offset_view = offsets;
+  m_chunk_view = chunks;
+  m_line_view = lines;
+  _update_bounds();
+}
+
+void Toolpath::_update_bounds()
+{
+  if (m_chunk_view.empty()) {
+    m_bounds = {0, 0, 0, 0, 0, 0};
+    return;
+  }
+
+  m_bounds = m_chunk_view[0].bounds;
+  for (const auto& chunk : m_chunk_view) {
+    for (int i = 0; i < 3; i++) {
+      m_bounds[2 * i] = std::min(m_bounds[2 * i], chunk.bounds[2 * i]);
+      m_bounds[2 * i + 1] =
+          std::max(m_bounds[2 * i + 1], chunk.bounds[2 * i + 1]);
+    }
+  }
+}
+
+std::pair<std::size_t, std::size_t>
+Toolpath::chunk_vertices(std::size_t index) const
+{
+  std::size_t begin = index * c_chunk_size;
+  return {begin, std::min(begin + c_chunk_size, vertex_count())};
+}
+
+std::pair<std::size_t, std::size_t> Toolpath::line_vertices(int first,
+                                                            int last) const
+{
+  if (m_line_view.empty())
+    return {0, 0};
+
+  first = std::clamp(first, 0, line_count());
+  last = std::clamp(last, first, line_count());
+  return {m_line_view[first].first_vertex, m_line_view[last].first_vertex};
+}
+
+int Toolpath::vertex_line(std::size_t vertex) const
+{
+  // first line starting past the vertex, the one before produced it
+  auto it = std::upper_bound(
+      m_line_view.begin(), m_line_view.end(), vertex,
+      [](std::size_t v, const Line& line) { return v < line.first_vertex; });
+  return static_cast<int>(it - m_line_view.begin()) - 1;
+}
+
+} // namespace ImCNC
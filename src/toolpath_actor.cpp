@@ -0,0 +1,243 @@
+/*
+ * toolpath_actor.cpp
+ *
+ * VTK actor of the toolpath for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "toolpath_actor.hpp"
+
+#include "vtkCamera.h"
+#include "vtkCellArray.h"
+#include "vtkFloatArray.h"
+#include "vtkMatrix4x4.h"
+#include "vtkNew.h"
+#include "vtkPointData.h"
+#include "vtkPoints.h"
+#include "vtkPolyData.h"
+#include "vtkPolyDataMapper.h"
+#include "vtkTypeInt32Array.h"
+
+#include <algorithm>
+#include <cstring>
+#include <numeric>
+
+namespace ImCNC {
+
+void ToolpathActor::set_toolpath(std::shared_ptr<const Toolpath> toolpath)
+{
+  for (auto& part : m_parts) {
+    if (part.actor)
+      m_assembly->RemovePart(part.actor);
+  }
+
+  m_toolpath = std::move(toolpath);
+  m_motion_line = 0;
+  m_expanded = 0;
+  m_parts.clear();
+  m_parts.resize(m_toolpath->chunk_count());
+  for (std::size_t i = 0; i < m_parts.size(); i++) {
+    auto [begin, end] = m_toolpath->chunk_vertices(i);
+    // every part but the first also draws the segment coming from the
+    // last vertex of the chunk before it
+    m_parts[i].first = (begin > 0) ? begin - 1 : begin;
+    m_parts[i].end = end;
+  }
+  m_assembly->Modified();
+}
+
+bool ToolpathActor::set_motion_line(int line)
+{
+  if (!m_toolpath || line == m_motion_line)
+    return false;
+
+  if (line > m_motion_line) {
+    _color(m_motion_line, line, State::DONE);
+  }
+  else {
+    _color(line + 1, m_motion_line + 1, State::PENDING);
+  }
+  _color(line, line + 1, line > 0 ? State::CURRENT : State::PENDING);
+  m_motion_line = line;
+  return true;
+}
+
+void ToolpathActor::update_visibility(vtkCamera* camera, double aspect)
+{
+  if (!m_toolpath)
+    return;
+
+  // the chunk bounds are in program coordinates, so the planes are moved
+  // there instead: a world plane p is p * M in the actor's frame
+  double world[24], planes[24];
+  camera->GetFrustumPlanes(aspect, world);
+  auto matrix = m_assembly->GetMatrix();
+  for (int i = 0; i < 6; i++) {
+    for (int k = 0; k < 4; k++) {
+      planes[4 * i + k] = 0;
+      for (int j = 0; j < 4; j++)
+        planes[4 * i + k] += world[4 * i + j] * matrix->GetElement(j, k);
+    }
+  }
+
+  for (std::size_t i = 0; i < m_parts.size(); i++) {
+    auto& part = m_parts[i];
+    part.visible = _in_view(m_toolpath->chunk(i).bounds, planes);
+    if (part.visible && !part.actor)
+      _expand(i);
+    if (part.actor)
+      part.actor->SetVisibility(part.visible);
+  }
+
+  for (auto& part : m_parts) {
+    if (m_expanded <= c_expanded_vertices)
+      break;
+    if (part.actor && !part.visible)
+      _release(part);
+  }
+}
+
+bool ToolpathActor::_in_view(const Toolpath::Bounds& bounds,
+                             const double* planes)
+{
+  for (int i = 0; i < 4; i++) {
+    const double* plane = planes + 4 * i;
+    double d = plane[3];
+    for (int k = 0; k < 3; k++)
+      d += plane[k] * (plane[k] > 0 ? bounds[2 * k + 1] : bounds[2 * k]);
+    if (d < 0)
+      return false;
+  }
+  return true;
+}
+
+void ToolpathActor::_expand(std::size_t index)
+{
+  auto& part = m_parts[index];
+  const auto& origin = m_toolpath->chunk(index).origin;
+  auto [begin, end] = m_toolpath->chunk_vertices(index);
+  auto n = static_cast<vtkIdType>(part.end - part.first);
+
+  // float offsets from the chunk origin, like the toolpath stores them.
+  // only the vertex borrowed from the chunk before has to be converted.
+  vtkNew<vtkFloatArray> coords;
+  coords->SetNumberOfComponents(3);
+  coords->SetNumberOfTuples(n);
+  float* c = coords->GetPointer(0);
+  if (part.first < begin) {
+    auto p = m_toolpath->point(part.first);
+    for (int k = 0; k < 3; k++)
+      *c++ = static_cast<float>(p[k] - origin[k]);
+  }
+  std::memcpy(c, m_toolpath->offsets().data() + begin,
+              (end - begin) * sizeof(Toolpath::Offset));
+  vtkNew<vtkPoints> points;
+  points->SetData(coords);
+
+  // a single polyline per part
+  vtkNew<vtkCellArray> lines;
+  if (n > 1) {
+    vtkNew<vtkTypeInt32Array> offsets;
+    vtkNew<vtkTypeInt32Array> connectivity;
+    offsets->SetNumberOfValues(2);
+    offsets->SetValue(0, 0);
+    offsets->SetValue(1, static_cast<vtkTypeInt32>(n));
+    connectivity->SetNumberOfValues(n);
+    std::iota(connectivity->GetPointer(0), connectivity->GetPointer(0) + n,
+              vtkTypeInt32{0});
+    lines->SetData(offsets, connectivity);
+  }
+
+  part.colors = vtkSmartPointer<vtkUnsignedCharArray>::New();
+  part.colors->SetNumberOfComponents(3);
+  part.colors->SetNumberOfTuples(n);
+  part.colors->SetName("state");
+  int last = m_toolpath->vertex_line(part.end - 1);
+  for (int line = m_toolpath->vertex_line(part.first); line <= last;
+       line++)
+  {
+    State state = State::PENDING;
+    if (line < m_motion_line)
+      state = State::DONE;
+    else if (line == m_motion_line && line > 0)
+      state = State::CURRENT;
+    auto [b, e] = m_toolpath->line_vertices(line, line + 1);
+    _paint(part, b, e, _line_color(line, state));
+  }
+
+  vtkNew<vtkPolyData> polydata;
+  polydata->SetPoints(points);
+  polydata->SetLines(lines);
+  polydata->GetPointData()->SetScalars(part.colors);
+
+  vtkNew<vtkPolyDataMapper> mapper;
+  mapper->SetInputData(polydata);
+  mapper->SetScalarModeToUsePointData();
+  mapper->SetColorModeToDirectScalars();
+  mapper->ScalarVisibilityOn();
+
+  part.actor = vtkSmartPointer<vtkActor>::New();
+  part.actor->SetMapper(mapper);
+  part.actor->SetPosition(origin[0], origin[1], origin[2]);
+  m_assembly->AddPart(part.actor);
+  m_expanded += part.end - part.first;
+}
+
+void ToolpathActor::_release(Part& part)
+{
+  m_assembly->RemovePart(part.actor);
+  part.actor = nullptr;
+  part.colors = nullptr;
+  m_expanded -= part.end - part.first;
+}
+
+const unsigned char* ToolpathActor::_line_color(int line, State state) const
+{
+  static constexpr unsigned char done[] = {96, 96, 96};
+  static constexpr unsigned char current[] = {255, 255, 0};
+  static constexpr unsigned char traverse[] = {30, 144, 255};
+  static constexpr unsigned char feed[] = {255, 255, 255};
+
+  if (state == State::DONE)
+    return done;
+  if (state == State::CURRENT)
+    return current;
+  return (m_toolpath->line_type(line) == MotionType::TRAVERSE) ? traverse
+                                                               : feed;
+}
+
+void ToolpathActor::_paint(Part& part, std::size_t begin, std::size_t end,
+                           const unsigned char* c)
+{
+  begin = std::max(begin, part.first);
+  end = std::min(end, part.end);
+  if (begin >= end)
+    return;
+
+  auto color = part.colors->GetPointer(0);
+  for (auto i = begin; i < end; i++)
+    std::copy_n(c, 3, color + 3 * (i - part.first));
+  part.colors->Modified();
+}
+
+void ToolpathActor::_color(int first, int last, State state)
+{
+  for (int line = first; line < last && line < m_toolpath->line_count();
+       line++)
+  {
+    auto [begin, end] = m_toolpath->line_vertices(line, line + 1);
+    if (begin == end)
+      continue;
+
+    auto c = _line_color(line, state);
+    // part i draws from vertex i * c_chunk_size - 1 on
+    for (auto i = begin / Toolpath::c_chunk_size;
+         i <= end / Toolpath::c_chunk_size && i < m_parts.size(); i++)
+    {
+      if (m_parts[i].colors)
+        _paint(m_parts[i], begin, end, c);
+    }
+  }
+}
+
+} // namespace ImCNC
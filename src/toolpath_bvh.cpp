@@ -0,0 +1,124 @@
+/*
+ * toolpath_bvh.cpp
+ *
+ * segment lookup for picking in the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "toolpath_bvh.hpp"
+
+#include "geometry.hpp"
+#include "toolpath.hpp"
+
+#include <cmath>
+#include <thread>
+
+namespace ImCNC {
+
+namespace {
+
+// slab test of the segment p0-p1 against the box
+bool segment_hits_box(const Vec& p0, const Vec& p1, const Aabb& box)
+{
+  double t0 = 0, t1 = 1;
+
+  for (int i = 0; i < 3; i++) {
+    double d = p1[i] - p0[i];
+    if (std::abs(d) < 1e-12) {
+      if (p0[i] < box.min[i] || p0[i] > box.max[i])
+        return false;
+      continue;
+    }
+    double ta = (box.min[i] - p0[i]) / d;
+    double tb = (box.max[i] - p0[i]) / d;
+    if (ta > tb)
+      std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+    if (t0 > t1)
+      return false;
+  }
+  return true;
+}
+
+} // namespace
+
+void ToolpathBvh::clear()
+{
+  m_toolpath.reset();
+  m_bvh.clear();
+}
+
+void ToolpathBvh::build(std::shared_ptr<const Toolpath> path)
+{
+  clear();
+  m_toolpath = std::move(path);
+  const auto& toolpath = *m_toolpath;
+  if (toolpath.vertex_count() < 2)
+    return;
+
+  std::vector<Aabb> boxes(toolpath.vertex_count() - 1);
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  std::size_t chunk = (boxes.size() + threads - 1) / threads;
+
+  auto fill = [&toolpath, &boxes](std::size_t begin, std::size_t end) {
+    for (auto i = begin; i < end; i++) {
+      const auto& a = toolpath.point(i);
+      const auto& b = toolpath.point(i + 1);
+      boxes[i].extend(a[0], a[1], a[2]);
+      boxes[i].extend(b[0], b[1], b[2]);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (std::size_t begin = 0; begin < boxes.size(); begin += chunk)
+    workers.emplace_back(fill, begin, std::min(begin + chunk, boxes.size()));
+  for (auto& worker : workers)
+    worker.join();
+
+  m_bvh.build(boxes, threads);
+}
+
+int ToolpathBvh::pick(const double near[3], const double far[3],
+                      double tol_near, double tol_far) const
+{
+  if (m_toolpath == nullptr || m_bvh.empty())
+    return 0;
+
+  const Vec p0{near[0], near[1], near[2]};
+  const Vec p1{far[0], far[1], far[2]};
+  const double tol_max = std::max(tol_near, tol_far);
+
+  double best = 1.0; // distance relative to the tolerance at that depth
+  std::size_t best_segment = 0;
+  bool found = false;
+
+  m_bvh.query(
+      [&](const Aabb& node) {
+        Aabb box = node;
+        for (int i = 0; i < 3; i++) {
+          box.min[i] -= static_cast<float>(tol_max);
+          box.max[i] += static_cast<float>(tol_max);
+        }
+        return segment_hits_box(p0, p1, box);
+      },
+      [&](std::uint32_t segment) {
+        double s;
+        double d2 = segment_distance2(p0, p1, m_toolpath->point(segment),
+                                      m_toolpath->point(segment + 1), s);
+        double tol = tol_near + (tol_far - tol_near) * s;
+        if (d2 <= tol * tol) {
+          double relative = std::sqrt(d2) / tol;
+          if (!found || relative < best) {
+            best = relative;
+            best_segment = segment;
+            found = true;
+          }
+        }
+        return true;
+      });
+
+  return found ? m_toolpath->vertex_line(best_segment + 1) : 0;
+}
+
+} // namespace ImCNC
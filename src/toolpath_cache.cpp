@@ -0,0 +1,455 @@
+/*
+ * toolpath_cache.cpp
+ *
+ * on-disk cache of preview toolpaths
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "toolpath_cache.hpp"
+
+#include "gcode_parser.hpp"
+#include "toolpath.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <type_traits>
+#include <unistd.h>
+#include <vector>
+
+namespace ImCNC {
+
+// bump whenever the layout or the way toolpaths are built changes
+static constexpr std::uint32_t c_cache_version = 3;
+static constexpr char c_cache_magic[8] = {'C', 'K', 'P', 'T',
+                                          'P', 'A', 'T', 'H'};
+static constexpr std::size_t c_hash_block = 1 << 20;
+static constexpr std::size_t c_section_align = 64;
+// the least recently used entries go once the cache is larger than this
+static constexpr std::uintmax_t c_cache_limit = std::uintmax_t(512) << 20;
+
+namespace {
+
+struct CacheHeader
+{
+  char magic[8];
+  std::uint32_t version;
+  std::int32_t end_line; // of the parse index
+  std::uint64_t key;
+  std::uint64_t vertex_count;
+  std::uint64_t chunk_count;
+  std::uint64_t line_count; // including the sentinel
+  std::uint64_t hash_count;
+  std::uint64_t checkpoint_count;
+  std::uint64_t offsets_offset;
+  std::uint64_t chunks_offset;
+  std::uint64_t lines_offset;
+  std::uint64_t hashes_offset;
+  std::uint64_t checkpoints_offset;
+  std::uint64_t file_size;
+};
+
+using Checkpoint = GCodeParser::Index::Checkpoint;
+static_assert(std::is_trivially_copyable_v<Checkpoint>);
+
+std::size_t align(std::size_t offset)
+{
+  return (offset + c_section_align - 1) & ~(c_section_align - 1);
+}
+
+// xxhash64 style, 4 lanes of 8 bytes
+constexpr std::uint64_t P1 = 0x9E3779B185EBCA87ull;
+constexpr std::uint64_t P2 = 0xC2B2AE3D27D4EB4Full;
+constexpr std::uint64_t P3 = 0x165667B19E3779F9ull;
+constexpr std::uint64_t P4 = 0x85EBCA77C2B2AE63ull;
+constexpr std::uint64_t P5 = 0x27D4EB2F165667C5ull;
+
+std::uint64_t hash_round(std::uint64_t acc, std::uint64_t input)
+{
+  acc += input * P2;
+  acc = std::rotl(acc, 31);
+  return acc * P1;
+}
+
+std::uint64_t merge(std::uint64_t acc, std::uint64_t value)
+{
+  acc ^= hash_round(0, value);
+  return acc * P1 + P4;
+}
+
+std::uint64_t read64(const unsigned char* p)
+{
+  std::uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+std::uint64_t hash64(const unsigned char* p, std::size_t len,
+                     std::uint64_t seed)
+{
+  const unsigned char* end = p + len;
+  std::uint64_t h;
+
+  if (len >= 32) {
+    std::uint64_t v[4] = {seed + P1 + P2, seed + P2, seed, seed - P1};
+    for (; p + 32 <= end; p += 32) {
+      for (int i = 0; i < 4; i++)
+        v[i] = hash_round(v[i], read64(p + 8 * i));
+    }
+    h = std::rotl(v[0], 1) + std::rotl(v[1], 7) + std::rotl(v[2], 12) +
+        std::rotl(v[3], 18);
+    for (auto lane : v)
+      h = merge(h, lane);
+  }
+  else {
+    h = seed + P5;
+  }
+
+  h += len;
+  for (; p + 8 <= end; p += 8)
+    h = std::rotl(h ^ hash_round(0, read64(p)), 27) * P1 + P4;
+  for (; p < end; p++)
+    h = std::rotl(h ^ (*p * P5), 11) * P1;
+
+  h ^= h >> 33;
+  h *= P2;
+  h ^= h >> 29;
+  h *= P3;
+  h ^= h >> 32;
+  return h;
+}
+
+} // namespace
+
+int hash_file(const std::string& path, std::uint64_t& hash)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return -1;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return -1;
+  }
+
+  // read, not mapped, like the parser does: a program truncated meanwhile
+  // would be a SIGBUS on the mapping. hashed as far as it goes by now.
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  std::vector<unsigned char> buffer(static_cast<std::size_t>(st.st_size));
+  std::size_t size = 0;
+  while (size < buffer.size()) {
+    ssize_t n = read(fd, buffer.data() + size, buffer.size() - size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0) {
+      close(fd);
+      return -1;
+    }
+    if (n == 0)
+      break;
+    size += static_cast<std::size_t>(n);
+  }
+  close(fd);
+  if (size == 0) {
+    hash = hash64(nullptr, 0, 0);
+    return 0;
+  }
+
+  // blocks are hashed independently, the result is the hash over the block
+  // hashes. threads take interleaved blocks.
+  const unsigned char* data = buffer.data();
+  std::size_t blocks = (size + c_hash_block - 1) / c_hash_block;
+  std::vector<std::uint64_t> block_hashes(blocks);
+  unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+  threads = std::min<unsigned>(threads, static_cast<unsigned>(blocks));
+
+  auto worker = [&](unsigned first) {
+    for (std::size_t b = first; b < blocks; b += threads) {
+      std::size_t offset = b * c_hash_block;
+      std::size_t len = std::min(c_hash_block, size - offset);
+      block_hashes[b] = hash64(data + offset, len, b);
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (unsigned i = 1; i < threads; i++)
+    workers.emplace_back(worker, i);
+  worker(0);
+  for (auto& w : workers)
+    w.join();
+
+  hash = hash64(reinterpret_cast<const unsigned char*>(block_hashes.data()),
+                block_hashes.size() * sizeof(std::uint64_t), size);
+  return 0;
+}
+
+ToolpathCache::ToolpathCache()
+{
+  if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg)
+    m_dir = std::string(xdg) + "/cockpit";
+  else if (const char* home = getenv("HOME"); home && *home)
+    m_dir = std::string(home) + "/.cache/cockpit";
+}
+
+std::string ToolpathCache::_file_name(std::uint64_t key) const
+{
+  char name[32];
+  snprintf(name, sizeof(name), "/%016llx.path",
+           static_cast<unsigned long long>(key));
+  return m_dir + name;
+}
+
+std::shared_ptr<Toolpath> ToolpathCache::load(std::uint64_t key,
+                                             GCodeParser::Index& index) const
+{
+  if (m_dir.empty())
+    return nullptr;
+
+  int fd = open(_file_name(key).c_str(), O_RDONLY);
+  if (fd < 0)
+    return nullptr;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 ||
+      static_cast<std::size_t>(st.st_size) < sizeof(CacheHeader))
+  {
+    close(fd);
+    return nullptr;
+  }
+
+  auto size = static_cast<std::size_t>(st.st_size);
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // a hit counts as a use, _trim goes by modification time
+  futimens(fd, nullptr);
+  close(fd);
+  if (map == MAP_FAILED)
+    return nullptr;
+
+  std::shared_ptr<const void> storage(
+      map, [size](const void* p) { munmap(const_cast<void*>(p), size); });
+
+  CacheHeader header;
+  std::memcpy(&header, map, sizeof(header));
+  if (std::memcmp(header.magic, c_cache_magic, sizeof(c_cache_magic)) != 0 ||
+      header.version != c_cache_version || header.key != key ||
+      header.file_size != size ||
+      header.offsets_offset +
+              header.vertex_count * sizeof(Toolpath::Offset) > size ||
+      header.chunks_offset + header.chunk_count * sizeof(Toolpath::Chunk) >
+          size ||
+      header.lines_offset + header.line_count * sizeof(Toolpath::Line) >
+          size ||
+      header.hashes_offset + header.hash_count * sizeof(std::uint64_t) >
+          size ||
+      header.checkpoints_offset +
+              header.checkpoint_count * sizeof(Checkpoint) > size ||
+      header.chunk_count != (header.vertex_count + Toolpath::c_chunk_size -
+                             1) / Toolpath::c_chunk_size ||
+      header.line_count == 0)
+    return nullptr;
+
+  auto base = static_cast<const char*>(map);
+  std::span<const Toolpath::Offset> offsets(
+      reinterpret_cast<const Toolpath::Offset*>(base + header.offsets_offset),
+      header.vertex_count);
+  std::span<const Toolpath::Chunk> chunks(
+      reinterpret_cast<const Toolpath::Chunk*>(base + header.chunks_offset),
+      header.chunk_count);
+  std::span<const Toolpath::Line> lines(
+      reinterpret_cast<const Toolpath::Line*>(base + header.lines_offset),
+      header.line_count);
+
+  // every line starts inside the toolpath, in order
+  std::uint32_t previous = 0;
+  for (const auto& line : lines) {
+    if (line.first_vertex < previous ||
+        line.first_vertex > header.vertex_count)
+      return nullptr;
+    previous = line.first_vertex;
+  }
+
+  // the index is copied out, update() reads it while the next one is built
+  auto hashes = reinterpret_cast<const std::uint64_t*>(base +
+                                                       header.hashes_offset);
+  auto checkpoints =
+      reinterpret_cast<const Checkpoint*>(base + header.checkpoints_offset);
+  index.line_hashes.assign(hashes, hashes + header.hash_count);
+  index.checkpoints.assign(checkpoints,
+                           checkpoints + header.checkpoint_count);
+  index.end_line = header.end_line;
+  int previous_line = 0;
+  for (const auto& checkpoint : index.checkpoints) {
+    if (checkpoint.line <= previous_line ||
+        static_cast<std::uint64_t>(checkpoint.line) > header.hash_count ||
+        checkpoint.vertex > header.vertex_count)
+    {
+      index = GCodeParser::Index{};
+      return nullptr;
+    }
+    previous_line = checkpoint.line;
+  }
+
+  auto toolpath = std::make_shared<Toolpath>();
+  toolpath->adopt(std::move(storage), offsets, chunks, lines);
+  return toolpath;
+}
+
+int ToolpathCache::store(std::uint64_t key, const Toolpath& toolpath,
+                         const GCodeParser::Index& index) const
+{
+  if (m_dir.empty())
+    return -1;
+
+  std::error_code ec;
+  std::filesystem::create_directories(m_dir, ec);
+  if (ec)
+    return -1;
+
+  auto offsets = toolpath.offsets();
+  auto chunks = toolpath.chunks();
+  auto lines = toolpath.lines();
+  std::span<const std::uint64_t> hashes = index.line_hashes;
+  std::span<const Checkpoint> checkpoints = index.checkpoints;
+
+  CacheHeader header{};
+  std::memcpy(header.magic, c_cache_magic, sizeof(c_cache_magic));
+  header.version = c_cache_version;
+  header.key = key;
+  header.vertex_count = offsets.size();
+  header.chunk_count = chunks.size();
+  header.line_count = lines.size();
+  header.hash_count = hashes.size();
+  header.checkpoint_count = checkpoints.size();
+  header.end_line = index.end_line;
+  header.offsets_offset = align(sizeof(CacheHeader));
+  header.chunks_offset =
+      align(header.offsets_offset + offsets.size_bytes());
+  header.lines_offset = align(header.chunks_offset + chunks.size_bytes());
+  header.hashes_offset = align(header.lines_offset + lines.size_bytes());
+  header.checkpoints_offset =
+      align(header.hashes_offset + hashes.size_bytes());
+  header.file_size = header.checkpoints_offset + checkpoints.size_bytes();
+
+  // written under a temporary name and renamed, so a concurrent load never
+  // sees half a file. two views may store the same program at once.
+  auto name = _file_name(key);
+  static std::atomic<unsigned> serial = 0;
+  auto tmp_name = name + ".tmp" + std::to_string(getpid()) + "." +
+                  std::to_string(serial++);
+  {
+    std::ofstream f(tmp_name, std::ios::binary | std::ios::trunc);
+    if (!f.good())
+      return -1;
+
+    const char padding[c_section_align] = {};
+    f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    f.write(padding, header.offsets_offset - sizeof(header));
+    f.write(reinterpret_cast<const char*>(offsets.data()),
+            offsets.size_bytes());
+    f.write(padding, header.chunks_offset - header.offsets_offset -
+                         offsets.size_bytes());
+    f.write(reinterpret_cast<const char*>(chunks.data()), chunks.size_bytes());
+    f.write(padding, header.lines_offset - header.chunks_offset -
+                         chunks.size_bytes());
+    f.write(reinterpret_cast<const char*>(lines.data()), lines.size_bytes());
+    f.write(padding, header.hashes_offset - header.lines_offset -
+                         lines.size_bytes());
+    f.write(reinterpret_cast<const char*>(hashes.data()), hashes.size_bytes());
+    f.write(padding, header.checkpoints_offset - header.hashes_offset -
+                         hashes.size_bytes());
+    f.write(reinterpret_cast<const char*>(checkpoints.data()),
+            checkpoints.size_bytes());
+    if (!f.good()) {
+      f.close();
+      unlink(tmp_name.c_str());
+      return -1;
+    }
+  }
+
+  if (rename(tmp_name.c_str(), name.c_str()) != 0) {
+    unlink(tmp_name.c_str());
+    return -1;
+  }
+  _trim();
+  return 0;
+}
+
+void ToolpathCache::_trim() const
+{
+  struct Entry
+  {
+    std::filesystem::file_time_type time;
+    std::uintmax_t size;
+    std::filesystem::path path;
+  };
+  std::vector<Entry> entries;
+  std::uintmax_t total = 0;
+
+  std::error_code ec;
+  for (const auto& file : std::filesystem::directory_iterator(m_dir, ec)) {
+    if (file.path().extension() != ".path")
+      continue;
+    Entry entry{file.last_write_time(ec), file.file_size(ec), file.path()};
+    if (ec)
+      continue;
+    total += entry.size;
+    entries.push_back(std::move(entry));
+  }
+  if (total <= c_cache_limit)
+    return;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& a, const Entry& b) { return a.time < b.time; });
+  for (const auto& entry : entries) {
+    if (total <= c_cache_limit)
+      break;
+    if (std::filesystem::remove(entry.path, ec))
+      total -= entry.size;
+  }
+}
+
+std::shared_ptr<Toolpath> load_toolpath(const std::string& path,
+                                        std::future<void>& store,
+                                        GCodeParser::Index& index)
+{
+  index = GCodeParser::Index{};
+  std::shared_ptr<Toolpath> toolpath;
+  ToolpathCache cache;
+  std::uint64_t key = 0;
+  bool hashed = !path.empty() && hash_file(path, key) == 0;
+
+  if (hashed)
+    toolpath = cache.load(key, index);
+  if (toolpath)
+    return toolpath;
+
+  toolpath = std::make_shared<Toolpath>();
+  GCodeParser parser;
+  if (!hashed || parser.parse(path, *toolpath, index) != 0) {
+    if (!path.empty())
+      fprintf(stderr, "toolpath: can't read %s\n", path.c_str());
+    toolpath->clear();
+    index = GCodeParser::Index{};
+    return toolpath;
+  }
+
+  // writing a few hundred MB shouldn't delay the first frame
+  store = std::async(std::launch::async, [cache, key, toolpath, index] {
+    if (cache.store(key, *toolpath, index) != 0)
+      fprintf(stderr, "toolpath: can't write toolpath cache\n");
+  });
+  return toolpath;
+}
+
+} // namespace ImCNC
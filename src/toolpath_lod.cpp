@@ -0,0 +1,343 @@
+/*
+ * toolpath_lod.cpp
+ *
+ * toolpath reduced for drawing in 2D
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ */
+
+#include "toolpath_lod.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace ImCNC {
+
+static void extend(Toolpath::Bounds& bounds, const Toolpath::Point& p)
+{
+  for (int i = 0; i < 3; i++) {
+    bounds[2 * i] = std::min(bounds[2 * i], p[i]);
+    bounds[2 * i + 1] = std::max(bounds[2 * i + 1], p[i]);
+  }
+}
+
+static Toolpath::Point add(const Toolpath::Point& origin,
+                           const Toolpath::Offset& offset)
+{
+  return {origin[0] + offset[0], origin[1] + offset[1],
+          origin[2] + offset[2]};
+}
+
+void ToolpathLod::build(std::shared_ptr<const Toolpath> toolpath,
+                        Plane plane)
+{
+  m_toolpath = std::move(toolpath);
+  m_plane = plane;
+  m_u = (plane == Plane::YZ) ? 1 : 0;
+  m_v = (plane == Plane::XY) ? 1 : 2;
+  m_levels.clear();
+  const auto& tp = *m_toolpath;
+  if (tp.vertex_count() < 2)
+    return;
+
+  // blocks don't straddle chunks, their offsets are from the chunk origin
+  Level full;
+  full.offsets = tp.offsets();
+  for (std::size_t c = 0; c < tp.chunk_count(); c++) {
+    auto [begin, end] = tp.chunk_vertices(c);
+    for (auto first = begin; first < end; first += c_block_size) {
+      auto last = std::min(first + c_block_size, end);
+      auto p = tp.point((first > 0) ? first - 1 : first);
+      Block block{tp.chunk(c).origin,
+                  {p[0], p[0], p[1], p[1], p[2], p[2]},
+                  static_cast<std::uint32_t>(first),
+                  static_cast<std::uint32_t>(last)};
+      for (auto i = first; i < last; i++)
+        extend(block.bounds, tp.point(i));
+      full.blocks.push_back(block);
+    }
+  }
+  m_levels.push_back(std::move(full));
+
+  const auto& b = tp.bounds();
+  double size =
+      std::hypot(b[2 * m_u + 1] - b[2 * m_u], b[2 * m_v + 1] - b[2 * m_v]);
+
+  // a level only pays for itself if it drops a third of the vertices
+  for (double tolerance = size / 65536; tolerance < size; tolerance *= 2) {
+    const auto& from = m_levels.back();
+    if (from.offsets.size() <= c_block_size)
+      break;
+
+    Level level;
+    _decimate(from, tolerance, level);
+    if (level.offsets.size() * 3 <= from.offsets.size() * 2)
+      m_levels.push_back(std::move(level));
+  }
+}
+
+void ToolpathLod::_decimate(const Level& from, double tolerance,
+                            Level& to) const
+{
+  const auto lines = m_toolpath->lines();
+  const std::size_t n = from.offsets.size();
+
+  std::vector<MotionType> types(n);
+  std::size_t line = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    auto source = from.source(i);
+    while (lines[line + 1].first_vertex <= source)
+      line++;
+    types[i] = lines[line].type;
+  }
+
+  // the error adds up over the levels, each is built from the one before
+  to.tolerance = from.tolerance + tolerance;
+  Toolpath::Point last{0, 0, 0};
+  auto keep = [&](std::size_t i, const Toolpath::Point& p) {
+    if (to.storage.size() % c_block_size == 0) {
+      auto first = static_cast<std::uint32_t>(to.storage.size());
+      Block block{p, {p[0], p[0], p[1], p[1], p[2], p[2]}, first, first};
+      if (first > 0)
+        extend(block.bounds, last);
+      to.blocks.push_back(block);
+    }
+
+    auto& block = to.blocks.back();
+    Toolpath::Offset offset;
+    for (int k = 0; k < 3; k++)
+      offset[k] = static_cast<float>(p[k] - block.origin[k]);
+    extend(block.bounds, p);
+    block.end++;
+    to.storage.push_back(offset);
+    to.sources.push_back(static_cast<std::uint32_t>(from.source(i)));
+    last = p;
+  };
+
+  // a vertex is left out while the path stays within tolerance of the line
+  // from the last vertex kept, going forward. the last vertex of every run of
+  // one motion type stays, so no segment stands in for another type.
+  const double tolerance2 = tolerance * tolerance;
+  const int u = m_u, v = m_v;
+  Toolpath::Point anchor{0, 0, 0}, prev{0, 0, 0};
+  std::array<double, 2> dir{0, 0};
+  bool has_dir = false;
+  double reach = 0;
+  auto aim = [&](const Toolpath::Point& p) {
+    double du = p[u] - anchor[u], dv = p[v] - anchor[v];
+    double length = std::hypot(du, dv);
+    has_dir = length > tolerance;
+    if (has_dir) {
+      dir = {du / length, dv / length};
+      reach = length;
+    }
+  };
+
+  for (const auto& block : from.blocks) {
+    for (std::size_t i = block.first; i < block.end; i++) {
+      auto p = add(block.origin, from.offsets[i]);
+      if (i == 0) {
+        keep(i, p);
+        anchor = p;
+        prev = p;
+        continue;
+      }
+
+      if (!has_dir) {
+        aim(p);
+      }
+      else {
+        double du = p[u] - anchor[u], dv = p[v] - anchor[v];
+        double t = du * dir[0] + dv * dir[1];
+        double off2 = du * du + dv * dv - t * t;
+        if (off2 <= tolerance2 && t >= reach - tolerance) {
+          reach = std::max(reach, t);
+        }
+        else {
+          keep(i - 1, prev);
+          anchor = prev;
+          aim(p);
+        }
+      }
+
+      if (i + 1 == n || types[i] != types[i + 1]) {
+        keep(i, p);
+        anchor = p;
+        has_dir = false;
+      }
+      prev = p;
+    }
+  }
+  to.offsets = to.storage;
+}
+
+const ToolpathLod::Level& ToolpathLod::_level(double scale) const
+{
+  // coarsest level still below a pixel
+  const Level* level = &m_levels.front();
+  for (const auto& l : m_levels) {
+    if (l.tolerance * scale <= 1)
+      level = &l;
+  }
+  return *level;
+}
+
+void ToolpathLod::draw(const View& view, Picture& picture) const
+{
+  auto& points = picture.points;
+  auto& sources = picture.sources;
+  auto& runs = picture.runs;
+  points.clear();
+  sources.clear();
+  runs.clear();
+  if (m_levels.empty() || view.scale <= 0)
+    return;
+
+  const auto& level = _level(view.scale);
+  const auto lines = m_toolpath->lines();
+  const int a = m_u, b = m_v;
+
+  const double half_w = view.rect[2] / 2 / view.scale;
+  const double half_h = view.rect[3] / 2 / view.scale;
+  const double u0 = view.center[0] - half_w, u1 = view.center[0] + half_w;
+  const double v0 = view.center[1] - half_h, v1 = view.center[1] + half_h;
+  const double x0 = view.rect[0] + view.rect[2] / 2;
+  const double y0 = view.rect[1] + view.rect[3] / 2;
+  const auto scale = static_cast<float>(view.scale);
+
+  using Pixel = std::array<float, 2>;
+  auto screen = [&](const Block& block, std::size_t i) {
+    const auto& o = level.offsets[i];
+    auto x = static_cast<float>(x0 + (block.origin[a] - view.center[0]) *
+                                         view.scale);
+    auto y = static_cast<float>(y0 - (block.origin[b] - view.center[1]) *
+                                         view.scale);
+    return Pixel{x + o[a] * scale, y - o[b] * scale};
+  };
+
+  // one bit per pixel and motion type. off screen counts as covered.
+  const int width = std::max(0, static_cast<int>(view.rect[2]));
+  const int height = std::max(0, static_cast<int>(view.rect[3]));
+  const std::size_t pixels = std::size_t(width) * height;
+  auto& covered = picture.covered;
+  covered.assign(2 * ((pixels + 63) / 64), 0);
+  auto bit = [&](bool traverse, const Pixel& p, std::size_t& index) {
+    int x = static_cast<int>(std::floor(p[0] - view.rect[0]));
+    int y = static_cast<int>(std::floor(p[1] - view.rect[1]));
+    if (x < 0 || y < 0 || x >= width || y >= height)
+      return false;
+    index = (traverse ? pixels : 0) + std::size_t(y) * width + x;
+    return true;
+  };
+  auto is_covered = [&](bool traverse, const Pixel& p) {
+    std::size_t index;
+    return !bit(traverse, p, index) ||
+           ((covered[index / 64] >> (index % 64)) & 1);
+  };
+  auto cover = [&](bool traverse, const Pixel& p) {
+    std::size_t index;
+    if (bit(traverse, p, index))
+      covered[index / 64] |= std::uint64_t{1} << (index % 64);
+  };
+  int line = 0;
+  auto traverse_at = [&](std::size_t source) {
+    while (lines[line + 1].first_vertex <= source)
+      line++;
+    return lines[line].type == MotionType::TRAVERSE;
+  };
+
+  bool open = false;
+  bool run_traverse = false;
+  std::uint32_t run_first = 0;
+  Pixel prev{0, 0}, last{0, 0}, pending{0, 0};
+  std::uint32_t prev_source = 0, pending_source = 0;
+  bool has_pending = false;
+
+  auto push = [&](const Pixel& p, std::uint32_t source) {
+    points.push_back(p);
+    sources.push_back(source);
+  };
+  auto close = [&] {
+    if (!open)
+      return;
+    if (has_pending)
+      push(pending, pending_source);
+    has_pending = false;
+    auto count = static_cast<std::uint32_t>(points.size()) - run_first;
+    runs.push_back({run_first, count, run_traverse});
+    open = false;
+  };
+
+  // next vertex if the block before was drawn
+  std::size_t expected = 0;
+  for (std::size_t k = 0; k < level.blocks.size(); k++) {
+    const auto& block = level.blocks[k];
+    const auto& bounds = block.bounds;
+    if (bounds[2 * a + 1] < u0 || bounds[2 * a] > u1 ||
+        bounds[2 * b + 1] < v0 || bounds[2 * b] > v1)
+    {
+      close();
+      continue;
+    }
+
+    std::size_t i = block.first;
+    if (i != expected || k == 0) {
+      close();
+      if (i == 0) {
+        // nothing leads to the first vertex
+        prev = screen(block, 0);
+        i = 1;
+      }
+      else {
+        prev = screen(level.blocks[k - 1], i - 1);
+      }
+      prev_source = static_cast<std::uint32_t>(level.source(i - 1));
+      if (i < block.end)
+        line = m_toolpath->vertex_line(level.source(i));
+    }
+
+    for (; i < block.end; i++) {
+      auto q = screen(block, i);
+      auto source = static_cast<std::uint32_t>(level.source(i));
+      bool traverse = traverse_at(source);
+      bool continues = open && traverse == run_traverse;
+
+      if (continues && std::abs(q[0] - last[0]) < 1 &&
+          std::abs(q[1] - last[1]) < 1)
+      {
+        // still on the pixel of the last point
+        pending = q;
+        pending_source = source;
+        has_pending = true;
+      }
+      else if (std::abs(q[0] - prev[0]) < 2 && std::abs(q[1] - prev[1]) < 2 &&
+               is_covered(traverse, prev) && is_covered(traverse, q))
+      {
+        // short and drawn over already
+        close();
+      }
+      else if (continues) {
+        push(q, source);
+        last = q;
+        has_pending = false;
+        cover(traverse, q);
+      }
+      else {
+        close();
+        open = true;
+        run_traverse = traverse;
+        run_first = static_cast<std::uint32_t>(points.size());
+        push(prev, prev_source);
+        push(q, source);
+        last = q;
+        cover(traverse, prev);
+        cover(traverse, q);
+      }
+      prev = q;
+      prev_source = source;
+    }
+    expected = block.end;
+  }
+  close();
+}
+
+} // namespace ImCNC
@@ -7,25 +7,59 @@
 
 #include "vtk_preview.hpp"
 
+#include "collision.hpp"
+#include "heightmap.hpp"
 #include "imgui.h"
+#include "program_source.hpp"
+#include "limit_check.hpp"
 #include "shcom.hh"
+#include "toolpath.hpp"
+#include "toolpath_actor.hpp"
+#include "toolpath_bvh.hpp"
 #include "vtkActor.h"
+#include "vtkAssembly.h"
 #include "vtkAxesActor.h"
+#include "vtkCallbackCommand.h"
 #include "vtkCamera.h"
+#include "vtkCellArray.h"
+#include "vtkCommand.h"
 #include "vtkConeSource.h"
 #include "vtkCubeAxesActor.h"
 #include "vtkCylinderSource.h"
+#include "vtkFloatArray.h"
+#include "vtkGenericOpenGLRenderWindow.h"
+#include "vtkGenericRenderWindowInteractor.h"
+#include "vtkMatrix4x4.h"
 #include "vtkNamedColors.h"
+#include "vtkOpenGLFramebufferObject.h"
+#include "vtkPointData.h"
+#include "vtkPoints.h"
+#include "vtkPolyData.h"
 #include "vtkPolyDataMapper.h"
 #include "vtkProperty.h"
+#include "vtkRenderer.h"
 #include "vtkSmartPointer.h"
 #include "vtkTransform.h"
 #include "vtkTransformPolyDataFilter.h"
+#include "vtkTypeInt32Array.h"
+
+#include <GL/gl3w.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdio.h>
 
 namespace ImCNC {
 
 extern ShCom emc;
 
+// pixels
+static constexpr double c_pick_radius = 5.0;
+static constexpr float c_click_distance = 3.0f;
+
 class AxesActor : public vtkAxesActor
 {
 public:
@@ -104,12 +138,9 @@ public:
 
   vtkSmartPointer<vtkActor> get_actor() { return m_actor; }
 
-  void set_position(EmcPose position)
+  void set_position(const std::array<double, 3>& position)
   {
-    // auto transform = vtkSmartPointer<vtkTransform>::New();
-    // transform->Translate(position.tran.x, position.tran.y, position.tran.z);
-    // m_actor->SetUserTransform(transform);
-    m_actor->SetPosition(position.tran.x, position.tran.y, position.tran.z);
+    m_actor->SetPosition(position.data());
   }
 
 private:
@@ -119,102 +150,1153 @@ private:
   double height = 50.0;
 };
 
-VtkPreview::VtkPreview()
+// segments of some lines, drawn over the toolpath
+class HighlightActor
+{
+public:
+  explicit HighlightActor(const char* color)
+  {
+    vtkNew<vtkNamedColors> colors;
+
+    m_polydata = vtkSmartPointer<vtkPolyData>::New();
+    vtkNew<vtkPolyDataMapper> mapper;
+    mapper->SetInputData(m_polydata);
+    mapper->ScalarVisibilityOff();
+
+    vtkNew<vtkActor> actor;
+    actor->SetMapper(mapper);
+    actor->GetProperty()->SetColor(colors->GetColor3d(color).GetData());
+    actor->GetProperty()->SetLineWidth(4);
+    m_actor = actor;
+  }
+
+  vtkSmartPointer<vtkActor> get_actor() { return m_actor; }
+
+  // lines <= 0 are skipped
+  void set_lines(const Toolpath* toolpath, const std::vector<int>& lines)
+  {
+    m_polydata->Initialize();
+
+    vtkNew<vtkPoints> points;
+    vtkNew<vtkCellArray> cells;
+    for (int line : lines) {
+      if (toolpath == nullptr || line <= 0)
+        continue;
+
+      // the line's first segment starts at the last vertex of the line
+      // before
+      auto [begin, end] = toolpath->line_vertices(line, line + 1);
+      if (begin == end)
+        continue;
+      if (begin > 0)
+        begin--;
+
+      cells->InsertNextCell(static_cast<vtkIdType>(end - begin));
+      for (auto i = begin; i < end; i++) {
+        const auto& p = toolpath->point(i);
+        cells->InsertCellPoint(points->InsertNextPoint(p.data()));
+      }
+    }
+    if (cells->GetNumberOfCells() > 0) {
+      m_polydata->SetPoints(points);
+      m_polydata->SetLines(cells);
+    }
+    m_polydata->Modified();
+  }
+
+private:
+  vtkSmartPointer<vtkPolyData> m_polydata;
+  vtkSmartPointer<vtkActor> m_actor;
+};
+
+// the heightmap as one mesh per tile, so a cut only rewrites the tiles it
+// touched. a tile's mesh reaches one node into its right and upper
+// neighbours to close the gaps between them.
+class StockActor
+{
+public:
+  StockActor() { m_assembly = vtkSmartPointer<vtkAssembly>::New(); }
+
+  vtkSmartPointer<vtkAssembly> get_actor() { return m_assembly; }
+
+  void set_heightmap(Heightmap& map)
+  {
+    vtkNew<vtkNamedColors> colors;
+
+    for (auto& part : m_parts) {
+      if (part.actor)
+        m_assembly->RemovePart(part.actor);
+    }
+    m_parts.clear();
+    m_tiles_x = map.tiles_x();
+    m_parts.resize(static_cast<std::size_t>(map.tiles_x()) * map.tiles_y());
+
+    for (int ty = 0; ty < map.tiles_y(); ty++) {
+      for (int tx = 0; tx < map.tiles_x(); tx++) {
+        auto& part = m_parts[ty * m_tiles_x + tx];
+        part.i0 = tx * Heightmap::c_tile_size;
+        part.j0 = ty * Heightmap::c_tile_size;
+        part.i1 = std::min(part.i0 + Heightmap::c_tile_size,
+                           map.nodes_x() - 1);
+        part.j1 = std::min(part.j0 + Heightmap::c_tile_size,
+                           map.nodes_y() - 1);
+        // a last row or column of single nodes is already drawn by the
+        // tile before
+        if (part.i1 <= part.i0 || part.j1 <= part.j0)
+          continue;
+        _build(map, part, colors->GetColor3d("Silver"));
+      }
+    }
+    update(map);
+    m_assembly->Modified();
+  }
+
+  // rewrites the heights of the tiles showing dirty nodes
+  void update(Heightmap& map)
+  {
+    bool changed = false;
+
+    for (int ty = 0; ty < map.tiles_y(); ty++) {
+      for (int tx = 0; tx < map.tiles_x(); tx++) {
+        auto& part = m_parts[ty * m_tiles_x + tx];
+        if (!part.coords ||
+            !(map.dirty(tx, ty) || map.dirty(tx + 1, ty) ||
+              map.dirty(tx, ty + 1) || map.dirty(tx + 1, ty + 1)))
+          continue;
+
+        float* p = part.coords->GetPointer(0);
+        for (int j = part.j0; j <= part.j1; j++) {
+          for (int i = part.i0; i <= part.i1; i++, p += 3)
+            p[2] = map.height(i, j);
+        }
+        part.coords->Modified();
+        changed = true;
+      }
+    }
+    map.clear_dirty();
+    if (changed)
+      m_assembly->Modified();
+  }
+
+private:
+  // nodes [i0, i1] x [j0, j1]
+  struct Part
+  {
+    vtkSmartPointer<vtkActor> actor;
+    vtkSmartPointer<vtkFloatArray> coords;
+    int i0 = 0, i1 = 0, j0 = 0, j1 = 0;
+  };
+
+  void _build(const Heightmap& map, Part& part, const vtkColor3d& color)
+  {
+    int ni = part.i1 - part.i0 + 1;
+    int nj = part.j1 - part.j0 + 1;
+
+    part.coords = vtkSmartPointer<vtkFloatArray>::New();
+    part.coords->SetNumberOfComponents(3);
+    part.coords->SetNumberOfTuples(ni * nj);
+    float* p = part.coords->GetPointer(0);
+    for (int j = part.j0; j <= part.j1; j++) {
+      for (int i = part.i0; i <= part.i1; i++, p += 3) {
+        p[0] = static_cast<float>(map.node_x(i));
+        p[1] = static_cast<float>(map.node_y(j));
+      }
+    }
+    vtkNew<vtkPoints> points;
+    points->SetData(part.coords);
+
+    vtkNew<vtkTypeInt32Array> offsets;
+    vtkNew<vtkTypeInt32Array> connectivity;
+    offsets->SetNumberOfValues((ni - 1) * (nj - 1) + 1);
+    connectivity->SetNumberOfValues(4 * (ni - 1) * (nj - 1));
+    int cell = 0;
+    for (int j = 0; j < nj - 1; j++) {
+      for (int i = 0; i < ni - 1; i++, cell++) {
+        int n = j * ni + i;
+        offsets->SetValue(cell, 4 * cell);
+        connectivity->SetValue(4 * cell, n);
+        connectivity->SetValue(4 * cell + 1, n + 1);
+        connectivity->SetValue(4 * cell + 2, n + ni + 1);
+        connectivity->SetValue(4 * cell + 3, n + ni);
+      }
+    }
+    offsets->SetValue(cell, 4 * cell);
+    vtkNew<vtkCellArray> polys;
+    polys->SetData(offsets, connectivity);
+
+    vtkNew<vtkPolyData> polydata;
+    polydata->SetPoints(points);
+    polydata->SetPolys(polys);
+
+    vtkNew<vtkPolyDataMapper> mapper;
+    mapper->SetInputData(polydata);
+    mapper->ScalarVisibilityOff();
+
+    part.actor = vtkSmartPointer<vtkActor>::New();
+    part.actor->SetMapper(mapper);
+    part.actor->GetProperty()->SetColor(color.GetData());
+    m_assembly->AddPart(part.actor);
+  }
+
+  int m_tiles_x = 0;
+  std::vector<Part> m_parts;
+  vtkSmartPointer<vtkAssembly> m_assembly;
+};
+
+// STL meshes in machine coordinates, drawn see-through so the toolpath
+// stays visible
+class FixtureActor
+{
+public:
+  FixtureActor() { m_assembly = vtkSmartPointer<vtkAssembly>::New(); }
+
+  vtkSmartPointer<vtkAssembly> get_actor() { return m_assembly; }
+
+  void add_mesh(const std::vector<Triangle>& triangles, bool part)
+  {
+    vtkNew<vtkNamedColors> colors;
+    auto n = static_cast<vtkIdType>(3 * triangles.size());
+
+    vtkNew<vtkFloatArray> coords;
+    coords->SetNumberOfComponents(3);
+    coords->SetNumberOfTuples(n);
+    std::memcpy(coords->GetPointer(0), triangles.data(),
+                triangles.size() * sizeof(Triangle));
+    vtkNew<vtkPoints> points;
+    points->SetData(coords);
+
+    vtkNew<vtkTypeInt32Array> offsets;
+    vtkNew<vtkTypeInt32Array> connectivity;
+    offsets->SetNumberOfValues(static_cast<vtkIdType>(triangles.size()) + 1);
+    for (vtkIdType i = 0; i < offsets->GetNumberOfValues(); i++)
+      offsets->SetValue(i, static_cast<vtkTypeInt32>(3 * i));
+    connectivity->SetNumberOfValues(n);
+    std::iota(connectivity->GetPointer(0), connectivity->GetPointer(0) + n,
+              vtkTypeInt32{0});
+    vtkNew<vtkCellArray> polys;
+    polys->SetData(offsets, connectivity);
+
+    vtkNew<vtkPolyData> polydata;
+    polydata->SetPoints(points);
+    polydata->SetPolys(polys);
+
+    vtkNew<vtkPolyDataMapper> mapper;
+    mapper->SetInputData(polydata);
+    mapper->ScalarVisibilityOff();
+
+    vtkNew<vtkActor> actor;
+    actor->SetMapper(mapper);
+    actor->GetProperty()->SetColor(
+        colors->GetColor3d(part ? "Wheat" : "SteelBlue").GetData());
+    actor->GetProperty()->SetOpacity(0.5);
+    m_assembly->AddPart(actor);
+    m_parts.push_back(actor);
+  }
+
+  void clear()
+  {
+    for (auto& part : m_parts)
+      m_assembly->RemovePart(part);
+    m_parts.clear();
+  }
+
+private:
+  std::vector<vtkSmartPointer<vtkActor>> m_parts;
+  vtkSmartPointer<vtkAssembly> m_assembly;
+};
+
+static double tool_radius()
+{
+  // the tool table entry 0 is the tool in the spindle
+  return emc.status().io.tool.toolTable[0].diameter / 2;
+}
+
+static double tool_length()
+{
+  return std::max(emc.status().io.tool.toolTable[0].offset.tran.z, 0.0);
+}
+
+static std::array<double, 6> machine_limits()
+{
+  const auto& axis = emc.status().motion.axis;
+
+  return {axis[0].minPositionLimit, axis[0].maxPositionLimit,
+          axis[1].minPositionLimit, axis[1].maxPositionLimit,
+          axis[2].minPositionLimit, axis[2].maxPositionLimit};
+}
+
+VtkPreview::VtkPreview(ProgramSource& program) : m_program(program)
 {
   vtkNew<vtkCamera> camera;
   camera->ParallelProjectionOn();
   camera->SetClippingRange(0.01, 10000);
+  m_camera = camera;
   auto renderer = m_viewer.getRenderer();
   renderer->SetActiveCamera(camera);
   vtkNew<AxesActor> axes;
   vtkNew<MachineActor> machine;
   m_tool_actor = std::make_unique<ToolActor>();
+  m_toolpath_actor = std::make_unique<ToolpathActor>();
+  m_highlight_actor = std::make_unique<HighlightActor>("Magenta");
+  m_limit_actor = std::make_unique<HighlightActor>("Red");
+  m_stock_actor = std::make_unique<StockActor>();
+  m_fixture_actor = std::make_unique<FixtureActor>();
+  m_collision_actor = std::make_unique<HighlightActor>("OrangeRed");
+  m_heightmap = std::make_unique<Heightmap>();
+  m_limits = machine_limits();
+  m_soft_limits = m_limits;
+
+  m_transform = vtkSmartPointer<vtkTransform>::New();
+  m_toolpath_actor->get_actor()->SetUserTransform(m_transform);
+  m_highlight_actor->get_actor()->SetUserTransform(m_transform);
+  m_limit_actor->get_actor()->SetUserTransform(m_transform);
+  m_stock_actor->get_actor()->SetUserTransform(m_transform);
+  m_stock_actor->get_actor()->SetVisibility(false);
+  m_collision_actor->get_actor()->SetUserTransform(m_transform);
 
   machine->SetCamera(camera);
-  m_viewer.addActor(axes);
-  m_viewer.addActor(machine);
-  m_viewer.addActor(m_tool_actor->get_actor());
+  _add_actor(axes);
+  _add_actor(machine);
+  _add_actor(m_stock_actor->get_actor());
+  _add_actor(m_fixture_actor->get_actor());
+  _add_actor(m_toolpath_actor->get_actor());
+  _add_actor(m_limit_actor->get_actor());
+  _add_actor(m_collision_actor->get_actor());
+  _add_actor(m_highlight_actor->get_actor());
+  _add_actor(m_tool_actor->get_actor());
+
+  // camera moves from the buttons below and from the interactor style both
+  // end up here, the interactor additionally asks for a render after each
+  // event it handled.
+  _watch(camera, vtkCommand::ModifiedEvent);
+  _watch(renderer, vtkCommand::ModifiedEvent);
+  _watch(m_viewer.getInteractor(), vtkCommand::RenderEvent);
+
+  // invisible window, only used for its context that shares textures with
+  // the main window. windows have to be created on the main thread.
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  m_context =
+      glfwCreateWindow(1, 1, "preview", nullptr, glfwGetCurrentContext());
+  glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+  if (m_context == nullptr) {
+    fprintf(stderr, "preview: can't create shared GL context\n");
+    return;
+  }
+
+  m_render_thread = std::thread(&VtkPreview::_render_loop, this);
+}
+
+VtkPreview::~VtkPreview()
+{
+  if (m_render_thread.joinable()) {
+    {
+      std::lock_guard lock(m_mutex);
+      m_quit = true;
+    }
+    m_wakeup.notify_one();
+    m_render_thread.join();
+  }
+  // their results are posted back, which needs the queue
+  if (m_limit_check.valid())
+    m_limit_check.wait();
+  if (m_stock_sweep.valid())
+    m_stock_sweep.wait();
+  if (m_collision_check.valid())
+    m_collision_check.wait();
+  if (m_context)
+    glfwDestroyWindow(m_context);
+}
+
+void VtkPreview::_set_toolpath(std::shared_ptr<const Toolpath> toolpath)
+{
+  m_toolpath = toolpath;
+  m_toolpath_actor->set_toolpath(toolpath);
+  m_highlight_actor->set_lines(nullptr, {});
+  m_limit_actor->set_lines(nullptr, {});
+  m_collision_actor->set_lines(nullptr, {});
+  {
+    std::lock_guard lock(m_mutex);
+    m_limit_lines = {0, 0, 0};
+    m_collision_summary.clear();
+  }
+  _check_limits();
+  m_dirty = true;
+
+  // picking isn't needed right away, the preview can render meanwhile
+  m_bvh.reset();
+  m_bvh_pending = std::async(std::launch::async, [toolpath] {
+    auto bvh = std::make_unique<ToolpathBvh>();
+    bvh->build(toolpath);
+    return bvh;
+  });
+}
+
+int VtkPreview::picked_line()
+{
+  return m_picked_line.exchange(0);
+}
+
+void VtkPreview::highlight_line(int line)
+{
+  if (line == m_highlight_line)
+    return;
+
+  m_highlight_line = line;
+  _post([this, line] {
+    m_highlight_actor->set_lines(m_toolpath.get(), {line});
+    m_dirty = true;
+  });
+}
+
+// x, y in pixels from the top left of the viewport
+void VtkPreview::_pick(double x, double y)
+{
+  if (m_bvh_pending.valid() &&
+      m_bvh_pending.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready)
+    m_bvh = m_bvh_pending.get();
+  if (!m_bvh)
+    return;
+
+  auto renderer = m_viewer.getRenderer();
+  auto to_world = [&renderer](double dx, double dy, double dz, double* p) {
+    double world[4];
+    renderer->SetDisplayPoint(dx, dy, dz);
+    renderer->DisplayToWorld();
+    renderer->GetWorldPoint(world);
+    for (int i = 0; i < 3; i++)
+      p[i] = world[i] / world[3];
+  };
+
+  // display coordinates have y up. the ray runs through the view volume
+  // from the near to the far clipping plane, the pick radius is measured
+  // at both ends.
+  double dy = m_height - y - 1;
+  double near[3], far[3], near_r[3], far_r[3];
+  to_world(x, dy, 0, near);
+  to_world(x, dy, 1, far);
+  to_world(x + c_pick_radius, dy, 0, near_r);
+  to_world(x + c_pick_radius, dy, 1, far_r);
+
+  // the BVH is in program coordinates. the transform is rigid, so the
+  // radius can be measured on either side.
+  auto inverse = m_transform->GetLinearInverse();
+  inverse->TransformPoint(near, near);
+  inverse->TransformPoint(far, far);
+  inverse->TransformPoint(near_r, near_r);
+  inverse->TransformPoint(far_r, far_r);
+
+  auto distance = [](const double* a, const double* b) {
+    return std::sqrt((a[0] - b[0]) * (a[0] - b[0]) +
+                     (a[1] - b[1]) * (a[1] - b[1]) +
+                     (a[2] - b[2]) * (a[2] - b[2]));
+  };
+
+  int line = m_bvh->pick(near, far, distance(near, near_r),
+                         distance(far, far_r));
+  if (line > 0)
+    m_picked_line = line;
+}
+
+// the toolpath stays in program coordinates, work offsets and the XY
+// rotation only move it around. same math as the DRO, backwards:
+// machine = R(rotation) * (program + g92) + g5x + tool
+void VtkPreview::_update_offsets()
+{
+  const auto& task = emc.status().task;
+  const std::array<double, 10> offsets{
+      task.g5x_offset.tran.x, task.g5x_offset.tran.y, task.g5x_offset.tran.z,
+      task.g92_offset.tran.x, task.g92_offset.tran.y, task.g92_offset.tran.z,
+      task.toolOffset.tran.x, task.toolOffset.tran.y, task.toolOffset.tran.z,
+      task.rotation_xy};
+
+  auto limits = machine_limits();
+
+  if (offsets == m_offsets && limits == m_limits)
+    return;
+
+  m_offsets = offsets;
+  m_limits = limits;
+  _post([this, offsets, limits] {
+    m_transform->Identity();
+    m_transform->Translate(offsets[0] + offsets[6], offsets[1] + offsets[7],
+                           offsets[2] + offsets[8]);
+    m_transform->RotateZ(offsets[9]);
+    m_transform->Translate(offsets[3], offsets[4], offsets[5]);
+    m_toolpath_actor->get_actor()->Modified();
+    m_highlight_actor->get_actor()->Modified();
+    m_limit_actor->get_actor()->Modified();
+    m_soft_limits = limits;
+    m_tool_offset = {offsets[6], offsets[7], offsets[8]};
+    _check_limits();
+  });
+}
+
+// upper 3x4 of the program to machine transform, for the checks running
+// off the render thread
+std::array<double, 12> VtkPreview::_machine_transform() const
+{
+  std::array<double, 12> transform;
+  auto matrix = m_transform->GetMatrix();
+  for (int i = 0; i < 3; i++) {
+    for (int j = 0; j < 4; j++)
+      transform[4 * i + j] = matrix->GetElement(i, j);
+  }
+  return transform;
+}
+
+// the same without the tool offset, program to where the tool tip is. the
+// offset is the last translation, taking it off the last column is enough.
+std::array<double, 12> VtkPreview::_tool_tip_transform() const
+{
+  auto transform = _machine_transform();
+  for (int i = 0; i < 3; i++)
+    transform[4 * i + 3] -= m_tool_offset[i];
+  return transform;
+}
+
+// runs in the background, the result is posted back as a command. a change
+// while a check runs isn't waited for, the render thread would stall for
+// as long as the check takes. the result is dropped and checked again.
+void VtkPreview::_check_limits()
+{
+  if (!m_toolpath)
+    return;
+  if (m_limit_check.valid() &&
+      m_limit_check.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready)
+  {
+    m_limit_pending = true;
+    return;
+  }
+  m_limit_pending = false;
+
+  m_limit_check = std::async(
+      std::launch::async, [this, toolpath = m_toolpath,
+                           transform = _machine_transform(),
+                           limits = m_soft_limits] {
+        auto lines = check_limits(*toolpath, transform, limits);
+        _post([this, toolpath, lines] {
+          if (m_limit_pending) {
+            // this is the check that posted, it's as good as done
+            m_limit_check.wait();
+            _check_limits();
+            return;
+          }
+          if (toolpath != m_toolpath)
+            return;
+          {
+            std::lock_guard lock(m_mutex);
+            m_limit_lines = lines;
+          }
+          m_limit_actor->set_lines(toolpath.get(),
+                                   {lines.begin(), lines.end()});
+          m_dirty = true;
+        });
+      });
+}
+
+void VtkPreview::_update_motion_line()
+{
+  const auto& task = emc.status().task;
+
+  // loaded once for this view and the plan view
+  auto toolpath = m_program.toolpath();
+  if (toolpath && toolpath != m_program_toolpath) {
+    m_program_toolpath = toolpath;
+    // the render thread starts the new toolpath at line 0
+    m_motion_line = 0;
+    m_highlight_line = 0;
+    _post([this, toolpath] { _set_toolpath(toolpath); });
+  }
+
+  int line = task.motionLine;
+  if (line == m_motion_line)
+    return;
+
+  m_motion_line = line;
+  _post([this, line] {
+    if (m_toolpath_actor->set_motion_line(line))
+      m_dirty = true;
+  });
+}
+
+void VtkPreview::_on_modified(vtkObject* caller, unsigned long event,
+                              void* client_data, void* call_data)
+{
+  auto self = static_cast<VtkPreview*>(client_data);
+
+  // rendering itself touches the camera (clipping range) and some actors,
+  // that must not schedule yet another render.
+  if (!self->m_rendering)
+    self->m_dirty = true;
+}
+
+void VtkPreview::_watch(vtkObject* object, unsigned long event)
+{
+  vtkNew<vtkCallbackCommand> callback;
+  callback->SetCallback(&VtkPreview::_on_modified);
+  callback->SetClientData(this);
+  object->AddObserver(event, callback);
 }
 
-VtkPreview::~VtkPreview() {}
+void VtkPreview::_add_actor(const vtkSmartPointer<vtkProp>& actor)
+{
+  m_viewer.addActor(actor);
+  _watch(actor, vtkCommand::ModifiedEvent);
+  m_dirty = true;
+}
 
-void VtkPreview::open_file(std::string path) {}
+void VtkPreview::_post(std::function<void()> command)
+{
+  {
+    std::lock_guard lock(m_mutex);
+    m_commands.push_back(std::move(command));
+  }
+  m_wakeup.notify_one();
+}
 
-void VtkPreview::_update_camera(vtkCamera& camera, double x, double y, double z,
-                                double vx, double vy, double vz)
+void VtkPreview::_render_loop()
 {
-  camera.SetPosition(x, y, z);
-  camera.SetFocalPoint(0, 0, 0);
-  camera.SetViewUp(vx, vy, vz);
-  camera.SetClippingRange(0.01, 10000);
-  m_viewer.getInteractor()->ReInitialize();
+  glfwMakeContextCurrent(m_context);
+
+  while (true) {
+    std::vector<std::function<void()>> commands;
+    {
+      std::unique_lock lock(m_mutex);
+      // a frame can only be rendered when the UI doesn't display the
+      // buffer it would go to
+      m_wakeup.wait(lock, [this] {
+        return m_quit || !m_commands.empty() ||
+               (m_dirty && m_latched == m_front.load());
+      });
+      if (m_quit)
+        break;
+      commands.swap(m_commands);
+    }
+
+    for (auto& command : commands)
+      command();
+
+    std::unique_lock lock(m_mutex);
+    if (m_dirty && m_width > 0 && m_height > 0 &&
+        m_latched == m_front.load())
+    {
+      lock.unlock();
+      _render_frame();
+    }
+  }
+
+  m_viewer.getRenderWindow()->Finalize();
+  for (auto& buffer : m_buffers) {
+    glDeleteFramebuffers(1, &buffer.fbo);
+    glDeleteTextures(1, &buffer.tex);
+  }
+  glfwMakeContextCurrent(nullptr);
+}
+
+void VtkPreview::_resize_buffer(RenderBuffer& buffer)
+{
+  if (buffer.width == m_width && buffer.height == m_height)
+    return;
+
+  if (buffer.tex == 0) {
+    glGenTextures(1, &buffer.tex);
+    glGenFramebuffers(1, &buffer.fbo);
+  }
+  glBindTexture(GL_TEXTURE_2D, buffer.tex);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_width, m_height, 0, GL_RGBA,
+               GL_UNSIGNED_BYTE, nullptr);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glBindTexture(GL_TEXTURE_2D, 0);
+
+  GLint draw_fbo;
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer.fbo);
+  glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                         GL_TEXTURE_2D, buffer.tex, 0);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fbo);
+
+  buffer.width = m_width;
+  buffer.height = m_height;
+}
+
+// renders the scene into VtkViewer's own target and copies it into the
+// buffer the UI doesn't display. the copy is cheap compared to the render
+// and keeps the VtkViewer FBO handling untouched.
+void VtkPreview::_render_frame()
+{
+  int back = (m_front.load() == 0) ? 1 : 0;
+  auto& buffer = m_buffers[back];
+  _resize_buffer(buffer);
+
+  auto render_window = m_viewer.getRenderWindow();
+  m_rendering = true;
+  m_toolpath_actor->update_visibility(
+      m_camera, static_cast<double>(m_width) / m_height);
+  render_window->Render();
+  m_rendering = false;
+  m_dirty = false;
+
+  GLint read_fbo, draw_fbo;
+  glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+  glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &draw_fbo);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER,
+                    render_window->GetDisplayFramebuffer()->GetFBOIndex());
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, buffer.fbo);
+  glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height,
+                    GL_COLOR_BUFFER_BIT, GL_NEAREST);
+  glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, draw_fbo);
+
+  // the other context must only see complete frames
+  glFinish();
+  m_front.store(back);
+}
+
+void VtkPreview::_update_tool_position()
+{
+  // the marker moves every frame while the machine does, the stock is only
+  // cut to positions the machine actually reported
+  auto shown = emc.estimated_position();
+  const auto& pos = emc.status().motion.traj.actualPosition;
+
+  // don't let encoder jitter of a standing machine trigger renders
+  if (CLOSE(shown[0], m_tool_position[0], LINEAR_CLOSENESS) &&
+      CLOSE(shown[1], m_tool_position[1], LINEAR_CLOSENESS) &&
+      CLOSE(shown[2], m_tool_position[2], LINEAR_CLOSENESS))
+    return;
+
+  m_tool_position = shown;
+  bool cut = m_stock_enabled && m_stock_follow;
+  double radius = tool_radius();
+  std::array<double, 3> actual{pos.tran.x, pos.tran.y, pos.tran.z};
+  _post([this, shown, actual, cut, radius] {
+    m_tool_actor->set_position(shown);
+    if (cut)
+      _cut_stock(actual, radius);
+    else
+      m_stock_position.reset();
+  });
+}
+
+bool VtkPreview::_stock_busy() const
+{
+  return m_stock_sweep.valid() &&
+         m_stock_sweep.wait_for(std::chrono::seconds(0)) !=
+             std::future_status::ready;
+}
+
+// position in machine coordinates, the stock is in program coordinates
+// like the toolpath
+void VtkPreview::_cut_stock(std::array<double, 3> position, double radius)
+{
+  if (_stock_busy()) {
+    m_stock_position.reset();
+    return;
+  }
+
+  m_transform->GetLinearInverse()->TransformPoint(position.data(),
+                                                  position.data());
+  // the marker moves between status updates, the reported position doesn't
+  if (m_stock_position == position)
+    return;
+  if (m_stock_position) {
+    m_heightmap->cut(*m_stock_position, position, radius);
+    m_stock_actor->update(*m_heightmap);
+  }
+  m_stock_position = position;
+}
+
+void VtkPreview::_reset_stock()
+{
+  std::array<double, 6> box;
+  std::copy(m_stock_box.begin(), m_stock_box.end(), box.begin());
+  double cell = m_stock_cell;
+
+  _post([this, box, cell] {
+    if (m_stock_sweep.valid())
+      m_stock_sweep.wait();
+    m_stock_position.reset();
+
+    if (m_heightmap->reset(box, cell) != 0) {
+      fprintf(stderr, "preview: invalid stock size\n");
+      m_stock_actor->get_actor()->SetVisibility(false);
+      return;
+    }
+    m_stock_actor->set_heightmap(*m_heightmap);
+    m_stock_actor->get_actor()->SetVisibility(true);
+  });
+}
+
+// building the BVH and sweeping the tool take seconds for big meshes and
+// programs, both happen in the background on a copy of the meshes
+void VtkPreview::_check_collisions(double radius, double length,
+                                   double clearance)
+{
+  if (!m_toolpath || m_meshes.empty())
+    return;
+  if (m_collision_check.valid() &&
+      m_collision_check.wait_for(std::chrono::seconds(0)) !=
+          std::future_status::ready)
+    return;
+
+  m_collision_check = std::async(
+      std::launch::async,
+      [this, toolpath = m_toolpath, meshes = m_meshes,
+       transform = _tool_tip_transform(), radius, length, clearance] {
+        CollisionCheck check;
+        check.set_meshes(meshes);
+        auto hits = check.check(*toolpath, transform, radius, length,
+                                clearance);
+
+        std::vector<int> lines;
+        std::string collisions;
+        int near_misses = 0;
+        for (const auto& hit : hits) {
+          lines.push_back(hit.line);
+          if (hit.distance >= 0)
+            near_misses++;
+          else if (collisions.size() < 40)
+            collisions += " " + std::to_string(hit.line);
+        }
+
+        char summary[128];
+        snprintf(summary, sizeof(summary),
+                 "collisions: %d%s%s, closer than %.1f: %d",
+                 static_cast<int>(hits.size()) - near_misses,
+                 collisions.empty() ? "" : " at", collisions.c_str(),
+                 clearance, near_misses);
+
+        _post([this, toolpath, lines, text = std::string(summary)] {
+          if (toolpath != m_toolpath)
+            return;
+          {
+            std::lock_guard lock(m_mutex);
+            m_collision_summary = text;
+          }
+          m_collision_actor->set_lines(toolpath.get(), lines);
+          m_dirty = true;
+        });
+      });
+}
+
+void VtkPreview::_show_collisions()
+{
+  ImGui::SameLine();
+  if (ImGui::Checkbox("collision", &m_collision_enabled)) {
+    bool visible = m_collision_enabled;
+    _post([this, visible] {
+      m_fixture_actor->get_actor()->SetVisibility(visible);
+      m_collision_actor->get_actor()->SetVisibility(visible);
+    });
+  }
+  if (!m_collision_enabled)
+    return;
+
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 16);
+  ImGui::InputTextWithHint("##mesh", "STL file", m_mesh_path,
+                           sizeof(m_mesh_path));
+  for (bool part : {false, true}) {
+    ImGui::SameLine();
+    if (ImGui::Button(part ? "add part" : "add fixture")) {
+      std::string path = m_mesh_path;
+      _post([this, path, part] {
+        CollisionMesh mesh;
+        mesh.part = part;
+        if (load_stl(path, mesh.triangles) != 0) {
+          fprintf(stderr, "preview: can't read %s\n", path.c_str());
+          return;
+        }
+        m_fixture_actor->add_mesh(mesh.triangles, part);
+        m_meshes.push_back(std::move(mesh));
+      });
+    }
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("clear##mesh")) {
+    _post([this] {
+      m_meshes.clear();
+      m_fixture_actor->clear();
+      m_collision_actor->set_lines(nullptr, {});
+      std::lock_guard lock(m_mutex);
+      m_collision_summary.clear();
+    });
+  }
+  ImGui::SameLine();
+  ImGui::SetNextItemWidth(ImGui::GetFontSize() * 4);
+  ImGui::InputFloat("clearance", &m_clearance, 0, 0, "%.1f");
+  ImGui::SameLine();
+  if (ImGui::Button("check")) {
+    double radius = tool_radius();
+    double length = tool_length();
+    double clearance = m_clearance;
+    _post([=, this] { _check_collisions(radius, length, clearance); });
+  }
+
+  std::string summary;
+  {
+    std::lock_guard lock(m_mutex);
+    summary = m_collision_summary;
+  }
+  if (!summary.empty())
+    ImGui::TextUnformatted(summary.c_str());
+}
+
+void VtkPreview::_show_stock()
+{
+  ImGui::SameLine();
+  if (ImGui::Checkbox("stock", &m_stock_enabled)) {
+    if (m_stock_enabled)
+      _reset_stock();
+    else
+      _post([this] { m_stock_actor->get_actor()->SetVisibility(false); });
+  }
+  if (!m_stock_enabled)
+    return;
+
+  ImGui::SameLine();
+  ImGui::Checkbox("follow", &m_stock_follow);
+  ImGui::SameLine();
+  if (ImGui::Button("cut all")) {
+    // the whole program takes seconds, the preview keeps rendering
+    double radius = tool_radius();
+    _post([this, radius] {
+      if (!m_toolpath || _stock_busy())
+        return;
+      m_stock_position.reset();
+      m_stock_sweep = std::async(
+          std::launch::async, [this, toolpath = m_toolpath, radius] {
+            m_heightmap->cut(*toolpath, radius);
+            _post([this] { m_stock_actor->update(*m_heightmap); });
+          });
+    });
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("reset"))
+    _reset_stock();
+
+  ImGui::PushItemWidth(ImGui::GetFontSize() * 8);
+  ImGui::InputFloat2("X##stock", &m_stock_box[0], "%.1f");
+  ImGui::SameLine();
+  ImGui::InputFloat2("Y##stock", &m_stock_box[2], "%.1f");
+  ImGui::SameLine();
+  ImGui::InputFloat2("Z##stock", &m_stock_box[4], "%.1f");
+  ImGui::SameLine();
+  ImGui::InputFloat("cell##stock", &m_stock_cell, 0, 0, "%.2f");
+  ImGui::PopItemWidth();
+}
+
+// shows the last frame the render thread completed. a newly completed frame
+// is latched at this point, which hands the previously displayed buffer
+// back to the render thread; the draw data referencing it has already been
+// submitted by then.
+void VtkPreview::_render_viewport()
+{
+  ImVec2 size = ImGui::GetContentRegionAvail();
+  if (size.x < 1 || size.y < 1)
+    return;
+
+  if (size.x != m_viewport_size.x || size.y != m_viewport_size.y) {
+    m_viewport_size = size;
+    _post([this, size] {
+      // reallocates the texture, so its content is gone
+      m_viewer.setViewportSize(size);
+      m_width = static_cast<int>(size.x);
+      m_height = static_cast<int>(size.y);
+      m_dirty = true;
+    });
+  }
+
+  int front = m_front.load();
+  if (front != m_displayed) {
+    {
+      std::lock_guard lock(m_mutex);
+      m_latched = front;
+    }
+    m_wakeup.notify_one();
+    m_displayed = front;
+  }
+
+  ImGui::BeginChild("##Viewport", size, true,
+                    ImGuiWindowFlags_NoScrollbar |
+                        ImGuiWindowFlags_NoScrollWithMouse);
+  if (m_displayed >= 0) {
+    ImGui::Image(reinterpret_cast<ImTextureID>(
+                     static_cast<intptr_t>(m_buffers[m_displayed].tex)),
+                 ImGui::GetContentRegionAvail(), ImVec2(0, 1), ImVec2(1, 0));
+  }
+  _process_events();
+  ImGui::EndChild();
+}
+
+// forward ImGui mouse input to the interactor. unlike VtkViewer, idle mouse
+// positions are not sent, so a resting cursor doesn't cause any VTK work.
+void VtkPreview::_process_events()
+{
+  if (!ImGui::IsWindowFocused() && !ImGui::IsWindowHovered())
+    return;
+
+  ImGuiIO& io = ImGui::GetIO();
+  io.ConfigWindowsMoveFromTitleBarOnly = true;
+
+  std::vector<unsigned long> events;
+  if (ImGui::IsWindowHovered()) {
+    if (io.MouseClicked[ImGuiMouseButton_Left])
+      events.push_back(vtkCommand::LeftButtonPressEvent);
+    else if (io.MouseClicked[ImGuiMouseButton_Right])
+      events.push_back(vtkCommand::RightButtonPressEvent);
+    else if (io.MouseClicked[ImGuiMouseButton_Middle])
+      events.push_back(vtkCommand::MiddleButtonPressEvent);
+    else if (io.MouseWheel > 0)
+      events.push_back(vtkCommand::MouseWheelForwardEvent);
+    else if (io.MouseWheel < 0)
+      events.push_back(vtkCommand::MouseWheelBackwardEvent);
+  }
+
+  if (io.MouseReleased[ImGuiMouseButton_Left])
+    events.push_back(vtkCommand::LeftButtonReleaseEvent);
+  else if (io.MouseReleased[ImGuiMouseButton_Right])
+    events.push_back(vtkCommand::RightButtonReleaseEvent);
+  else if (io.MouseReleased[ImGuiMouseButton_Middle])
+    events.push_back(vtkCommand::MiddleButtonReleaseEvent);
+
+  if (io.MouseDelta.x != 0 || io.MouseDelta.y != 0)
+    events.push_back(vtkCommand::MouseMoveEvent);
+
+  if (events.empty())
+    return;
+
+  ImVec2 viewport_pos = ImGui::GetCursorStartPos();
+  double xpos = io.MousePos.x - (ImGui::GetWindowPos().x + viewport_pos.x);
+  double ypos = io.MousePos.y - (ImGui::GetWindowPos().y + viewport_pos.y);
+
+  // a left click that didn't turn into a rotation picks a segment
+  if (ImGui::IsWindowHovered() && io.MouseReleased[ImGuiMouseButton_Left] &&
+      io.MouseDragMaxDistanceSqr[ImGuiMouseButton_Left] <
+          c_click_distance * c_click_distance)
+    _post([=, this] { _pick(xpos, ypos); });
+
+  bool ctrl = io.KeyCtrl;
+  bool shift = io.KeyShift;
+  bool dclick = io.MouseDoubleClicked[0] || io.MouseDoubleClicked[1] ||
+                io.MouseDoubleClicked[2];
+
+  _post([=, this] {
+    auto interactor = m_viewer.getInteractor();
+    interactor->SetEventInformationFlipY(xpos, ypos, ctrl, shift, dclick);
+    for (auto event : events)
+      interactor->InvokeEvent(event, nullptr);
+  });
+}
+
+void VtkPreview::_update_camera(double x, double y, double z, double vx,
+                                double vy, double vz)
+{
+  _post([=, this] {
+    m_camera->SetPosition(x, y, z);
+    m_camera->SetFocalPoint(0, 0, 0);
+    m_camera->SetViewUp(vx, vy, vz);
+    m_camera->SetClippingRange(0.01, 10000);
+    m_viewer.getInteractor()->ReInitialize();
+  });
 }
 
 void VtkPreview::show()
 {
   ImGui::SetNextWindowSize(ImVec2(360, 240), ImGuiCond_FirstUseEver);
 
-  ImGui::Begin("preview");
-  auto renderer = m_viewer.getRenderer();
-  auto camera = renderer->GetActiveCamera();
+  if (!ImGui::Begin("preview")) {
+    // collapsed or docked away, nothing to render
+    ImGui::End();
+    return;
+  }
 
   if (ImGui::Button("ORTHO")) {
-    camera->ParallelProjectionOn();
-    m_viewer.getInteractor()->ReInitialize();
+    _post([this] {
+      m_camera->ParallelProjectionOn();
+      m_viewer.getInteractor()->ReInitialize();
+    });
   }
   ImGui::SameLine();
   if (ImGui::Button("PERSP")) {
-    camera->ParallelProjectionOff();
-    m_viewer.getInteractor()->ReInitialize();
+    _post([this] {
+      m_camera->ParallelProjectionOff();
+      m_viewer.getInteractor()->ReInitialize();
+    });
   }
   ImGui::SameLine();
   if (ImGui::Button("P")) {
-    _update_camera(*camera, 1000, -1000, 1000, 0, 0, 1);
+    _update_camera(1000, -1000, 1000, 0, 0, 1);
   }
   ImGui::SameLine();
   if (ImGui::Button("X")) {
     // camera distance should probably be configurable somewhere
-    _update_camera(*camera, 0, -1000, 0, 0, 0, 1);
+    _update_camera(0, -1000, 0, 0, 0, 1);
   }
   ImGui::SameLine();
   if (ImGui::Button("Y")) {
-    _update_camera(*camera, 1000, 0, 0, 0, 0, 1);
+    _update_camera(1000, 0, 0, 0, 0, 1);
   }
   ImGui::SameLine();
   if (ImGui::Button("Z")) {
-    _update_camera(*camera, 0, 0, 1000, 0, 1, 0);
+    _update_camera(0, 0, 1000, 0, 1, 0);
   }
   // for lathe
   // ImGui::SameLine();
   // if (ImGui::Button("XZ")) {
-  //   _update_camera(*camera, 0, 1000, 0, 1, 0, 0);
+  //   _update_camera(0, 1000, 0, 1, 0, 0);
   // }
   // ImGui::SameLine();
   // if (ImGui::Button("X2")) {
-  //   _update_camera(*camera, 0, -1000, 0, -1, 0, 0);
+  //   _update_camera(0, -1000, 0, -1, 0, 0);
   // }
   ImGui::SameLine();
   if (ImGui::Button("+")) {
-    if (camera->GetParallelProjection()) {
-      camera->SetParallelScale(camera->GetParallelScale() * (1.0 / 1.1));
-    }
-    else {
-      camera->Zoom(1.1);
-    }
+    _post([this] {
+      if (m_camera->GetParallelProjection()) {
+        m_camera->SetParallelScale(m_camera->GetParallelScale() *
+                                   (1.0 / 1.1));
+      }
+      else {
+        m_camera->Zoom(1.1);
+      }
+    });
   }
   ImGui::SameLine();
   if (ImGui::Button("-")) {
-    if (camera->GetParallelProjection()) {
-      camera->SetParallelScale(camera->GetParallelScale() * 1.1);
-    }
-    else {
-      camera->Zoom(1.0 / 1.1);
+    _post([this] {
+      if (m_camera->GetParallelProjection()) {
+        m_camera->SetParallelScale(m_camera->GetParallelScale() * 1.1);
+      }
+      else {
+        m_camera->Zoom(1.0 / 1.1);
+      }
+    });
+  }
+
+  _show_stock();
+  _show_collisions();
+
+  LimitLines limit_lines;
+  {
+    std::lock_guard lock(m_mutex);
+    limit_lines = m_limit_lines;
+  }
+  for (int axis = 0; axis < 3; axis++) {
+    if (limit_lines[axis] > 0) {
+      ImGui::TextColored(ImVec4(1.0f, 0.3f, 0.3f, 1.0f),
+                         "%c leaves soft limits at line %d", "XYZ"[axis],
+                         limit_lines[axis]);
     }
   }
 
-  m_tool_actor->set_position(emc.status().motion.traj.actualPosition);
-  m_viewer.render();
+  _update_offsets();
+  _update_motion_line();
+  _update_tool_position();
+  _render_viewport();
   ImGui::End();
 }
 
-} // namespace ImCNC
\ No newline at end of file
+} // namespace ImCNC
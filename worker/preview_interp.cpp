@@ -0,0 +1,519 @@
+/*
+ * preview_interp.cpp
+ *
+ * interpreter worker for the preview
+ * (c) 2023 Robert Schöftner <rs@unfoo.net>
+ *
+ * runs the LinuxCNC interpreter on a program against a canon that only
+ * records what the preview needs and writes it to the CanonRing the
+ * preview passed in:
+ *
+ *   preview_interp <ring fd> <program> [ini]
+ *
+ * started and killed by InterpSource, not meant to be run by hand. the
+ * parameter file named in the ini is copied first, so nothing the program
+ * does to parameters reaches the machine's.
+ */
+
+#include "canon.hh"
+#include "canon_ring.hpp"
+#include "inifile.hh"
+#include "interp_base.hh"
+#include "interp_return.hh"
+#include "tooldata.hh"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <initializer_list>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using ImCNC::CanonOp;
+using ImCNC::CanonRecord;
+using ImCNC::CanonRing;
+
+// bytes collected before they go to the ring
+static constexpr std::size_t c_batch = 64 << 10;
+static constexpr int c_spline_segments = 16;
+
+static CanonRing ring;
+static std::vector<unsigned char> batch;
+static InterpBase* interp = nullptr;
+// line of the main program being executed, what moves from subroutines and
+// remaps are drawn as
+static int main_line = 0;
+static std::string parameter_file;
+
+// last position handed to canon, program units
+static double position[9] = {};
+static CANON_PLANE plane = CANON_PLANE_XY;
+static CANON_UNITS length_units = CANON_UNITS_MM;
+
+// the interpreter checks these
+int _task = 0;
+USER_DEFINED_FUNCTION_TYPE USER_DEFINED_FUNCTION[USER_DEFINED_FUNCTION_NUM];
+
+static void flush()
+{
+  // the preview doesn't want this program anymore
+  if (ring.write(batch.data(), batch.size()) != 0)
+    _exit(0);
+  batch.clear();
+}
+
+static void emit(const CanonRecord& record)
+{
+  auto p = reinterpret_cast<const unsigned char*>(&record);
+  batch.insert(batch.end(), p, p + record.size);
+  if (batch.size() >= c_batch)
+    flush();
+}
+
+static void emit(CanonOp op, int line, std::initializer_list<double> values)
+{
+  CanonRecord record{};
+  record.op = op;
+  record.line = line;
+  std::size_t n = 0;
+  for (double v : values)
+    record.values[n++] = v;
+  record.size =
+      static_cast<std::uint16_t>(offsetof(CanonRecord, values) + 8 * n);
+  emit(record);
+}
+
+static void emit_error(int line, const char* text)
+{
+  CanonRecord record{};
+  record.op = CanonOp::ERROR;
+  record.line = line;
+  auto buffer = reinterpret_cast<char*>(record.values);
+  std::size_t length = std::min(strlen(text), sizeof(record.values) - 1);
+  std::memcpy(buffer, text, length);
+  record.size = static_cast<std::uint16_t>(offsetof(CanonRecord, values) +
+                                           (length + 8) / 8 * 8);
+  emit(record);
+}
+
+static int line_of(int lineno)
+{
+  return (interp && interp->call_level() > 0) ? main_line : lineno;
+}
+
+static void move(CanonOp op, int lineno, double x, double y, double z,
+                 double a, double b, double c, double u, double v, double w)
+{
+  const double p[] = {x, y, z, a, b, c, u, v, w};
+  std::memcpy(position, p, sizeof(position));
+  emit(op, line_of(lineno), {x, y, z});
+}
+
+/* canon: what the preview draws */
+
+void STRAIGHT_TRAVERSE(int lineno, double x, double y, double z, double a,
+                       double b, double c, double u, double v, double w)
+{
+  move(CanonOp::TRAVERSE, lineno, x, y, z, a, b, c, u, v, w);
+}
+
+void STRAIGHT_FEED(int lineno, double x, double y, double z, double a,
+                   double b, double c, double u, double v, double w)
+{
+  move(CanonOp::FEED, lineno, x, y, z, a, b, c, u, v, w);
+}
+
+void STRAIGHT_PROBE(int lineno, double x, double y, double z, double a,
+                    double b, double c, double u, double v, double w,
+                    unsigned char probe_type)
+{
+  move(CanonOp::PROBE, lineno, x, y, z, a, b, c, u, v, w);
+}
+
+void ARC_FEED(int lineno, double first_end, double second_end,
+              double first_axis, double second_axis, int rotation,
+              double axis_end_point, double a, double b, double c, double u,
+              double v, double w)
+{
+  switch (plane) {
+  case CANON_PLANE_YZ:
+    position[1] = first_end;
+    position[2] = second_end;
+    position[0] = axis_end_point;
+    break;
+  case CANON_PLANE_XZ:
+    position[2] = first_end;
+    position[0] = second_end;
+    position[1] = axis_end_point;
+    break;
+  default:
+    position[0] = first_end;
+    position[1] = second_end;
+    position[2] = axis_end_point;
+    break;
+  }
+  emit(CanonOp::ARC, line_of(lineno),
+       {first_end, second_end, first_axis, second_axis,
+        static_cast<double>(rotation), axis_end_point});
+}
+
+void RIGID_TAP(int lineno, double x, double y, double z, double scale)
+{
+  double start[9];
+  std::memcpy(start, position, sizeof(start));
+  move(CanonOp::FEED, lineno, x, y, z, start[3], start[4], start[5],
+       start[6], start[7], start[8]);
+  move(CanonOp::FEED, lineno, start[0], start[1], start[2], start[3],
+       start[4], start[5], start[6], start[7], start[8]);
+}
+
+// G5 and G5.1 come as bezier segments in the XY plane
+static void bezier(int lineno, std::initializer_list<double> controls)
+{
+  double p[4][2];
+  int n = 0;
+  p[n][0] = position[0];
+  p[n][1] = position[1];
+  for (auto it = controls.begin(); it != controls.end(); it += 2) {
+    n++;
+    p[n][0] = it[0];
+    p[n][1] = it[1];
+  }
+
+  for (int i = 1; i <= c_spline_segments; i++) {
+    double t = static_cast<double>(i) / c_spline_segments;
+    // de Casteljau
+    double q[4][2];
+    std::memcpy(q, p, sizeof(q));
+    for (int k = n; k > 0; k--) {
+      for (int j = 0; j < k; j++) {
+        q[j][0] += (q[j + 1][0] - q[j][0]) * t;
+        q[j][1] += (q[j + 1][1] - q[j][1]) * t;
+      }
+    }
+    move(CanonOp::FEED, lineno, q[0][0], q[0][1], position[2], position[3],
+         position[4], position[5], position[6], position[7], position[8]);
+  }
+}
+
+void SPLINE_FEED(int lineno, double x1, double y1, double x2, double y2)
+{
+  bezier(lineno, {x1, y1, x2, y2});
+}
+
+void SPLINE_FEED(int lineno, double x1, double y1, double x2, double y2,
+                 double x3, double y3)
+{
+  bezier(lineno, {x1, y1, x2, y2, x3, y3});
+}
+
+// drawn as a line to the last control point
+void NURBS_FEED(int lineno, std::vector<CONTROL_POINT> nurbs_control_points,
+                unsigned int k)
+{
+  if (nurbs_control_points.empty())
+    return;
+  const auto& last = nurbs_control_points.back();
+  move(CanonOp::FEED, lineno, last.X, last.Y, position[2], position[3],
+       position[4], position[5], position[6], position[7], position[8]);
+}
+
+void SELECT_PLANE(CANON_PLANE pl)
+{
+  plane = pl;
+  emit(CanonOp::PLANE, main_line, {static_cast<double>(pl)});
+}
+
+void USE_LENGTH_UNITS(CANON_UNITS u)
+{
+  length_units = u;
+  double mm = (u == CANON_UNITS_INCHES) ? 25.4
+              : (u == CANON_UNITS_CM)   ? 10.0
+                                        : 1.0;
+  emit(CanonOp::UNITS, main_line, {mm});
+}
+
+void SET_G5X_OFFSET(int origin, double x, double y, double z, double a,
+                    double b, double c, double u, double v, double w)
+{
+  emit(CanonOp::G5X, main_line, {x, y, z});
+}
+
+void SET_G92_OFFSET(double x, double y, double z, double a, double b,
+                    double c, double u, double v, double w)
+{
+  emit(CanonOp::G92, main_line, {x, y, z});
+}
+
+void SET_XY_ROTATION(double t)
+{
+  emit(CanonOp::ROTATION, main_line, {t});
+}
+
+void CANON_ERROR(const char* fmt, ...)
+{
+  char text[256];
+  va_list ap;
+  va_start(ap, fmt);
+  vsnprintf(text, sizeof(text), fmt, ap);
+  va_end(ap);
+  emit_error(main_line, text);
+}
+
+/* canon: what the interpreter asks */
+
+void GET_EXTERNAL_PARAMETER_FILE_NAME(char* filename, int max_size)
+{
+  snprintf(filename, max_size, "%s", parameter_file.c_str());
+}
+
+CANON_POSITION GET_EXTERNAL_POSITION()
+{
+  return CANON_POSITION(position[0], position[1], position[2], position[3],
+                        position[4], position[5], position[6], position[7],
+                        position[8]);
+}
+
+CANON_POSITION GET_EXTERNAL_PROBE_POSITION()
+{
+  return GET_EXTERNAL_POSITION();
+}
+
+CANON_PLANE GET_EXTERNAL_PLANE() { return plane; }
+CANON_UNITS GET_EXTERNAL_LENGTH_UNIT_TYPE() { return length_units; }
+double GET_EXTERNAL_LENGTH_UNITS() { return 1.0; }
+double GET_EXTERNAL_ANGLE_UNITS() { return 1.0; }
+double GET_EXTERNAL_FEED_RATE() { return 1.0; }
+double GET_EXTERNAL_TRAVERSE_RATE() { return 0.0; }
+int GET_EXTERNAL_FLOOD() { return 0; }
+int GET_EXTERNAL_MIST() { return 0; }
+CANON_MOTION_MODE GET_EXTERNAL_MOTION_CONTROL_MODE()
+{
+  return CANON_CONTINUOUS;
+}
+double GET_EXTERNAL_MOTION_CONTROL_TOLERANCE() { return 0.0; }
+double GET_EXTERNAL_MOTION_CONTROL_NAIVECAM_TOLERANCE() { return 0.0; }
+int GET_EXTERNAL_PROBE_TRIPPED_VALUE() { return 0; }
+double GET_EXTERNAL_PROBE_VALUE() { return 0.0; }
+int GET_EXTERNAL_QUEUE_EMPTY() { return 1; }
+double GET_EXTERNAL_SPEED(int spindle) { return 0.0; }
+CANON_DIRECTION GET_EXTERNAL_SPINDLE(int spindle) { return CANON_STOPPED; }
+int GET_EXTERNAL_TOOL_SLOT() { return 0; }
+int GET_EXTERNAL_SELECTED_TOOL_SLOT() { return 0; }
+int GET_EXTERNAL_TC_FAULT() { return 0; }
+int GET_EXTERNAL_TC_REASON() { return 0; }
+int GET_EXTERNAL_FEED_OVERRIDE_ENABLE() { return 1; }
+int GET_EXTERNAL_SPINDLE_OVERRIDE_ENABLE(int spindle) { return 1; }
+int GET_EXTERNAL_ADAPTIVE_FEED_ENABLE() { return 0; }
+int GET_EXTERNAL_FEED_HOLD_ENABLE() { return 1; }
+int GET_EXTERNAL_DIGITAL_INPUT(int index, int def) { return def; }
+double GET_EXTERNAL_ANALOG_INPUT(int index, double def) { return def; }
+int GET_EXTERNAL_AXIS_MASK() { return 0x1ff; }
+int GET_EXTERNAL_OFFSET_APPLIED() { return 0; }
+EmcPose GET_EXTERNAL_OFFSETS() { return EmcPose{}; }
+bool GET_BLOCK_DELETE() { return false; }
+bool GET_OPTIONAL_PROGRAM_STOP() { return false; }
+
+CANON_TOOL_TABLE GET_EXTERNAL_TOOL_TABLE(int pocket)
+{
+  CANON_TOOL_TABLE tool{};
+  tool.toolno = -1;
+  return tool;
+}
+
+int USER_DEFINED_FUNCTION_ADD(USER_DEFINED_FUNCTION_TYPE func, int num)
+{
+  if (num < 0 || num >= USER_DEFINED_FUNCTION_NUM)
+    return -1;
+  USER_DEFINED_FUNCTION[num] = func;
+  return 0;
+}
+
+/* canon: nothing to draw */
+
+void INIT_CANON() {}
+void FINISH() {}
+void ON_RESET() {}
+void CANON_UPDATE_END_POINT(double x, double y, double z, double a, double b,
+                            double c, double u, double v, double w)
+{
+  const double p[] = {x, y, z, a, b, c, u, v, w};
+  std::memcpy(position, p, sizeof(position));
+}
+void SET_TRAVERSE_RATE(double rate) {}
+void SET_FEED_RATE(double rate) {}
+void SET_FEED_REFERENCE(CANON_FEED_REFERENCE reference) {}
+void SET_FEED_MODE(int spindle, int mode) {}
+void SET_MOTION_CONTROL_MODE(CANON_MOTION_MODE mode, double tolerance) {}
+void SET_NAIVECAM_TOLERANCE(double tolerance) {}
+void SET_CUTTER_RADIUS_COMPENSATION(double radius) {}
+void START_CUTTER_RADIUS_COMPENSATION(int direction) {}
+void STOP_CUTTER_RADIUS_COMPENSATION() {}
+void START_SPEED_FEED_SYNCH(int spindle, double feed_per_revolution,
+                            bool velocity_mode)
+{
+}
+void STOP_SPEED_FEED_SYNCH() {}
+void STOP() {}
+void DWELL(double seconds) {}
+void SET_SPINDLE_MODE(int spindle, double mode) {}
+void SPINDLE_RETRACT_TRAVERSE() {}
+void START_SPINDLE_CLOCKWISE(int spindle, int wait_for_atspeed) {}
+void START_SPINDLE_COUNTERCLOCKWISE(int spindle, int wait_for_atspeed) {}
+void SET_SPINDLE_SPEED(int spindle, double r) {}
+void STOP_SPINDLE_TURNING(int spindle) {}
+void SPINDLE_RETRACT() {}
+void ORIENT_SPINDLE(int spindle, double orientation, int mode) {}
+void WAIT_SPINDLE_ORIENT_COMPLETE(int spindle, double timeout) {}
+void LOCK_SPINDLE_Z() {}
+void USE_SPINDLE_FORCE() {}
+void USE_NO_SPINDLE_FORCE() {}
+void SET_TOOL_TABLE_ENTRY(int pocket, int toolno, EmcPose offset,
+                          double diameter, double frontangle,
+                          double backangle, int orientation)
+{
+}
+void USE_TOOL_LENGTH_OFFSET(EmcPose offset) {}
+void START_CHANGE() {}
+void CHANGE_TOOL() {}
+void SELECT_TOOL(int tool) {}
+void CHANGE_TOOL_NUMBER(int number) {}
+void RELOAD_TOOLDATA() {}
+void CLAMP_AXIS(CANON_AXIS axis) {}
+void UNCLAMP_AXIS(CANON_AXIS axis) {}
+void COMMENT(const char* s) {}
+void DISABLE_ADAPTIVE_FEED() {}
+void ENABLE_ADAPTIVE_FEED() {}
+void DISABLE_FEED_OVERRIDE() {}
+void ENABLE_FEED_OVERRIDE() {}
+void DISABLE_SPEED_OVERRIDE(int spindle) {}
+void ENABLE_SPEED_OVERRIDE(int spindle) {}
+void DISABLE_FEED_HOLD() {}
+void ENABLE_FEED_HOLD() {}
+void FLOOD_OFF() {}
+void FLOOD_ON() {}
+void MIST_OFF() {}
+void MIST_ON() {}
+void MESSAGE(char* s) {}
+void LOG(char* s) {}
+void LOGOPEN(char* s) {}
+void LOGAPPEND(char* s) {}
+void LOGCLOSE() {}
+void PALLET_SHUTTLE() {}
+void TURN_PROBE_OFF() {}
+void TURN_PROBE_ON() {}
+void NURB_KNOT_VECTOR() {}
+void NURB_CONTROL_POINT(int i, double x, double y, double z, double w) {}
+void NURB_FEED(double sStart, double sEnd) {}
+void SET_BLOCK_DELETE(bool enabled) {}
+void SET_OPTIONAL_PROGRAM_STOP(bool state) {}
+void OPTIONAL_PROGRAM_STOP() {}
+void PROGRAM_END() {}
+void PROGRAM_STOP() {}
+void SET_MOTION_OUTPUT_BIT(int index) {}
+void CLEAR_MOTION_OUTPUT_BIT(int index) {}
+void SET_AUX_OUTPUT_BIT(int index) {}
+void CLEAR_AUX_OUTPUT_BIT(int index) {}
+void SET_MOTION_OUTPUT_VALUE(int index, double value) {}
+void SET_AUX_OUTPUT_VALUE(int index, double value) {}
+int WAIT(int index, int input_type, int wait_type, double timeout)
+{
+  return 0;
+}
+int UNLOCK_ROTARY(int line_no, int joint_num) { return 0; }
+int LOCK_ROTARY(int line_no, int joint_num) { return 0; }
+void PLUGIN_CALL(int len, const char* call) {}
+void IO_PLUGIN_CALL(int len, const char* call) {}
+void UPDATE_TAG(StateTag tag) {}
+
+// a private copy, relative names are relative to the ini
+static int copy_parameter_file(const char* ini)
+{
+  IniFile inifile;
+  if (!inifile.Open(ini))
+    return -1;
+
+  std::filesystem::path source;
+  if (const char* name = inifile.Find("PARAMETER_FILE", "RS274NGC"))
+    source = std::filesystem::path(ini).parent_path() / name;
+  inifile.Close();
+  if (source.empty())
+    return -1;
+
+  char name[] = "/tmp/preview_interp_XXXXXX";
+  int fd = mkstemp(name);
+  if (fd < 0)
+    return -1;
+  close(fd);
+  parameter_file = name;
+
+  std::error_code ec;
+  std::filesystem::copy_file(
+      source, parameter_file,
+      std::filesystem::copy_options::overwrite_existing, ec);
+  if (ec) {
+    unlink(name);
+    parameter_file.clear();
+    return -1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc < 3) {
+    fprintf(stderr, "usage: %s <ring fd> <program> [ini]\n", argv[0]);
+    return 1;
+  }
+  if (ring.attach(atoi(argv[1])) != 0) {
+    fprintf(stderr, "preview_interp: can't map the canon ring\n");
+    return 1;
+  }
+
+  // the interpreter reads subroutine paths, remaps and the like from the
+  // ini named in the environment
+  if (argc > 3 && *argv[3]) {
+    setenv("INI_FILE_NAME", argv[3], 1);
+    if (copy_parameter_file(argv[3]) != 0)
+      fprintf(stderr, "preview_interp: no parameter file, using defaults\n");
+  }
+  // the tool table of a running LinuxCNC, if there is one
+  tool_mmap_user();
+
+  interp = makeInterp();
+  int result = interp->init();
+  // init() has read it, and the preview kills a run it doesn't want anymore
+  // before main could clean up
+  if (!parameter_file.empty())
+    unlink(parameter_file.c_str());
+  if (result <= INTERP_MIN_ERROR)
+    result = interp->open(argv[2]);
+
+  while (result == INTERP_OK || result == INTERP_EXECUTE_FINISH) {
+    result = interp->read();
+    if (result != INTERP_OK && result != INTERP_EXECUTE_FINISH)
+      break;
+    if (interp->call_level() == 0)
+      main_line = interp->sequence_number();
+    result = interp->execute();
+  }
+
+  if (result > INTERP_MIN_ERROR) {
+    char text[LINELEN] = "";
+    interp->error_text(result, text, sizeof(text));
+    emit_error(main_line, text);
+  }
+  emit(CanonOp::END, result, {});
+  flush();
+  ring.close_writer();
+
+  // not interp->exit(), that would write the parameters back
+  interp->close();
+  return 0;
+}